@@ -28,95 +28,32 @@
 #ifndef wpe_platform_ipc_bcmnexuswl_h
 #define wpe_platform_ipc_bcmnexuswl_h
 
-#include <memory>
+#include "ipc-schema.h"
 #include <stdint.h>
-#include <cstring>
 
 namespace IPC {
 
 namespace BCMNexusWL {
 
-struct TargetConstruction {
+struct TargetConstructionFields {
     uint32_t handle;
     uint32_t width;
     uint32_t height;
-    uint8_t padding[12];
-
-    static const uint64_t code = 1;
-    static void construct(Message& message, uint32_t handle, uint32_t width, uint32_t height)
-    {
-        message.messageCode = code;
-
-        auto& messageData = *reinterpret_cast<TargetConstruction*>(std::addressof(message.messageData));
-        messageData.handle = handle;
-        messageData.width = width;
-        messageData.height = height;
-    }
-    static TargetConstruction& cast(Message& message)
-    {
-        return *reinterpret_cast<TargetConstruction*>(std::addressof(message.messageData));
-    }
 };
-static_assert(sizeof(TargetConstruction) == Message::dataSize, "TargetConstruction is of correct size");
+using TargetConstruction = Schema::MessageType<1, TargetConstructionFields>;
 
+// The whole client certificate, sent with sendBlob().
 struct Authentication {
-    uint32_t authDataSize;
-    uint32_t chunkSize;
-    uint8_t data[16];
-
-    static const uint64_t code = 2;
-    static const size_t maxChunkSize = 16;
-    static void construct(Message& message, size_t authDataSize, size_t chunkSize, const uint8_t* data)
-    {
-        message.messageCode = code;
-
-        auto& messageData = *reinterpret_cast<Authentication*>(std::addressof(message.messageData));
-        messageData.authDataSize = authDataSize;
-        messageData.chunkSize = chunkSize;
-        memcpy(messageData.data, data, chunkSize);
-    }
-    static Authentication& cast(Message& message)
-    {
-        return *reinterpret_cast<Authentication*>(std::addressof(message.messageData));
-    }
+    static const uint32_t code = 2;
 };
-static_assert(sizeof(Authentication) == Message::dataSize, "Authentication is of correct size");
 
-struct BufferCommit {
+struct BufferCommitFields {
     uint32_t width;
     uint32_t height;
-    uint8_t padding[16];
-
-    static const uint64_t code = 3;
-    static void construct(Message& message, uint32_t width, uint32_t height)
-    {
-        message.messageCode = code;
-
-        auto& messageData = *reinterpret_cast<BufferCommit*>(std::addressof(message.messageData));
-        messageData.width = width;
-        messageData.height = height;
-    }
-    static BufferCommit& cast(Message& message)
-    {
-        return *reinterpret_cast<BufferCommit*>(std::addressof(message.messageData));
-    }
 };
-static_assert(sizeof(BufferCommit) == Message::dataSize, "BufferCommit is of correct size");
+using BufferCommit = Schema::MessageType<3, BufferCommitFields>;
 
-struct FrameComplete {
-    int8_t padding[24];
-
-    static const uint64_t code = 4;
-    static void construct(Message& message)
-    {
-        message.messageCode = code;
-    }
-    static FrameComplete& cast(Message& message)
-    {
-        return *reinterpret_cast<FrameComplete*>(std::addressof(message.messageData));
-    }
-};
-static_assert(sizeof(FrameComplete) == Message::dataSize, "FrameComplete is of correct size");
+using FrameComplete = Schema::MessageType<4, Schema::NoFields>;
 
 } // namespace BCMNexusWL
 
@@ -29,6 +29,7 @@
 
 #include "ipc.h"
 #include "ipc-bcmnexuswl.h"
+#include "ipc-blob.h"
 #include <EGL/egl.h>
 #include <cstring>
 #include <refsw/nexus_config.h>
@@ -49,12 +50,11 @@ struct Backend {
     ~Backend();
 
     bool authenticated() const { return m_authenticated; }
-    void authenticate(uint32_t, uint32_t, uint8_t*);
+    void authenticate(const uint8_t*, size_t);
     void waitForAuthenticationIfNeeded();
 
     NXPL_PlatformHandle m_nxplHandle { nullptr };
     NxClient_AllocResults m_allocResults;
-    std::string m_authenticationData { };
 
     std::mutex m_authenticationMutex;
     std::condition_variable m_authenticationCondition;
@@ -98,20 +98,21 @@ void Backend::waitForAuthenticationIfNeeded()
         m_authenticationCondition.wait(locker);
 }
 
-void Backend::authenticate(uint32_t authDataSize, uint32_t chunkSize, uint8_t* authData)
+void Backend::authenticate(const uint8_t* authData, size_t authDataSize)
 {
-    m_authenticationData.append(reinterpret_cast<const char*>(authData), chunkSize);
-    if (m_authenticationData.length() != authDataSize)
+    NEXUS_Certificate certificate;
+    if (authDataSize > sizeof(certificate.data)) {
+        fprintf(stderr, "Backend: authentication data is too large\n");
         return;
+    }
 
     // Unregister to register again
     NXPL_UnregisterNexusDisplayPlatform(m_nxplHandle);
     NxClient_Free(&m_allocResults);
     NxClient_Uninit();
 
-    NEXUS_Certificate certificate;
-    BKNI_Memcpy(certificate.data, m_authenticationData.data(), m_authenticationData.length());
-    certificate.length = m_authenticationData.length();
+    BKNI_Memcpy(certificate.data, authData, authDataSize);
+    certificate.length = authDataSize;
 
     NEXUS_ClientAuthenticationSettings authSettings;
     NEXUS_Platform_GetDefaultClientAuthenticationSettings(&authSettings);
@@ -134,12 +135,16 @@ struct EGLTarget : public IPC::Client::Handler {
     void initialize(Backend&);
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
+    void handleMessageWithFds(char* data, size_t size, int* fds, size_t fdCount) override;
 
+    void handleFrameComplete(const IPC::BCMNexusWL::FrameComplete&);
     void constructTarget(uint32_t, uint32_t, uint32_t);
+    void waitForTarget();
 
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
+    IPC::RequestId m_targetRequest { 0 };
     void* m_nativeWindow { nullptr };
     Backend* m_backend { nullptr };
     uint32_t m_width { 0 };
@@ -150,10 +155,29 @@ EGLTarget::EGLTarget(struct wpe_renderer_backend_egl_target* target, int hostFd)
     : target(target)
 {
     ipcClient.initialize(*this, hostFd);
+
+    // Answered once the view backend created the window, by then EGL asks for
+    // it through get_native_window.
+    m_targetRequest = ipcClient.sendRequest(IPC::BCMNexusWL::TargetConstruction::code, nullptr, 0, 0,
+        [](void* data, IPC::RequestStatus status, char* payload, size_t length)
+        {
+            auto& target = *static_cast<EGLTarget*>(data);
+            target.m_targetRequest = 0;
+
+            if (status != IPC::RequestStatus::Answered || length < sizeof(IPC::BCMNexusWL::TargetConstruction)) {
+                fprintf(stderr, "EGLTarget: no target from the view backend\n");
+                return;
+            }
+
+            auto& targetConstruction = *reinterpret_cast<const IPC::BCMNexusWL::TargetConstruction*>(payload);
+            target.constructTarget(targetConstruction.handle, targetConstruction.width, targetConstruction.height);
+        }, this);
 }
 
 EGLTarget::~EGLTarget()
 {
+    if (m_targetRequest)
+        ipcClient.cancelRequest(m_targetRequest);
     ipcClient.deinitialize();
     NXPL_DestroyNativeWindow(m_nativeWindow);
 }
@@ -161,10 +185,23 @@ EGLTarget::~EGLTarget()
 void EGLTarget::initialize(Backend& backend)
 {
     m_backend = &backend;
+}
+
+// See the bcm-rpi backend. The window stays unset when no answer came. There
+// is no lazy mode: NXPL_CreateNativeWindow() needs the client id, so unlike a
+// dispmanx window there is nothing to hand to EGL before the answer.
+void EGLTarget::waitForTarget()
+{
+    if (!m_targetRequest)
+        return;
+
+    IPC::ReadStatus status = ipcClient.waitForResponse(m_targetRequest,
+        IPC::timeoutFromEnvironment("WPE_TARGET_CONSTRUCTION_TIMEOUT", 10000));
+    if (status == IPC::ReadStatus::Dispatched)
+        return;
 
-    // Wait for the TargetConstruction message from wpe_view_backend.
-    while (!m_nativeWindow)
-        ipcClient.readSynchronously();
+    fprintf(stderr, "EGLTarget: %s while waiting for the target\n", status == IPC::ReadStatus::TimedOut ? "timed out" : "disconnected");
+    ipcClient.cancelRequest(m_targetRequest);
 }
 
 void EGLTarget::handleMessage(char* data, size_t size)
@@ -172,28 +209,34 @@ void EGLTarget::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::BCMNexusWL::TargetConstruction::code:
-    {
-        auto& targetConstruction = IPC::BCMNexusWL::TargetConstruction::cast(message);
-        constructTarget(targetConstruction.handle, targetConstruction.width, targetConstruction.height);
-        break;
-    }
-    case IPC::BCMNexusWL::Authentication::code:
-    {
-        auto& authentication = IPC::BCMNexusWL::Authentication::cast(message);
-        m_backend->authenticate(authentication.authDataSize, authentication.chunkSize, authentication.data);
-        break;
-    }
-    case IPC::BCMNexusWL::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::BCMNexusWL::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
+}
+
+void EGLTarget::handleMessageWithFds(char* data, size_t size, int* fds, size_t fdCount)
+{
+    auto& messageCode = *reinterpret_cast<uint32_t*>(data);
+    if (messageCode != IPC::BCMNexusWL::Authentication::code) {
+        IPC::Client::Handler::handleMessageWithFds(data, size, fds, fdCount);
+        return;
+    }
+
+    IPC::Blob* blob = IPC::Blob::adopt(data, size, fds, fdCount);
+    if (!blob)
+        return;
+
+    // May well arrive before initialize().
+    Backend* backend = m_backend ? m_backend : Backend::s_singleton;
+    if (backend)
+        backend->authenticate(blob->data(), blob->size());
+    delete blob;
+}
+
+void EGLTarget::handleFrameComplete(const IPC::BCMNexusWL::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 void EGLTarget::constructTarget(uint32_t handle, uint32_t width, uint32_t height)
@@ -258,6 +301,7 @@ struct wpe_renderer_backend_egl_target_interface bcm_nexus_wayland_renderer_back
     [](void* data) -> EGLNativeWindowType
     {
         auto& target = *static_cast<BCMNexusWL::EGLTarget*>(data);
+        target.waitForTarget();
         return target.m_nativeWindow;
     },
     // resize
@@ -276,6 +320,7 @@ struct wpe_renderer_backend_egl_target_interface bcm_nexus_wayland_renderer_back
         IPC::Message message;
         IPC::BCMNexusWL::BufferCommit::construct(message, target.m_width, target.m_height);
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::BCMNexusWL::FrameComplete::code);
     },
 };
 
@@ -30,12 +30,14 @@
 #include "display.h"
 #include "ipc.h"
 #include "ipc-bcmnexuswl.h"
+#include "ipc-frame-pipeline.h"
 #include "xdg-shell-client-protocol.h"
 #include "nsc-client-protocol.h"
 #include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <unistd.h>
+#include <vector>
 
 namespace BCMNexusWL {
 
@@ -47,16 +49,19 @@ public:
     void initialize();
 
     // IPC::Host::Handler
-    void handleFd(int) override { };
+    void handleFd(int fd) override { close(fd); };
     void handleMessage(char*, size_t) override;
-    void commitBuffer(uint32_t, uint32_t);
+    void handleRequest(IPC::RequestId, uint32_t, char*, size_t) override;
+    void commitBuffer(const IPC::BCMNexusWL::BufferCommit&);
 
     struct wpe_view_backend* backend() { return m_backend; }
     IPC::Host& ipcHost() { return m_ipcHost; }
 
     struct CallbackListenerData {
         IPC::Host* ipcHost;
-        struct wl_callback* frameCallback;
+        IPC::FramePipeline* framePipeline;
+        // One per frame in flight.
+        std::vector<struct wl_callback*> frameCallbacks;
         struct wpe_view_backend* backend;
     };
 
@@ -68,16 +73,23 @@ public:
     };
 
 private:
+    void respondTargetConstruction(IPC::RequestId);
+
     Wayland::Display& m_display;
     struct wpe_view_backend* m_backend;
 
     struct wl_surface* m_surface;
     struct xdg_surface* m_xdgSurface;
 
-    CallbackListenerData m_callbackData { nullptr, nullptr, nullptr};
+    IPC::FramePipeline m_framePipeline;
+    CallbackListenerData m_callbackData { nullptr, nullptr, { }, nullptr };
     NSCData m_nscData { 0, std::string{ }, 0, 0 };
     struct wl_buffer* m_buffer;
 
+    // Target requests that came in before the window was created.
+    bool m_targetCreated { false };
+    std::vector<IPC::RequestId> m_pendingTargetRequests;
+
     IPC::Host m_ipcHost;
 };
 
@@ -97,7 +109,7 @@ const struct wl_callback_listener g_callbackListener = {
     {
         auto& callbackData = *static_cast<ViewBackend::CallbackListenerData*>(data);
 
-        if (callbackData.ipcHost) {
+        if (callbackData.ipcHost && callbackData.framePipeline->displayed()) {
             IPC::Message message;
             IPC::BCMNexusWL::FrameComplete::construct(message);
             callbackData.ipcHost->sendMessage(IPC::Message::data(message), IPC::Message::size);
@@ -105,7 +117,8 @@ const struct wl_callback_listener g_callbackListener = {
 
         wpe_view_backend_dispatch_frame_displayed(callbackData.backend);
 
-        callbackData.frameCallback = nullptr;
+        auto& callbacks = callbackData.frameCallbacks;
+        callbacks.erase(std::find(callbacks.begin(), callbacks.end(), callback));
         wl_callback_destroy(callback);
     },
 };
@@ -163,6 +176,7 @@ ViewBackend::ViewBackend(struct wpe_view_backend* backend)
     wl_nsc_add_listener(m_display.interfaces().nsc, &g_nscListener, &m_nscData);
 
     m_callbackData.ipcHost = &m_ipcHost;
+    m_callbackData.framePipeline = &m_framePipeline;
     m_callbackData.backend = m_backend;
 }
 
@@ -174,9 +188,9 @@ ViewBackend::~ViewBackend()
 
     m_display.unregisterInputClient(m_surface);
 
-    if (m_callbackData.frameCallback)
-        wl_callback_destroy(m_callbackData.frameCallback);
-    m_callbackData = { nullptr, nullptr, nullptr };
+    for (auto* callback : m_callbackData.frameCallbacks)
+        wl_callback_destroy(callback);
+    m_callbackData = { nullptr, nullptr, { }, nullptr };
 
     m_nscData = { 0, std::string{ }, 0, 0 };
 
@@ -200,23 +214,8 @@ void ViewBackend::initialize()
     wl_nsc_authenticate(m_display.interfaces().nsc);
     wl_display_roundtrip(m_display.display());
 
-    IPC::Message message;
-
-    size_t transferredData = 0;
-    size_t totalDataSize = m_nscData.authenticationData.length();
-    const uint8_t* data = reinterpret_cast<const uint8_t*>(m_nscData.authenticationData.data());
-    while (transferredData < totalDataSize) {
-        size_t dataSize;
-        if (totalDataSize - transferredData > IPC::BCMNexusWL::Authentication::maxChunkSize)
-            dataSize = IPC::BCMNexusWL::Authentication::maxChunkSize;
-        else
-            dataSize = totalDataSize - transferredData;
-
-        IPC::BCMNexusWL::Authentication::construct(message, totalDataSize, dataSize, data + transferredData);
-        m_ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
-
-        transferredData += dataSize;
-    }
+    if (!m_ipcHost.sendBlob(IPC::BCMNexusWL::Authentication::code, m_nscData.authenticationData.data(), m_nscData.authenticationData.length()))
+        fprintf(stderr, "ViewBackend: could not send the authentication data\n");
 
     wl_nsc_request_clientID(m_display.interfaces().nsc, WL_NSC_CLIENT_SURFACE);
     wl_display_roundtrip(m_display.display());
@@ -224,9 +223,10 @@ void ViewBackend::initialize()
     wl_nsc_create_window(m_display.interfaces().nsc, m_nscData.clientID, 0, m_nscData.width, m_nscData.height);
     wl_display_roundtrip(m_display.display());
 
-    IPC::BCMNexusWL::TargetConstruction::construct(message, m_nscData.clientID, m_nscData.width, m_nscData.height);
-    m_ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
-
+    m_targetCreated = true;
+    for (auto id : m_pendingTargetRequests)
+        respondTargetConstruction(id);
+    m_pendingTargetRequests.clear();
 }
 
 void ViewBackend::handleMessage(char* data, size_t size)
@@ -234,22 +234,36 @@ void ViewBackend::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::BCMNexusWL::BufferCommit::code:
-    {
-        auto& bufferCommit = IPC::BCMNexusWL::BufferCommit::cast(message);
-        commitBuffer(bufferCommit.width, bufferCommit.height);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::BCMNexusWL::BufferCommit, ViewBackend, &ViewBackend::commitBuffer>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "ViewBackend: unhandled message\n");
+}
+
+void ViewBackend::handleRequest(IPC::RequestId id, uint32_t code, char*, size_t)
+{
+    if (code != IPC::BCMNexusWL::TargetConstruction::code) {
+        fprintf(stderr, "ViewBackend: unhandled request\n");
+        return;
     }
+
+    if (!m_targetCreated) {
+        m_pendingTargetRequests.push_back(id);
+        return;
+    }
+    respondTargetConstruction(id);
 }
 
-void ViewBackend::commitBuffer(uint32_t width, uint32_t height)
+void ViewBackend::respondTargetConstruction(IPC::RequestId id)
 {
-    if (width != m_nscData.width || height != m_nscData.height)
+    IPC::Message message;
+    IPC::BCMNexusWL::TargetConstruction::construct(message, m_nscData.clientID, m_nscData.width, m_nscData.height);
+    m_ipcHost.respond(id, message.messageData, IPC::Message::dataSize);
+}
+
+void ViewBackend::commitBuffer(const IPC::BCMNexusWL::BufferCommit& bufferCommit)
+{
+    if (bufferCommit.width != m_nscData.width || bufferCommit.height != m_nscData.height)
         return;
 
     if (!m_buffer) {
@@ -257,8 +271,15 @@ void ViewBackend::commitBuffer(uint32_t width, uint32_t height)
         wl_display_roundtrip(m_display.display());
     }
 
-    m_callbackData.frameCallback = wl_surface_frame(m_surface);
-    wl_callback_add_listener(m_callbackData.frameCallback, &g_callbackListener, &m_callbackData);
+    if (m_framePipeline.commit()) {
+        IPC::Message message;
+        IPC::BCMNexusWL::FrameComplete::construct(message);
+        m_ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
+
+    struct wl_callback* frameCallback = wl_surface_frame(m_surface);
+    wl_callback_add_listener(frameCallback, &g_callbackListener, &m_callbackData);
+    m_callbackData.frameCallbacks.push_back(frameCallback);
 
     wl_surface_attach(m_surface, m_buffer, 0, 0);
     wl_surface_damage(m_surface, 0, 0, INT32_MAX, INT32_MAX);
@@ -154,6 +154,8 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char*, size_t) override;
 
+    void handleFrameComplete(const IPC::BCMNexus::FrameComplete&);
+
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
@@ -206,16 +208,15 @@ void EGLTarget::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::BCMNexus::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::BCMNexus::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
+}
+
+void EGLTarget::handleFrameComplete(const IPC::BCMNexus::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 } // namespace BCMNexus
@@ -281,6 +282,7 @@ struct wpe_renderer_backend_egl_target_interface bcm_nexus_renderer_backend_egl_
         IPC::Message message;
         IPC::BCMNexus::BufferCommit::construct(message, target.width, target.height);
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::BCMNexus::FrameComplete::code);
     },
 };
 
@@ -45,6 +45,7 @@
 #include <cstdlib>
 #include <cstring>
 #include <tuple>
+#include <unistd.h>
 
 namespace BCMNexus {
 
@@ -101,7 +102,7 @@ struct ViewBackend : public IPC::Host::Handler
     void handleFd(int) override;
     void handleMessage(char*, size_t) override;
 
-    void commitBuffer(uint32_t, uint32_t);
+    void commitBuffer(const IPC::BCMNexus::BufferCommit&);
 
 #ifdef KEY_INPUT_HANDLING_LIBINPUT
     // WPE::LibinputServer::Client
@@ -187,8 +188,9 @@ void ViewBackend::initialize()
 #endif
 }
 
-void ViewBackend::handleFd(int)
+void ViewBackend::handleFd(int fd)
 {
+    close(fd);
 }
 
 void ViewBackend::handleMessage(char* data, size_t size)
@@ -196,22 +198,15 @@ void ViewBackend::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::BCMNexus::BufferCommit::code:
-    {
-        auto& bufferCommit = IPC::BCMNexus::BufferCommit::cast(message);
-        commitBuffer(bufferCommit.width, bufferCommit.height);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::BCMNexus::BufferCommit, ViewBackend, &ViewBackend::commitBuffer>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "ViewBackend: unhandled message\n");
-    }
 }
 
-void ViewBackend::commitBuffer(uint32_t width, uint32_t height)
+void ViewBackend::commitBuffer(const IPC::BCMNexus::BufferCommit& bufferCommit)
 {
-    if (width != this->width || height != this->height)
+    if (bufferCommit.width != width || bufferCommit.height != height)
         return;
 
     IPC::Message message;
@@ -31,7 +31,9 @@
 #include "ipc-rpi.h"
 #include <EGL/egl.h>
 
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 
 namespace BCMRPi {
 
@@ -42,11 +44,18 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
 
+    void handleFrameComplete(const IPC::BCMRPi::FrameComplete&);
     void constructTarget(uint32_t, uint32_t, uint32_t);
+    bool waitForTarget();
+    EGLNativeWindowType window();
 
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
+    IPC::RequestId targetRequest { 0 };
+    bool lazyTarget { false };
+    // Monotonic time by which the element has to be known, -1 for never.
+    gint64 targetDeadline { -1 };
     EGL_DISPMANX_WINDOW_T nativeWindow { 0, };
 };
 
@@ -55,13 +64,37 @@ EGLTarget::EGLTarget(struct wpe_renderer_backend_egl_target* target, int hostFd)
 {
     ipcClient.initialize(*this, hostFd);
 
-    // Wait for the TargetConstruction message from wpe_view_backend.
-    while (!nativeWindow.element)
-        ipcClient.readSynchronously();
+    // WPE_BCMRPI_LAZY_TARGET=1 hands out the window before the element is
+    // known and only waits for it before the first frame is rendered.
+    const char* lazy = std::getenv("WPE_BCMRPI_LAZY_TARGET");
+    lazyTarget = lazy && std::strtoul(lazy, nullptr, 10);
+
+    int timeout = IPC::timeoutFromEnvironment("WPE_TARGET_CONSTRUCTION_TIMEOUT", 10000);
+    if (timeout >= 0)
+        targetDeadline = g_get_monotonic_time() + gint64(timeout) * 1000;
+
+    // The element is only needed once EGL asks for the window, the rest of
+    // the renderer setup goes on in the meantime.
+    targetRequest = ipcClient.sendRequest(IPC::BCMRPi::TargetConstruction::code, nullptr, 0, 0,
+        [](void* data, IPC::RequestStatus status, char* payload, size_t length)
+        {
+            auto& target = *static_cast<EGLTarget*>(data);
+            target.targetRequest = 0;
+
+            if (status != IPC::RequestStatus::Answered || length < sizeof(IPC::BCMRPi::TargetConstruction)) {
+                fprintf(stderr, "EGLTarget: no target from the view backend\n");
+                return;
+            }
+
+            auto& targetConstruction = *reinterpret_cast<const IPC::BCMRPi::TargetConstruction*>(payload);
+            target.constructTarget(targetConstruction.handle, targetConstruction.width, targetConstruction.height);
+        }, this);
 }
 
 EGLTarget::~EGLTarget()
 {
+    if (targetRequest)
+        ipcClient.cancelRequest(targetRequest);
     ipcClient.deinitialize();
 }
 
@@ -70,22 +103,15 @@ void EGLTarget::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::BCMRPi::TargetConstruction::code:
-    {
-        auto& targetConstruction = IPC::BCMRPi::TargetConstruction::cast(message);
-        constructTarget(targetConstruction.handle, targetConstruction.width, targetConstruction.height);
-        break;
-    }
-    case IPC::BCMRPi::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::BCMRPi::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
+}
+
+void EGLTarget::handleFrameComplete(const IPC::BCMRPi::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 void EGLTarget::constructTarget(uint32_t handle, uint32_t width, uint32_t height)
@@ -98,6 +124,42 @@ void EGLTarget::constructTarget(uint32_t handle, uint32_t width, uint32_t height
     nativeWindow.height = height;
 }
 
+// Gives up WPE_TARGET_CONSTRUCTION_TIMEOUT milliseconds after the target was
+// created, 10 seconds by default or never if negative, rather than hanging
+// on an unresponsive host. Returns whether the element is known, a window
+// without one would never be shown and its commits never completed.
+bool EGLTarget::waitForTarget()
+{
+    if (targetRequest) {
+        int timeout = -1;
+        if (targetDeadline != -1)
+            timeout = std::max<gint64>((targetDeadline - g_get_monotonic_time() + 999) / 1000, 0);
+
+        IPC::ReadStatus status = ipcClient.waitForResponse(targetRequest, timeout);
+        if (status != IPC::ReadStatus::Dispatched) {
+            fprintf(stderr, "EGLTarget: %s while waiting for the target\n", status == IPC::ReadStatus::TimedOut ? "timed out" : "disconnected");
+            ipcClient.cancelRequest(targetRequest);
+        }
+    }
+    return !!nativeWindow.element;
+}
+
+// In lazy mode the window is handed out as long as the answer may still
+// come in time, frame_will_render fills in the element before the first
+// BufferCommit.
+EGLNativeWindowType EGLTarget::window()
+{
+    if (lazyTarget && targetRequest) {
+        ipcClient.readSynchronously(0);
+        if (targetRequest && (targetDeadline == -1 || g_get_monotonic_time() < targetDeadline))
+            return &nativeWindow;
+    }
+
+    if (!waitForTarget())
+        return 0;
+    return &nativeWindow;
+}
+
 } // namespace BCMRPi
 
 extern "C" {
@@ -139,7 +201,7 @@ struct wpe_renderer_backend_egl_target_interface bcm_rpi_renderer_backend_egl_ta
     [](void* data) -> EGLNativeWindowType
     {
         auto& target = *static_cast<BCMRPi::EGLTarget*>(data);
-        return &target.nativeWindow;
+        return target.window();
     },
     // resize
     [](void* data, uint32_t width, uint32_t height)
@@ -148,16 +210,27 @@ struct wpe_renderer_backend_egl_target_interface bcm_rpi_renderer_backend_egl_ta
     // frame_will_render
     [](void* data)
     {
+        auto& target = *static_cast<BCMRPi::EGLTarget*>(data);
+        if (target.lazyTarget)
+            target.waitForTarget();
     },
     // frame_rendered
     [](void* data)
     {
         auto& target = *static_cast<BCMRPi::EGLTarget*>(data);
 
+        // The view backend never answers a commit without an element, only a
+        // lazy target that got no answer in time gets here.
+        if (!target.nativeWindow.element) {
+            wpe_renderer_backend_egl_target_dispatch_frame_complete(target.target);
+            return;
+        }
+
         IPC::Message message;
         IPC::BCMRPi::BufferCommit::construct(message, target.nativeWindow.element,
-            target.nativeWindow.width, target.nativeWindow.height);
+            uint32_t(target.nativeWindow.width), uint32_t(target.nativeWindow.height));
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::BCMRPi::FrameComplete::code);
     },
 };
 
@@ -30,12 +30,14 @@
 #include "Libinput/LibinputServer.h"
 #include "cursor-data.h"
 #include "ipc.h"
+#include "ipc-frame-pipeline.h"
 #include "ipc-rpi.h"
 #include <bcm_host.h>
 #include <cstdio>
 #include <memory>
 #include <sys/eventfd.h>
-#include <sys/time.h>
+#include <unistd.h>
+#include <vector>
 
 namespace BCMRPi {
 
@@ -63,9 +65,12 @@ struct ViewBackend : public IPC::Host::Handler, public WPE::LibinputServer::Clie
     // IPC::Host::Handler
     void handleFd(int) override;
     void handleMessage(char*, size_t) override;
+    void handleRequest(IPC::RequestId, uint32_t, char*, size_t) override;
 
-    void commitBuffer(uint32_t, uint32_t, uint32_t);
+    void respondTargetConstruction(IPC::RequestId);
+    void commitBuffer(const IPC::BCMRPi::BufferCommit&);
     void handleUpdate();
+    void sendFrameComplete();
 
     // WPE::LibinputServer::Client
     void handleKeyboardEvent(struct wpe_input_keyboard_event*) override;
@@ -79,12 +84,17 @@ struct ViewBackend : public IPC::Host::Handler, public WPE::LibinputServer::Clie
     DISPMANX_DISPLAY_HANDLE_T displayHandle { DISPMANX_NO_HANDLE };
     DISPMANX_ELEMENT_HANDLE_T elementHandle { DISPMANX_NO_HANDLE };
 
+    // Counts the updates that completed since it was last read.
     int updateFd { -1 };
     GSource* updateSource;
+    IPC::FramePipeline framePipeline;
 
     uint32_t width { 0 };
     uint32_t height { 0 };
 
+    // Asked for before the element existed.
+    std::vector<IPC::RequestId> pendingTargetRequests;
+
     struct Cursor : public WPE::LibinputServer::Client {
         Cursor(WPE::LibinputServer::Client&, DISPMANX_DISPLAY_HANDLE_T, uint32_t, uint32_t);
         ~Cursor();
@@ -180,6 +190,10 @@ void ViewBackend::initializeRenderingTarget()
     vc_dispmanx_update_submit_sync(updateHandle);
 
     wpe_view_backend_dispatch_set_size(backend, width, height);
+
+    for (auto id : pendingTargetRequests)
+        respondTargetConstruction(id);
+    pendingTargetRequests.clear();
 }
 
 void ViewBackend::initializeInput()
@@ -201,15 +215,12 @@ void ViewBackend::initializeInput()
 
 int ViewBackend::releaseClientFD()
 {
-    IPC::Message message;
-    IPC::BCMRPi::TargetConstruction::construct(message, elementHandle, width, height);
-    ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
-
     return ipcHost.releaseClientFD();
 }
 
-void ViewBackend::handleFd(int)
+void ViewBackend::handleFd(int fd)
 {
+    close(fd);
 }
 
 void ViewBackend::handleMessage(char* data, size_t size)
@@ -217,22 +228,36 @@ void ViewBackend::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::BCMRPi::BufferCommit::code:
-    {
-        auto& bufferCommit = IPC::BCMRPi::BufferCommit::cast(message);
-        commitBuffer(bufferCommit.handle, bufferCommit.width, bufferCommit.height);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::BCMRPi::BufferCommit, ViewBackend, &ViewBackend::commitBuffer>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "ViewBackend: unhandled message\n");
+}
+
+void ViewBackend::handleRequest(IPC::RequestId id, uint32_t code, char*, size_t)
+{
+    if (code != IPC::BCMRPi::TargetConstruction::code) {
+        fprintf(stderr, "ViewBackend: unhandled request\n");
+        return;
     }
+
+    if (elementHandle == DISPMANX_NO_HANDLE) {
+        pendingTargetRequests.push_back(id);
+        return;
+    }
+    respondTargetConstruction(id);
 }
 
-void ViewBackend::commitBuffer(uint32_t handle, uint32_t width, uint32_t height)
+void ViewBackend::respondTargetConstruction(IPC::RequestId id)
 {
-    if (handle != elementHandle || width != this->width || height != this->height)
+    IPC::Message message;
+    IPC::BCMRPi::TargetConstruction::construct(message, elementHandle, width, height);
+    ipcHost.respond(id, message.messageData, IPC::Message::dataSize);
+}
+
+void ViewBackend::commitBuffer(const IPC::BCMRPi::BufferCommit& bufferCommit)
+{
+    if (bufferCommit.handle != elementHandle || bufferCommit.width != width || bufferCommit.height != height)
         return;
 
     DISPMANX_UPDATE_HANDLE_T updateHandle = vc_dispmanx_update_start(0);
@@ -243,17 +268,18 @@ void ViewBackend::commitBuffer(uint32_t handle, uint32_t width, uint32_t height)
 
     vc_dispmanx_element_change_attributes(updateHandle, elementHandle, 1 << 3 | 1 << 2, 0, 0, &destRect, &srcRect, 0, DISPMANX_NO_ROTATE);
 
+    if (framePipeline.commit())
+        sendFrameComplete();
+
     vc_dispmanx_update_submit(updateHandle,
         [](DISPMANX_UPDATE_HANDLE_T, void* data)
         {
             auto& backend = *static_cast<ViewBackend*>(data);
 
-            struct timeval tv;
-            gettimeofday(&tv, nullptr);
-            uint64_t time = tv.tv_sec * 1000 + tv.tv_usec / 1000;
-
-            ssize_t ret = write(backend.updateFd, &time, sizeof(time));
-            if (ret != sizeof(time))
+            // Several updates may complete before the count is read.
+            uint64_t count = 1;
+            ssize_t ret = write(backend.updateFd, &count, sizeof(count));
+            if (ret != sizeof(count))
                 fprintf(stderr, "ViewBackend: failed to write to the update eventfd\n");
         },
         this);
@@ -261,16 +287,23 @@ void ViewBackend::commitBuffer(uint32_t handle, uint32_t width, uint32_t height)
 
 void ViewBackend::handleUpdate()
 {
-    uint64_t time;
-    ssize_t ret = read(updateFd, &time, sizeof(time));
-    if (ret != sizeof(time))
+    uint64_t count;
+    ssize_t ret = read(updateFd, &count, sizeof(count));
+    if (ret != sizeof(count))
         return;
 
+    for (; count; --count) {
+        if (framePipeline.displayed())
+            sendFrameComplete();
+        wpe_view_backend_dispatch_frame_displayed(backend);
+    }
+}
+
+void ViewBackend::sendFrameComplete()
+{
     IPC::Message message;
     IPC::BCMRPi::FrameComplete::construct(message);
     ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
-
-    wpe_view_backend_dispatch_frame_displayed(backend);
 }
 
 void ViewBackend::handleKeyboardEvent(struct wpe_input_keyboard_event* event)
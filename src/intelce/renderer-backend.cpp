@@ -41,6 +41,8 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
 
+    void handleFrameComplete(const IPC::IntelCE::FrameComplete&);
+
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
@@ -64,16 +66,15 @@ void EGLTarget::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::IntelCE::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::IntelCE::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
+}
+
+void EGLTarget::handleFrameComplete(const IPC::IntelCE::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 } // namespace IntelCE
@@ -137,6 +138,7 @@ struct wpe_renderer_backend_egl_target_interface intelce_renderer_backend_egl_ta
         IPC::Message message;
         IPC::IntelCE::BufferCommit::construct(message, target.width, target.height);
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::IntelCE::FrameComplete::code);
     },
 };
 
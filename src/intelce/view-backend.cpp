@@ -32,6 +32,7 @@
 #include "ipc-intelce.h"
 #include <cstdio>
 #include <libgdl.h>
+#include <unistd.h>
 
 namespace IntelCE {
 
@@ -119,7 +120,7 @@ struct ViewBackend : public IPC::Host::Handler, public WPE::LibinputServer::Clie
     void handleFd(int) override;
     void handleMessage(char*, size_t) override;
 
-    void commitBuffer(uint32_t, uint32_t);
+    void commitBuffer(const IPC::IntelCE::BufferCommit&);
 
     // WPE::LibinputServer::Client
     void handleKeyboardEvent(struct wpe_input_keyboard_event*) override;
@@ -158,8 +159,9 @@ void ViewBackend::initialize()
     WPE::LibinputServer::singleton().setClient(this);
 }
 
-void ViewBackend::handleFd(int)
+void ViewBackend::handleFd(int fd)
 {
+    close(fd);
 }
 
 void ViewBackend::handleMessage(char* data, size_t size)
@@ -167,22 +169,15 @@ void ViewBackend::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::IntelCE::BufferCommit::code:
-    {
-        auto& bufferCommit = IPC::IntelCE::BufferCommit::cast(message);
-        commitBuffer(bufferCommit.width, bufferCommit.height);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::IntelCE::BufferCommit, ViewBackend, &ViewBackend::commitBuffer>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "ViewBackend: unhandled message\n");
-    };
 }
 
-void ViewBackend::commitBuffer(uint32_t width, uint32_t height)
+void ViewBackend::commitBuffer(const IPC::IntelCE::BufferCommit& bufferCommit)
 {
-    if (width != this->width || height != this->height)
+    if (bufferCommit.width != width || bufferCommit.height != height)
         return;
 
     IPC::Message message;
@@ -61,6 +61,8 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
 
+    void handleFrameComplete(const IPC::WaylandEGL::FrameComplete&);
+
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
@@ -159,16 +161,15 @@ void EGLTarget::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::WaylandEGL::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::WaylandEGL::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
+}
+
+void EGLTarget::handleFrameComplete(const IPC::WaylandEGL::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 } // namespace WaylandEGL
@@ -240,6 +241,7 @@ struct wpe_renderer_backend_egl_target_interface wayland_egl_renderer_backend_eg
         IPC::Message message;
         IPC::WaylandEGL::BufferCommit::construct(message);
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::WaylandEGL::FrameComplete::code);
     },
 };
 
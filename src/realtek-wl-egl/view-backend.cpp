@@ -29,7 +29,9 @@
 #include <wpe/wpe.h>
 #include "display.h"
 #include "ipc.h"
+#include "ipc-touch.h"
 #include "ipc-waylandegl.h"
+#include <unistd.h>
 
 #define WIDTH 1280
 #define HEIGHT 720
@@ -43,10 +45,10 @@ struct ViewBackend : public IPC::Host::Handler {
     virtual ~ViewBackend();
 
     // IPC::Host::Handler
-    void handleFd(int) override { };
+    void handleFd(int fd) override { close(fd); };
     void handleMessage(char*, size_t) override;
 
-    void ackBufferCommit();
+    void ackBufferCommit(const IPC::WaylandEGL::BufferCommit&);
     void initialize();
 
     struct wpe_view_backend* backend;
@@ -66,9 +68,22 @@ ViewBackend::~ViewBackend()
 
 void ViewBackend::handleMessage(char* data, size_t size)
 {
+    auto& messageCode = *reinterpret_cast<uint32_t*>(data);
+    if (messageCode == Wayland::EventDispatcher::MsgType::TOUCH) {
+        struct wpe_input_touch_event event;
+        if (IPC::Touch::decode(IPC::Frame::payload(data), IPC::Frame::payloadSize(size), event))
+            wpe_view_backend_dispatch_touch_event(backend, &event);
+        return;
+    }
+
     if (size != IPC::Message::size)
         return;
 
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::WaylandEGL::BufferCommit, ViewBackend, &ViewBackend::ackBufferCommit>>;
+    if (Dispatcher::dispatch(*this, data, size))
+        return;
+
     auto& message = IPC::Message::cast(data);
     switch (message.messageCode) {
     case Wayland::EventDispatcher::MsgType::AXIS:
@@ -83,23 +98,12 @@ void ViewBackend::handleMessage(char* data, size_t size)
         wpe_view_backend_dispatch_pointer_event(backend, event);
         break;
     }
-    case Wayland::EventDispatcher::MsgType::TOUCH:
-    {
-        struct wpe_input_touch_event * event = reinterpret_cast<wpe_input_touch_event*>(std::addressof(message.messageData));
-        wpe_view_backend_dispatch_touch_event(backend, event);
-        break;
-    }
     case Wayland::EventDispatcher::MsgType::KEYBOARD:
     {
         struct wpe_input_keyboard_event * event = reinterpret_cast<wpe_input_keyboard_event*>(std::addressof(message.messageData));
         wpe_view_backend_dispatch_keyboard_event(backend, event);
         break;
     }
-    case IPC::WaylandEGL::BufferCommit::code:
-    {
-        ackBufferCommit();
-        break;
-    }
     default:
         fprintf(stderr, "ViewBackend: unhandled message\n");
     }
@@ -119,7 +123,7 @@ void ViewBackend::initialize()
     wpe_view_backend_dispatch_set_size( backend, w, h );
 }
 
-void ViewBackend::ackBufferCommit()
+void ViewBackend::ackBufferCommit(const IPC::WaylandEGL::BufferCommit&)
 {
     IPC::Message message;
     IPC::WaylandEGL::FrameComplete::construct(message);
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-blob.h"
+
+#include "ipc.h"
+#include "ipc-shm.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace IPC {
+
+static const int s_requiredSeals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE;
+
+int Blob::createFd(const void* data, size_t size)
+{
+    int fd = SharedRing::createMemoryFd("wpe-ipc-blob", size);
+    if (fd == -1)
+        return -1;
+
+    const char* bytes = static_cast<const char*>(data);
+    for (size_t offset = 0; offset < size;) {
+        ssize_t written = pwrite(fd, bytes + offset, size - offset, offset);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            fprintf(stderr, "IPC::Blob: writing %zu bytes failed: %s\n", size, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        offset += written;
+    }
+
+    if (fcntl(fd, F_ADD_SEALS, s_requiredSeals | F_SEAL_SEAL) == -1) {
+        fprintf(stderr, "IPC::Blob: sealing failed: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Blob* Blob::adopt(char* data, size_t size, int* fds, size_t fdCount)
+{
+    Blob* blob = nullptr;
+    struct stat fileStatus;
+    if (fdCount == 1 && Frame::payloadSize(size) == sizeof(Header)
+        && (fcntl(fds[0], F_GET_SEALS) & s_requiredSeals) == s_requiredSeals
+        && !fstat(fds[0], &fileStatus)) {
+        Header header;
+        memcpy(&header, Frame::payload(data), sizeof(Header));
+        if (header.size <= uint64_t(fileStatus.st_size)) {
+            void* memory = nullptr;
+            if (header.size)
+                memory = mmap(nullptr, header.size, PROT_READ, MAP_PRIVATE, fds[0], 0);
+            if (memory != MAP_FAILED) {
+                blob = new Blob;
+                blob->m_memory = memory;
+                blob->m_size = header.size;
+            }
+        }
+    }
+
+    if (!blob)
+        fprintf(stderr, "IPC::Blob: the frame does not carry a sealed blob\n");
+    for (size_t i = 0; i < fdCount; ++i)
+        close(fds[i]);
+    return blob;
+}
+
+Blob::~Blob()
+{
+    if (m_memory)
+        munmap(m_memory, m_size);
+}
+
+} // namespace IPC
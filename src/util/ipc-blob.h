@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_blob_h
+#define wpe_platform_ipc_blob_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unistd.h>
+
+namespace IPC {
+
+// A payload of any size sent with Host::sendBlob() or Client::sendBlob(). It
+// travels as a frame holding its size plus a memfd that is sealed before it
+// is sent, so what the receiver maps can no longer change underneath it.
+class Blob {
+public:
+    struct Header {
+        uint64_t size;
+    };
+
+    // The descriptor of a sealed memfd holding a copy of the data, -1 on
+    // failure.
+    static int createFd(const void*, size_t);
+
+    // Sends a copy of the data with sender's sendMessageWithFds(), false if
+    // no memfd could be created for it.
+    template<typename Sender>
+    static bool send(Sender& sender, uint32_t code, const void* data, size_t size)
+    {
+        int fd = createFd(data, size);
+        if (fd == -1)
+            return false;
+
+        Header header { size };
+        sender.sendMessageWithFds(code, &header, sizeof(header), &fd, 1);
+        close(fd);
+        return true;
+    }
+
+    // Maps the blob carried by a frame that reached handleMessageWithFds()
+    // read-only. Closes the descriptors either way and returns nullptr if the
+    // frame does not carry a blob.
+    static Blob* adopt(char* data, size_t size, int* fds, size_t fdCount);
+    ~Blob();
+
+    const uint8_t* data() const { return static_cast<const uint8_t*>(m_memory); }
+    size_t size() const { return m_size; }
+
+private:
+    Blob() = default;
+
+    void* m_memory { nullptr };
+    size_t m_size { 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_blob_h
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-busy-poll.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace IPC {
+
+const uint32_t BusyPoll::minimumBudget;
+
+uint32_t BusyPoll::limitFromEnvironment()
+{
+    const char* value = std::getenv("WPE_IPC_BUSY_POLL");
+    if (!value)
+        return 0;
+    // Spinning for longer than a frame only burns the time it was meant to save.
+    return std::min<unsigned long>(std::strtoul(value, nullptr, 10), 16000);
+}
+
+BusyPoll::BusyPoll(uint32_t limit)
+    : m_statistics { limit, limit, 0, 0, 0 }
+{
+}
+
+uint32_t BusyPoll::floor() const
+{
+    return std::min(m_statistics.limit, std::max(m_statistics.limit / 16, minimumBudget));
+}
+
+void BusyPoll::recordHit(uint32_t elapsed)
+{
+    ++m_statistics.hits;
+    m_statistics.spun += elapsed;
+
+    if (!m_average)
+        m_average = uint64_t(elapsed) * 8;
+    else
+        m_average = m_average - m_average / 8 + elapsed;
+
+    uint64_t budget = m_average / 4 + minimumBudget;
+    m_statistics.budget = uint32_t(std::max<uint64_t>(std::min<uint64_t>(budget, m_statistics.limit), floor()));
+}
+
+void BusyPoll::recordMiss(uint32_t elapsed)
+{
+    ++m_statistics.misses;
+    m_statistics.spun += elapsed;
+    m_statistics.budget = std::max(m_statistics.budget / 2, floor());
+}
+
+} // namespace IPC
@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_busy_poll_h
+#define wpe_platform_ipc_busy_poll_h
+
+#include "ipc.h"
+#include <stdint.h>
+
+namespace IPC {
+
+// Decides how long Client::busyPoll() spins. The budget follows twice the
+// average time the awaited answers took when they arrived while spinning and
+// is halved whenever something else or nothing did, down to a sixteenth of
+// the limit so that it keeps probing. Only used from the thread the client runs on.
+class BusyPoll {
+public:
+    // The limit in microseconds from WPE_IPC_BUSY_POLL, 0 when disabled.
+    static uint32_t limitFromEnvironment();
+
+    explicit BusyPoll(uint32_t limit);
+
+    uint32_t budget() const { return m_statistics.budget; }
+
+    void recordHit(uint32_t elapsed);
+    void recordMiss(uint32_t elapsed);
+
+    const BusyPollStatistics& statistics() const { return m_statistics; }
+
+private:
+    // Less than this is not worth measuring with a monotonic clock.
+    static const uint32_t minimumBudget = 10;
+
+    uint32_t floor() const;
+
+    // In 1/8 microseconds, for an average over about eight hits.
+    uint64_t m_average { 0 };
+    BusyPollStatistics m_statistics;
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_busy_poll_h
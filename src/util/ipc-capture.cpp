@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-capture.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <time.h>
+#include <unistd.h>
+
+namespace IPC {
+
+Capture* Capture::create()
+{
+    const char* prefix = std::getenv("WPE_IPC_CAPTURE");
+    if (!prefix || !*prefix)
+        return nullptr;
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s.%d", prefix, getpid());
+    FILE* file = fopen(path, "wbe");
+    if (!file) {
+        fprintf(stderr, "IPC::Capture: unable to create %s\n", path);
+        return nullptr;
+    }
+
+    FileHeader header;
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.pid = getpid();
+    fwrite(&header, sizeof(header), 1, file);
+    return new Capture(file);
+}
+
+Capture* Capture::fromEnvironment()
+{
+    // Lives as long as the process.
+    static Capture* capture = create();
+    return capture;
+}
+
+Capture::Capture(FILE* file)
+    : m_file(file)
+{
+}
+
+void Capture::record(uint32_t channel, bool hostSide, Kind kind, const char* data, size_t size, size_t fdCount)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    RecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.timestamp = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+    header.channel = channel;
+    header.hostSide = hostSide;
+    header.kind = static_cast<uint8_t>(kind);
+    header.fdCount = fdCount;
+    header.size = size;
+
+    // Flushed right away, a capture is most interesting when the process
+    // did not end well.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    fwrite(&header, sizeof(header), 1, m_file);
+    if (size)
+        fwrite(data, size, 1, m_file);
+    fflush(m_file);
+}
+
+} // namespace IPC
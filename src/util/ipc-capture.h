@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_capture_h
+#define wpe_platform_ipc_capture_h
+
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace IPC {
+
+// Writes everything the channels of the process hand to their handlers to a
+// file, in the form the handlers got it, so IPC::Replay can feed it to a
+// handler again. Turned on with WPE_IPC_CAPTURE=<prefix>, each process writes
+// <prefix>.<pid>.
+class Capture {
+public:
+    enum class Kind : uint8_t {
+        // Records handed out together through handleMessages().
+        Messages,
+        Message,
+        MessageWithFds,
+        Fd,
+    };
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t pid;
+    };
+    static_assert(sizeof(FileHeader) == 16, "FileHeader is of correct size");
+
+    // Followed by size bytes of data.
+    struct RecordHeader {
+        // CLOCK_MONOTONIC, in nanoseconds.
+        uint64_t timestamp;
+        uint32_t channel;
+        uint8_t hostSide;
+        uint8_t kind;
+        uint8_t fdCount;
+        uint8_t padding;
+        uint32_t size;
+        uint32_t padding2;
+    };
+    static_assert(sizeof(RecordHeader) == 24, "RecordHeader is of correct size");
+
+    static constexpr const char* magic = "WPEIPCCP";
+    static const uint32_t version = 1;
+
+    // nullptr unless capturing was asked for and the file could be created.
+    static Capture* fromEnvironment();
+
+    void record(uint32_t channel, bool hostSide, Kind, const char* data, size_t size, size_t fdCount);
+
+private:
+    static Capture* create();
+    explicit Capture(FILE*);
+
+    std::mutex m_mutex;
+    FILE* m_file;
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_capture_h
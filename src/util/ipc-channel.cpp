@@ -0,0 +1,1615 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-channel.h"
+
+#include "ipc-capture.h"
+#include "ipc-flight-recorder.h"
+#include "ipc-shm.h"
+#if USE_IPC_IO_URING
+#include "ipc-uring.h"
+#endif
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <gio/gunixfdmessage.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace IPC {
+
+static SharedRing::Direction incomingDirection(Channel::Side side)
+{
+    return side == Channel::Side::Host ? SharedRing::ClientToHost : SharedRing::HostToClient;
+}
+
+static SharedRing::Direction outgoingDirection(Channel::Side side)
+{
+    return side == Channel::Side::Host ? SharedRing::HostToClient : SharedRing::ClientToHost;
+}
+
+static Loopback::Direction incomingLoopbackDirection(Channel::Side side)
+{
+    return side == Channel::Side::Host ? Loopback::ClientToHost : Loopback::HostToClient;
+}
+
+static Loopback::Direction outgoingLoopbackDirection(Channel::Side side)
+{
+    return side == Channel::Side::Host ? Loopback::HostToClient : Loopback::ClientToHost;
+}
+
+// WPE_IPC_SHARED_RING=1 enables the ring with its default capacity, a larger
+// value is taken as the number of records per direction.
+static uint32_t sharedRingCapacity(const char* value)
+{
+    unsigned long requested = std::strtoul(value, nullptr, 10);
+    if (requested <= 1)
+        return requested ? SharedRing::defaultCapacity : 0;
+
+    uint32_t capacity = 16;
+    while (capacity < requested && capacity < (1 << 16))
+        capacity <<= 1;
+    return capacity;
+}
+
+// Once the shared ring or the loopback is up, every record goes through it
+// but those of the handshakes, internal ones included. Handshake records stay
+// on the socket, they switch the transport over.
+static bool isHandshakeRecord(const char* record)
+{
+    uint32_t code = *reinterpret_cast<const uint32_t*>(record);
+    return !Frame::isFrame(code) && Internal::isHandshake(code);
+}
+
+static void attachFds(struct msghdr& header, char* control, const int* fds, size_t fdCount)
+{
+    if (!fdCount)
+        return;
+
+    header.msg_control = control;
+    header.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+}
+
+class Channel::DoorbellSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+    Channel* channel;
+};
+
+GSourceFuncs Channel::DoorbellSource::sourceFuncs = {
+    // prepare
+    [](GSource*, gint* timeout) -> gboolean
+    {
+        *timeout = -1;
+        return FALSE;
+    },
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto& source = *reinterpret_cast<DoorbellSource*>(base);
+        return !!source.pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto& source = *reinterpret_cast<DoorbellSource*>(base);
+
+        if (source.pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        if (source.pfd.revents & G_IO_IN)
+            source.channel->drainSharedRing();
+
+        source.pfd.revents = 0;
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+class Channel::LoopbackSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    Channel* channel;
+
+    bool isReady() const
+    {
+        auto& loopback = *channel->m_loopback;
+        return loopback.hasPending(incomingLoopbackDirection(channel->m_side)) || loopback.isClosed();
+    }
+};
+
+GSourceFuncs Channel::LoopbackSource::sourceFuncs = {
+    // prepare
+    [](GSource* base, gint* timeout) -> gboolean
+    {
+        *timeout = -1;
+        return reinterpret_cast<LoopbackSource*>(base)->isReady();
+    },
+    // check
+    [](GSource* base) -> gboolean
+    {
+        return reinterpret_cast<LoopbackSource*>(base)->isReady();
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto& source = *reinterpret_cast<LoopbackSource*>(base);
+        return source.channel->drainLoopback() || !source.channel->m_loopback->isClosed();
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+#if USE_IPC_IO_URING
+class Channel::UringSource {
+public:
+    static GSourceFuncs sourceFuncs;
+
+    GSource source;
+    GPollFD pfd;
+    Channel* channel;
+};
+
+GSourceFuncs Channel::UringSource::sourceFuncs = {
+    // prepare
+    [](GSource* base, gint* timeout) -> gboolean
+    {
+        // Everything queued during this iteration goes out in one go.
+        auto& source = *reinterpret_cast<UringSource*>(base);
+        source.channel->m_uring->submit();
+
+        *timeout = -1;
+        return FALSE;
+    },
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto& source = *reinterpret_cast<UringSource*>(base);
+        return !!source.pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto& source = *reinterpret_cast<UringSource*>(base);
+
+        if (source.pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        source.pfd.revents = 0;
+        Channel& channel = *source.channel;
+        if (channel.m_uring->receiveActive()) {
+            if (channel.receive())
+                return TRUE;
+            if (channel.m_receiver.closed)
+                channel.m_receiver.closed(channel.m_receiverData);
+            return FALSE;
+        }
+
+        // Reading went back to the socket, only sends complete here.
+        channel.drainUring();
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+#endif
+
+Channel::Channel(Side side, const Receiver& receiver, void* receiverData)
+    : m_side(side)
+    , m_receiver(receiver)
+    , m_receiverData(receiverData)
+{
+    FlightRecorder::initialize();
+    m_id = FlightRecorder::registerChannel();
+    m_capture = Capture::fromEnvironment();
+}
+
+Channel::~Channel()
+{
+#if USE_IPC_IO_URING
+    if (m_uringSource) {
+        g_source_destroy(m_uringSource);
+        g_source_unref(m_uringSource);
+    }
+    m_uring = nullptr;
+#endif
+
+    delete m_latency.load();
+
+    if (m_sendSource) {
+        g_source_destroy(m_sendSource);
+        g_source_unref(m_sendSource);
+    }
+
+    if (m_loopbackSource) {
+        g_source_destroy(m_loopbackSource);
+        g_source_unref(m_loopbackSource);
+    }
+    if (m_loopback) {
+        m_loopback->setReceiveContext(incomingLoopbackDirection(m_side), nullptr);
+        // Only once it was accepted does the peer depend on it.
+        if (m_loopbackSendActive || m_loopbackReceiveActive)
+            m_loopback->close();
+        m_loopback->deref();
+    }
+
+    if (m_doorbellSource) {
+        g_source_destroy(m_doorbellSource);
+        g_source_unref(m_doorbellSource);
+    }
+
+    if (m_source) {
+        g_source_destroy(m_source);
+        g_source_unref(m_source);
+    }
+    if (m_socket)
+        g_object_unref(m_socket);
+
+    closePendingFds();
+}
+
+// SOCK_SEQPACKET keeps every record in its own packet and lets the client pick
+// up several of them with a single recvmmsg().
+bool Channel::createSocketPair(int sockets[2])
+{
+    int type = SOCK_STREAM;
+    const char* seqpacket = std::getenv("WPE_IPC_SEQPACKET");
+    if (seqpacket && std::strtoul(seqpacket, nullptr, 10))
+        type = SOCK_SEQPACKET;
+
+    return socketpair(AF_UNIX, type, 0, sockets) != -1;
+}
+
+bool Channel::initialize(int fd, gint priority, gboolean blocking)
+{
+    m_socket = g_socket_new_from_fd(fd, nullptr);
+    if (!m_socket)
+        return false;
+
+    int type = 0;
+    socklen_t typeLength = sizeof(type);
+    if (!getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &typeLength))
+        m_seqpacket = type == SOCK_SEQPACKET;
+
+    m_blocking = blocking;
+    m_priority = priority;
+    m_context = g_main_context_get_thread_default();
+    g_socket_set_blocking(m_socket, blocking);
+
+#if USE_IPC_IO_URING
+    if (m_useUring) {
+        m_uring.reset(Uring::create(fd));
+        if (m_uring) {
+            startUring();
+            return true;
+        }
+        fprintf(stderr, "IPC::Channel: io_uring is unavailable, using the socket directly\n");
+    }
+#endif
+
+    attachSocketSource();
+    return true;
+}
+
+void Channel::attachSocketSource()
+{
+    m_source = g_socket_create_source(m_socket, G_IO_IN, nullptr);
+    g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(socketCallback), this, nullptr);
+    g_source_set_priority(m_source, m_priority);
+    g_source_set_can_recurse(m_source, TRUE);
+    g_source_attach(m_source, m_context);
+}
+
+// WPE_IPC_SEND_QUEUE_LIMIT is the number of records a channel keeps around
+// while the peer is not reading, newer messages are dropped beyond it.
+// WPE_IPC_TIMESTAMPS=1 stamps outgoing messages, so the peer can tell how
+// long they took and whether any got lost.
+// WPE_IPC_IO_URING=1 moves the socket reads and writes to io_uring, provided
+// the kernel is recent enough.
+void Channel::configureFromEnvironment()
+{
+    size_t limit = SendQueue::defaultLimit;
+    const char* value = std::getenv("WPE_IPC_SEND_QUEUE_LIMIT");
+    if (value && std::strtoul(value, nullptr, 10))
+        limit = std::strtoul(value, nullptr, 10);
+    setSendQueueLimit(limit);
+
+    value = std::getenv("WPE_IPC_TIMESTAMPS");
+    setStampMessages(value && std::strtoul(value, nullptr, 10));
+
+#if USE_IPC_IO_URING
+    value = std::getenv("WPE_IPC_IO_URING");
+    setUseUring(value && std::strtoul(value, nullptr, 10));
+#endif
+}
+
+// Everything a channel supports on its own, whichever way it is configured.
+static const uint32_t channelFeatures = Features::Frames | Features::SharedRing
+    | Features::Timestamps | Features::Rpc;
+
+void Channel::advertiseFeatures(uint32_t backendFeatures)
+{
+    m_features = channelFeatures | backendFeatures;
+
+    Message message;
+    Internal::Capabilities::construct(message, m_features);
+    sendInternalMessage(message, nullptr, 0);
+}
+
+uint32_t Channel::commonFeatures() const
+{
+    return m_commonFeatures.load(std::memory_order_acquire);
+}
+
+bool Channel::canUse(uint32_t features) const
+{
+    if (!m_features || !m_peerAdvertised.load(std::memory_order_acquire))
+        return true;
+    return (commonFeatures() & features) == features;
+}
+
+// Without features advertised the offer is the first thing the client reads
+// after any multiplexing hello, otherwise it waits for the client's
+// capabilities. Clients that do not answer it keep talking over the socket.
+void Channel::offerSharedRingFromEnvironment()
+{
+    const char* value = std::getenv("WPE_IPC_SHARED_RING");
+    if (!value)
+        return;
+
+    uint32_t capacity = sharedRingCapacity(value);
+    if (capacity)
+        offerSharedRing(capacity);
+}
+
+void Channel::offerSharedRing(uint32_t capacity)
+{
+    if (m_side != Side::Host || m_ring)
+        return;
+
+    if (m_features && !m_peerAdvertised.load(std::memory_order_relaxed)) {
+        m_deferredRingCapacity = capacity;
+        return;
+    }
+    if (!canUse(Features::SharedRing))
+        return;
+
+    m_ring.reset(SharedRing::create(capacity));
+    if (!m_ring) {
+        fprintf(stderr, "IPC::Channel: unable to create the shared ring, staying on the socket\n");
+        return;
+    }
+
+    Message message;
+    Internal::SharedRingOffer::construct(message, capacity);
+    sendInternalMessage(message, m_ring->transferFds(), SharedRing::transferFdCount);
+}
+
+void Channel::setSendQueueLimit(size_t records)
+{
+    m_sendQueue.setLimit(records);
+    m_bulkQueue.setLimit(records);
+}
+
+void Channel::setMergeFunction(MergeFunction mergeFunction)
+{
+    m_sendQueue.setMergeFunction(mergeFunction);
+    m_bulkQueue.setMergeFunction(mergeFunction);
+}
+
+void Channel::setLoopback(Loopback* loopback)
+{
+    if (m_loopback)
+        return;
+
+    loopback->ref();
+    m_loopback = loopback;
+}
+
+// Messages sent so far are ahead in the socket, anything sent from now on
+// waits in the loopback queue until the host took the accept from there.
+void Channel::acceptLoopback(Loopback* loopback)
+{
+    if (m_side != Side::Client || m_loopback)
+        return;
+
+    setLoopback(loopback);
+
+    Message accept;
+    Internal::LoopbackAccept::construct(accept);
+    sendInternalMessage(accept, nullptr, 0);
+    m_loopbackSendActive = true;
+}
+
+void Channel::sendMessage(const char* data, size_t size, Delivery delivery, Lane lane)
+{
+    if (size != Message::size) {
+        if (size >= sizeof(uint32_t))
+            sendFrame(*reinterpret_cast<const uint32_t*>(data), Frame::payload(const_cast<char*>(data)), Frame::payloadSize(size), nullptr, 0, lane);
+        return;
+    }
+
+    if (lane == Lane::Bulk)
+        queueBulkRecords(data, 1, nullptr, 0, delivery);
+    else
+        queueRecords(data, 1, nullptr, 0, delivery, false);
+}
+
+void Channel::sendFrame(uint32_t code, const void* payload, size_t length, const int* fds, size_t fdCount, Lane lane)
+{
+    // A peer that only knows Message records would misread the header.
+    if (!canUse(Features::Frames)) {
+        fprintf(stderr, "IPC::Channel: the peer does not take frames, dropping message %u\n", code);
+        return;
+    }
+
+    Message records[Frame::maxRecordCount];
+    size_t recordCount = encodeFrame(code, payload, length, fdCount, records);
+    if (!recordCount)
+        return;
+
+    if (lane == Lane::Bulk)
+        queueBulkRecords(Message::data(records[0]), recordCount, fds, fdCount, Delivery::Always);
+    else
+        queueRecords(Message::data(records[0]), recordCount, fds, fdCount, Delivery::Always, false);
+}
+
+size_t Channel::encodeFrame(uint32_t code, const void* payload, size_t length, size_t fdCount, Message* records)
+{
+    if (length > Frame::maxLength || fdCount > Frame::maxFds) {
+        fprintf(stderr, "IPC::Channel: frame of %zu bytes with %zu descriptors is too large, dropping it\n", length, fdCount);
+        return 0;
+    }
+
+    Frame frame;
+    frame.flags |= fdCount;
+    frame.length = length;
+    frame.messageCode = code;
+
+    size_t recordCount = Frame::recordCount(length);
+    char* data = reinterpret_cast<char*>(records);
+    memcpy(data, &frame, sizeof(frame));
+    memcpy(data + sizeof(frame), payload, length);
+    memset(data + sizeof(frame) + length, 0, recordCount * Message::size - sizeof(frame) - length);
+    return recordCount;
+}
+
+void Channel::sendRecords(const char* data, size_t recordCount, const int* fds, size_t fdCount)
+{
+    uint32_t code = *reinterpret_cast<const uint32_t*>(data);
+    queueRecords(data, recordCount, fds, fdCount, Delivery::Always, !Frame::isFrame(code) && Internal::isInternal(code));
+}
+
+bool Channel::selectEndpoint(uint32_t endpoint)
+{
+    if (endpoint == m_outgoingEndpoint)
+        return true;
+
+    // A lost select would hand the next messages to the wrong endpoint, so
+    // it is retried with the next message instead.
+    Message message;
+    Internal::ChannelSelect::construct(message, endpoint);
+    m_outgoingEndpoint = queueRecords(Message::data(message), 1, nullptr, 0, Delivery::Always, true) ? endpoint : noEndpoint;
+    return m_outgoingEndpoint == endpoint;
+}
+
+void Channel::sendFd(int fd)
+{
+    Message message;
+    Internal::FdTransfer::construct(message);
+    sendInternalMessage(message, &fd, 1);
+}
+
+SendStatistics Channel::sendStatistics() const
+{
+    return m_sendQueue.statistics();
+}
+
+LaneStatistics Channel::laneStatistics(Lane lane) const
+{
+    if (lane == Lane::Bulk)
+        return { m_bulkQueue.size(), m_bulkPeakDepth, m_bulkQueue.statistics() };
+    return { m_sendQueue.size(), m_sendPeakDepth, m_sendQueue.statistics() };
+}
+
+size_t Channel::latencyStatistics(LatencyStatistics* statistics, size_t capacity) const
+{
+    LatencyRecorder* latency = m_latency.load(std::memory_order_acquire);
+    return latency ? latency->statistics(statistics, capacity) : 0;
+}
+
+uint64_t Channel::lostMessages() const
+{
+    LatencyRecorder* latency = m_latency.load(std::memory_order_acquire);
+    return latency ? latency->lost() : 0;
+}
+
+ReadStatus Channel::readSynchronously(int timeoutMilliseconds)
+{
+    // Whatever is being waited for may depend on what is still queued here.
+    if (!m_sendQueue.isEmpty())
+        flushSendQueue();
+
+    if (m_ringReceiveActive && drainSharedRing())
+        return ReadStatus::Dispatched;
+
+    // Nothing but the handshake ever comes through the socket afterwards.
+    if (m_loopbackReceiveActive) {
+        if (drainLoopback())
+            return ReadStatus::Dispatched;
+        if (m_loopback->isClosed())
+            return ReadStatus::Closed;
+        if (!m_loopback->wait(incomingLoopbackDirection(m_side), timeoutMilliseconds))
+            return ReadStatus::TimedOut;
+        drainLoopback();
+        return m_loopback->isClosed() ? ReadStatus::Closed : ReadStatus::Dispatched;
+    }
+
+    GPollFD pfds[2] = {
+        { g_socket_get_fd(m_socket), G_IO_IN, 0 },
+        { m_ringReceiveActive ? m_ring->doorbellFd(incomingDirection(m_side)) : -1, G_IO_IN, 0 },
+    };
+#if USE_IPC_IO_URING
+    // Sends complete through the same eventfd as receives.
+    if (m_uring && m_uring->receiveActive()) {
+        m_uring->submit();
+        pfds[0].fd = m_uring->eventFd();
+    } else
+#endif
+    if (!m_sendQueue.isEmpty())
+        pfds[0].events |= G_IO_OUT;
+    int ready = g_poll(pfds, m_ringReceiveActive ? 2 : 1, timeoutMilliseconds);
+    if (!ready)
+        return ReadStatus::TimedOut;
+    // Interrupted, the caller decides whether to wait some more.
+    if (ready < 0)
+        return ReadStatus::Dispatched;
+
+    // The socket source reports the closure to the receiver once it runs.
+    if (pfds[0].revents & G_IO_OUT)
+        flushSendQueue();
+    if ((pfds[0].revents & ~G_IO_OUT) && !receive())
+        return ReadStatus::Closed;
+    if (m_ringReceiveActive && pfds[1].revents)
+        drainSharedRing();
+    return ReadStatus::Dispatched;
+}
+
+bool Channel::hasIncoming() const
+{
+    if (m_ringReceiveActive && !m_ring->isEmpty(incomingDirection(m_side)))
+        return true;
+    if (m_loopbackReceiveActive)
+        return m_loopback->hasPending(incomingLoopbackDirection(m_side)) || m_loopback->isClosed();
+
+    GPollFD pfd = { g_socket_get_fd(m_socket), G_IO_IN, 0 };
+#if USE_IPC_IO_URING
+    if (m_uring && m_uring->receiveActive())
+        pfd.fd = m_uring->eventFd();
+#endif
+    return g_poll(&pfd, 1, 0) > 0;
+}
+
+gboolean Channel::socketCallback(GSocket*, GIOCondition condition, gpointer data)
+{
+    if (!(condition & G_IO_IN))
+        return TRUE;
+
+    auto& channel = *static_cast<Channel*>(data);
+    if (channel.receive())
+        return TRUE;
+
+    if (channel.m_receiver.closed)
+        channel.m_receiver.closed(channel.m_receiverData);
+    return FALSE;
+}
+
+bool Channel::receive()
+{
+    ++m_receiveDepth;
+#if USE_IPC_IO_URING
+    bool keepSource = m_uring && m_uring->receiveActive() ? drainUring() : m_seqpacket ? receivePackets() : receiveStream();
+#else
+    bool keepSource = m_seqpacket ? receivePackets() : receiveStream();
+#endif
+    --m_receiveDepth;
+
+    return keepSource;
+}
+
+bool Channel::receiveStream()
+{
+    int socketFd = g_socket_get_fd(m_socket);
+    char* buffer = reinterpret_cast<char*>(m_receiveBuffer);
+
+    while (true) {
+        compactReceiveBuffer();
+
+        size_t space = sizeof(m_receiveBuffer) - m_receiveEnd;
+        if (!space)
+            return true;
+
+        struct iovec vector = { buffer + m_receiveEnd, space };
+        union {
+            char buffer[CMSG_SPACE(sizeof(int) * maxPendingFds)];
+            struct cmsghdr align;
+        } control;
+
+        struct msghdr header = { };
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        header.msg_control = control.buffer;
+        header.msg_controllen = sizeof(control.buffer);
+
+        ssize_t len = recvmsg(socketFd, &header, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            // Nothing left to read. A blocking socket that woke up without
+            // data is broken, a non-blocking one can wake up spuriously.
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return !m_blocking;
+            return true;
+        }
+
+        queueReceivedFds(header);
+
+        // The peer went away.
+        if (!len)
+            return false;
+
+        m_receiveEnd += len;
+        if (!dispatchRecords(buffer, m_receiveStart, m_receiveEnd))
+            return false;
+
+        // A short read drained the socket.
+        if (static_cast<size_t>(len) < space)
+            return true;
+    }
+}
+
+bool Channel::receivePackets()
+{
+    int socketFd = g_socket_get_fd(m_socket);
+    char* buffer = reinterpret_cast<char*>(m_receiveBuffer);
+
+    struct iovec vectors[packetBatchSize];
+    struct mmsghdr headers[packetBatchSize];
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * maxPacketFds)];
+        struct cmsghdr align;
+    } control[packetBatchSize];
+
+    while (true) {
+        compactReceiveBuffer();
+
+        // Every packet lands in its own record slot.
+        size_t count = std::min((sizeof(m_receiveBuffer) - m_receiveEnd) / Message::size, packetBatchSize);
+        if (!count)
+            return true;
+
+        memset(headers, 0, count * sizeof(struct mmsghdr));
+        for (size_t i = 0; i < count; ++i) {
+            vectors[i] = { buffer + m_receiveEnd + i * Message::size, Message::size };
+            headers[i].msg_hdr.msg_iov = &vectors[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_control = control[i].buffer;
+            headers[i].msg_hdr.msg_controllen = sizeof(control[i].buffer);
+        }
+
+        int received = recvmmsg(socketFd, headers, count, MSG_DONTWAIT | MSG_CMSG_CLOEXEC, nullptr);
+        if (received == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                return !m_blocking;
+            return true;
+        }
+
+        bool keepSource = true;
+        int valid = 0;
+        for (; valid < received; ++valid) {
+            queueReceivedFds(headers[valid].msg_hdr);
+
+            // An empty packet means the peer went away.
+            if (!headers[valid].msg_len) {
+                keepSource = false;
+                break;
+            }
+            if (headers[valid].msg_len != Message::size || (headers[valid].msg_hdr.msg_flags & MSG_TRUNC)) {
+                fprintf(stderr, "IPC::Channel: received a malformed packet, closing the channel\n");
+                keepSource = false;
+                break;
+            }
+        }
+
+        m_receiveEnd += valid * Message::size;
+        if (!dispatchRecords(buffer, m_receiveStart, m_receiveEnd) || !keepSource)
+            return false;
+
+        if (static_cast<size_t>(received) < count)
+            return true;
+    }
+}
+
+// Only the outermost receive may move the unread bytes to the front, a nested
+// one would pull records from under the handler running above it.
+void Channel::compactReceiveBuffer()
+{
+    if (m_receiveDepth != 1 || !m_receiveStart)
+        return;
+
+    char* buffer = reinterpret_cast<char*>(m_receiveBuffer);
+    memmove(buffer, buffer + m_receiveStart, m_receiveEnd - m_receiveStart);
+    m_receiveEnd -= m_receiveStart;
+    m_receiveStart = 0;
+}
+
+// Hands out every complete record between start and end. start is moved past
+// each record before it is delivered, so a nested receive continues after it.
+bool Channel::dispatchRecords(char* buffer, size_t& start, size_t end)
+{
+    while (end - start >= Message::size) {
+        auto* messages = reinterpret_cast<Message*>(buffer + start);
+        size_t available = (end - start) / Message::size;
+
+        if (Frame::isFrame(messages[0].messageCode)) {
+            auto& frame = *reinterpret_cast<Frame*>(messages);
+            if (frame.length > Frame::maxLength) {
+                fprintf(stderr, "IPC::Channel: received an oversized frame, closing the channel\n");
+                start = end;
+                return false;
+            }
+
+            size_t recordCount = Frame::recordCount(frame.length);
+            if (recordCount > available)
+                break;
+
+            start += recordCount * Message::size;
+            FlightRecorder::record(m_id, FlightRecorder::Direction::Received, messages[0]);
+            if (Internal::isInternal(frame.messageCode)) {
+                if (Internal::isRpc(frame.messageCode) && m_receiver.rpc)
+                    m_receiver.rpc(m_receiverData, reinterpret_cast<char*>(&frame.messageCode), sizeof(frame.messageCode) + frame.length);
+                continue;
+            }
+
+            char* data = reinterpret_cast<char*>(&frame.messageCode);
+            size_t size = sizeof(frame.messageCode) + frame.length;
+            size_t fdCount = std::min<size_t>(frame.flags & Frame::fdCountMask, size_t(Frame::maxFds));
+            recordLatency(frame.messageCode);
+            if (!fdCount) {
+                if (m_capture)
+                    m_capture->record(m_id, m_side == Side::Host, Capture::Kind::Message, data, size, 0);
+                m_receiver.message(m_receiverData, data, size);
+                continue;
+            }
+
+            // The message and its descriptors are handed out together or not
+            // at all.
+            int fds[Frame::maxFds];
+            size_t claimed = claimFds(fds, fdCount);
+            if (claimed != fdCount) {
+                fprintf(stderr, "IPC::Channel: descriptors of a message went missing, dropping it\n");
+                for (size_t i = 0; i < claimed; ++i)
+                    close(fds[i]);
+                continue;
+            }
+            if (m_capture)
+                m_capture->record(m_id, m_side == Side::Host, Capture::Kind::MessageWithFds, data, size, fdCount);
+            m_receiver.messageWithFds(m_receiverData, data, size, fds, fdCount);
+            continue;
+        }
+
+        if (Internal::isInternal(messages[0].messageCode)) {
+            start += Message::size;
+            FlightRecorder::record(m_id, FlightRecorder::Direction::Received, messages[0]);
+            handleInternalMessage(messages[0]);
+            continue;
+        }
+
+        size_t count = 1;
+        while (count < available && !Frame::isFrame(messages[count].messageCode) && !Internal::isInternal(messages[count].messageCode))
+            ++count;
+
+        start += count * Message::size;
+        for (size_t i = 0; i < count; ++i)
+            FlightRecorder::record(m_id, FlightRecorder::Direction::Received, messages[i]);
+        recordLatency(messages[0].messageCode);
+        if (m_capture)
+            m_capture->record(m_id, m_side == Side::Host, Capture::Kind::Messages, Message::data(messages[0]), count * Message::size, 0);
+        m_receiver.messages(m_receiverData, messages, count);
+    }
+
+    return true;
+}
+
+void Channel::handleInternalMessage(Message& message)
+{
+    switch (message.messageCode) {
+    case Internal::SharedRingOffer::code:
+    {
+        int fds[SharedRing::transferFdCount];
+        size_t nFds = takePendingFds(fds, SharedRing::transferFdCount);
+        // A client in the same process has no use for the ring.
+        if (m_side != Side::Client || m_ring || m_loopback || !canUse(Features::SharedRing)) {
+            for (size_t i = 0; i < nFds; ++i)
+                close(fds[i]);
+            break;
+        }
+
+        // The ring takes over the descriptors, even when mapping fails.
+        m_ring.reset(SharedRing::adopt(fds, nFds));
+        if (!m_ring) {
+            fprintf(stderr, "IPC::Channel: unable to map the offered shared ring, staying on the socket\n");
+            break;
+        }
+
+        // The accept message is the last one this side writes to the socket,
+        // everything after it goes through the ring.
+        Message accept;
+        Internal::SharedRingAccept::construct(accept);
+        sendInternalMessage(accept, nullptr, 0);
+        m_ringSendActive = true;
+        break;
+    }
+    case Internal::SharedRingAccept::code:
+    {
+        if (m_side != Side::Host || !m_ring || m_ringSendActive)
+            break;
+
+        startSharedRingReceive();
+
+        Message switchMessage;
+        Internal::SharedRingSwitch::construct(switchMessage);
+        sendInternalMessage(switchMessage, nullptr, 0);
+        m_ringSendActive = true;
+        break;
+    }
+    case Internal::SharedRingSwitch::code:
+        if (m_side != Side::Client || !m_ring || m_ringReceiveActive)
+            break;
+
+        startSharedRingReceive();
+        break;
+    case Internal::LoopbackAccept::code:
+    {
+        if (m_side != Side::Host || !m_loopback || m_loopbackSendActive)
+            break;
+
+        startLoopbackReceive();
+
+        Message switchMessage;
+        Internal::LoopbackSwitch::construct(switchMessage);
+        sendInternalMessage(switchMessage, nullptr, 0);
+        m_loopbackSendActive = true;
+        break;
+    }
+    case Internal::LoopbackSwitch::code:
+        if (m_side != Side::Client || !m_loopback || m_loopbackReceiveActive)
+            break;
+
+        startLoopbackReceive();
+        break;
+    case Internal::FdTransfer::code:
+    {
+        int fd;
+        if (!claimFds(&fd, 1))
+            break;
+        if (m_capture)
+            m_capture->record(m_id, m_side == Side::Host, Capture::Kind::Fd, nullptr, 0, 1);
+        m_receiver.fd(m_receiverData, fd);
+        break;
+    }
+    case Internal::FdCarrier::code:
+        // The descriptors stay pending until the message they belong to
+        // arrives through the ring.
+        break;
+    case Internal::Stamp::code:
+        handleStamp(message);
+        break;
+    case Internal::Capabilities::code:
+        handleCapabilities(message);
+        break;
+    default:
+        if (Internal::isMultiplex(message.messageCode) && m_receiver.multiplex) {
+            m_receiver.multiplex(m_receiverData, message);
+            break;
+        }
+        fprintf(stderr, "IPC::Channel: unhandled internal message\n");
+    }
+}
+
+void Channel::handleStamp(Message& message)
+{
+    auto& stamp = Internal::Stamp::cast(message);
+
+    LatencyRecorder* latency = m_latency.load(std::memory_order_relaxed);
+    if (!latency) {
+        latency = new LatencyRecorder;
+        m_latency.store(latency, std::memory_order_release);
+    }
+    if (stamp.sequence() > m_receiveSequence)
+        latency->addLost(stamp.sequence() - m_receiveSequence);
+
+    m_receiveSequence = stamp.sequence() + 1;
+    m_stampSent = stamp.sent();
+    m_stampPending = true;
+}
+
+// Peers of a newer version may advertise bits this end does not know about,
+// which the intersection takes care of.
+void Channel::handleCapabilities(Message& message)
+{
+    auto& capabilities = Internal::Capabilities::cast(message);
+    if (!capabilities.version)
+        return;
+
+    uint32_t common = m_features & capabilities.features;
+    m_commonFeatures.store(common, std::memory_order_release);
+    m_peerAdvertised.store(true, std::memory_order_release);
+
+    // Stamps only get in the way of a peer that cannot make sense of them.
+    if (!canUse(Features::Timestamps))
+        m_stampMessages = false;
+
+    if (uint32_t capacity = m_deferredRingCapacity) {
+        m_deferredRingCapacity = 0;
+        offerSharedRing(capacity);
+    }
+
+    if (m_receiver.features)
+        m_receiver.features(m_receiverData, common);
+}
+
+// Stamped messages always come one at a time, right after their stamp.
+void Channel::recordLatency(uint32_t code)
+{
+    if (!m_stampPending)
+        return;
+    m_stampPending = false;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t nanoseconds = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+    m_latency.load(std::memory_order_relaxed)->record(code, nanoseconds > m_stampSent ? nanoseconds - m_stampSent : 0);
+}
+
+void Channel::sendInternalMessage(Message& message, const int* fds, int nFds)
+{
+    queueRecords(Message::data(message), 1, fds, nFds, Delivery::Always, true);
+}
+
+// Every message goes through the queue, which is written out right away when
+// nothing is waiting ahead of it.
+bool Channel::queueRecords(const char* data, size_t recordCount, const int* fds, size_t fdCount, Delivery delivery, bool internal)
+{
+    FlightRecorder::record(m_id, FlightRecorder::Direction::Sent, *reinterpret_cast<const Message*>(data));
+
+    // The stamp travels as part of the message, nothing can come between
+    // them.
+    Message stamped[Frame::maxRecordCount + 1];
+    if (m_stampMessages && !internal) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        Internal::Stamp::construct(stamped[0], m_sendSequence++, uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec);
+        memcpy(&stamped[1], data, recordCount * Message::size);
+        data = Message::data(stamped[0]);
+        ++recordCount;
+        delivery = Delivery::Always;
+    }
+
+    bool wasEmpty = m_sendQueue.isEmpty();
+    if (wasEmpty && m_loopbackSendActive && !isHandshakeRecord(data))
+        return m_loopback->push(outgoingLoopbackDirection(m_side), data, recordCount, fds, fdCount);
+    if (wasEmpty && m_ringSendActive && !fdCount && !isHandshakeRecord(data) && m_ring->push(outgoingDirection(m_side), data, recordCount))
+        return true;
+
+    switch (m_sendQueue.append(data, recordCount, fds, fdCount, delivery, internal)) {
+    case SendQueue::Result::Appended:
+        break;
+    case SendQueue::Result::Merged:
+        return true;
+    case SendQueue::Result::Dropped:
+        if (!m_sendOverflowReported)
+            fprintf(stderr, "IPC::Channel: outgoing queue is full, dropping messages\n");
+        m_sendOverflowReported = true;
+        return false;
+    }
+
+    m_sendPeakDepth = std::max(m_sendPeakDepth, m_sendQueue.size());
+    if (wasEmpty)
+        flushSendQueue();
+
+    if (!m_sendQueue.isEmpty()) {
+        m_sendQueue.markLastWaiting();
+        scheduleFlush();
+    }
+    return true;
+}
+
+// Stamps are taken once a bulk message moves on to the send queue.
+bool Channel::queueBulkRecords(const char* data, size_t recordCount, const int* fds, size_t fdCount, Delivery delivery)
+{
+    if (m_sendQueue.isEmpty() && m_bulkQueue.isEmpty())
+        return queueRecords(data, recordCount, fds, fdCount, delivery, false);
+
+    switch (m_bulkQueue.append(data, recordCount, fds, fdCount, delivery, false)) {
+    case SendQueue::Result::Appended:
+        break;
+    case SendQueue::Result::Merged:
+        return true;
+    case SendQueue::Result::Dropped:
+        if (!m_sendOverflowReported)
+            fprintf(stderr, "IPC::Channel: outgoing bulk queue is full, dropping messages\n");
+        m_sendOverflowReported = true;
+        return false;
+    }
+
+    m_bulkQueue.markLastWaiting();
+    m_bulkPeakDepth = std::max(m_bulkPeakDepth, m_bulkQueue.size());
+    if (m_sendQueue.isEmpty())
+        drainBulkQueue();
+    return true;
+}
+
+// Stops as soon as a message stays in the send queue, control messages sent
+// from then on only wait for that one.
+void Channel::drainBulkQueue()
+{
+    if (m_drainingBulkQueue)
+        return;
+    m_drainingBulkQueue = true;
+
+    while (m_sendQueue.isEmpty() && !m_bulkQueue.isEmpty()) {
+        size_t recordCount = m_bulkQueue.messageRecordCount(0);
+        Message records[Frame::maxRecordCount];
+        for (size_t i = 0; i < recordCount; ++i)
+            memcpy(Message::data(records[i]), m_bulkQueue.record(i), Message::size);
+
+        const int* fds = nullptr;
+        size_t fdCount = m_bulkQueue.fds(0, &fds);
+        queueRecords(Message::data(records[0]), recordCount, fds, fdCount, Delivery::Always, false);
+        m_bulkQueue.consume(recordCount * Message::size);
+    }
+
+    m_drainingBulkQueue = false;
+}
+
+void Channel::flushSendQueue()
+{
+    int socketFd = g_socket_get_fd(m_socket);
+
+    while (!m_sendQueue.isEmpty()) {
+#if USE_IPC_IO_URING
+        // Nothing may overtake the records the kernel is still writing.
+        if (m_uring && m_uring->sendInFlight())
+            return;
+#endif
+
+        if (m_fdCarrierWritten && !finishFdCarrier())
+            return;
+
+        const int* fds = nullptr;
+        size_t fdCount = m_sendQueue.offset() ? 0 : m_sendQueue.fds(0, &fds);
+
+        // What was queued behind the loopback accept follows it in memory.
+        if (m_loopbackSendActive && !m_sendQueue.offset() && !isHandshakeRecord(m_sendQueue.record(0))) {
+            size_t recordCount = m_sendQueue.messageRecordCount(0);
+            Message records[receiveBatchSize];
+            for (size_t i = 0; i < recordCount; ++i)
+                memcpy(Message::data(records[i]), m_sendQueue.record(i), Message::size);
+
+            m_loopback->push(outgoingLoopbackDirection(m_side), Message::data(records[0]), recordCount, fds, fdCount);
+            m_sendQueue.consume(recordCount * Message::size);
+            continue;
+        }
+
+        // With the ring up, descriptors go ahead on the socket and the
+        // message follows through the ring.
+        if (m_ringSendActive && fdCount && !isHandshakeRecord(m_sendQueue.record(0))) {
+            if (!sendFdCarrier(fds, fdCount))
+                return;
+            m_sendQueue.releaseHeadFds();
+            continue;
+        }
+
+        // The handshake and the rest of a partially written record go through
+        // the socket, everything else uses the ring once it is up.
+        if (m_ringSendActive && !fdCount && !m_sendQueue.offset() && !isHandshakeRecord(m_sendQueue.record(0))) {
+            size_t recordCount = m_sendQueue.messageRecordCount(0);
+            Message records[receiveBatchSize];
+            for (size_t i = 0; i < recordCount; ++i)
+                memcpy(Message::data(records[i]), m_sendQueue.record(i), Message::size);
+
+            if (!m_ring->push(outgoingDirection(m_side), Message::data(records[0]), recordCount))
+                return;
+            m_sendQueue.consume(recordCount * Message::size);
+            continue;
+        }
+
+        // Batch up records until the next message that carries descriptors.
+        size_t count = m_ringSendActive ? m_sendQueue.messageRecordCount(0) : std::min(m_sendQueue.size(), packetBatchSize);
+        count = std::min(count, packetBatchSize);
+        const int* unused;
+        for (size_t i = 1; i < count; ++i) {
+            if (m_sendQueue.isMessageStart(i) && m_sendQueue.fds(i, &unused)) {
+                count = i;
+                break;
+            }
+        }
+
+        union {
+            char buffer[CMSG_SPACE(sizeof(int) * SendQueue::maxFds)];
+            struct cmsghdr align;
+        } control;
+
+        struct iovec vectors[packetBatchSize];
+        size_t bytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t offset = i ? 0 : m_sendQueue.offset();
+            vectors[i] = { m_sendQueue.record(i) + offset, Message::size - offset };
+            bytes += Message::size - offset;
+        }
+
+#if USE_IPC_IO_URING
+        if (m_uring) {
+            if (!m_uring->queueSend(vectors, count, fds, fdCount, m_seqpacket))
+                return;
+
+            // Replies produced while handling received messages are
+            // submitted together once the batch is done.
+            m_sendQueue.markInFlight(count);
+            if (!m_receiveDepth)
+                m_uring->submit();
+            return;
+        }
+#endif
+
+        ssize_t written;
+        if (m_seqpacket) {
+            struct mmsghdr headers[packetBatchSize];
+            memset(headers, 0, count * sizeof(struct mmsghdr));
+            for (size_t i = 0; i < count; ++i) {
+                headers[i].msg_hdr.msg_iov = &vectors[i];
+                headers[i].msg_hdr.msg_iovlen = 1;
+            }
+            attachFds(headers[0].msg_hdr, control.buffer, fds, fdCount);
+
+            int sent = sendmmsg(socketFd, headers, count, MSG_DONTWAIT | MSG_NOSIGNAL);
+            written = sent > 0 ? sent * Message::size : sent;
+        } else {
+            struct msghdr header = { };
+            header.msg_iov = vectors;
+            header.msg_iovlen = count;
+            attachFds(header, control.buffer, fds, fdCount);
+
+            written = sendmsg(socketFd, &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+
+            // The peer is gone, nothing queued can be delivered anymore.
+            fprintf(stderr, "IPC::Channel: failed to send, discarding the outgoing queue\n");
+            m_sendQueue.consume(m_sendQueue.size() * Message::size - m_sendQueue.offset());
+            m_bulkQueue.consume(m_bulkQueue.size() * Message::size);
+            return;
+        }
+
+        m_sendQueue.consume(written);
+        if (static_cast<size_t>(written) < bytes)
+            return;
+    }
+
+    m_sendOverflowReported = false;
+    if (!m_bulkQueue.isEmpty())
+        drainBulkQueue();
+}
+
+bool Channel::sendFdCarrier(const int* fds, size_t fdCount)
+{
+    Message message;
+    Internal::FdCarrier::construct(message);
+
+    union {
+        char buffer[CMSG_SPACE(sizeof(int) * SendQueue::maxFds)];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec vector = { Message::data(message), Message::size };
+    struct msghdr header = { };
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    attachFds(header, control.buffer, fds, fdCount);
+
+    ssize_t written;
+    do
+        written = sendmsg(g_socket_get_fd(m_socket), &header, MSG_DONTWAIT | MSG_NOSIGNAL);
+    while (written == -1 && errno == EINTR);
+    if (written == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return false;
+        fprintf(stderr, "IPC::Channel: failed to send descriptors\n");
+        return true;
+    }
+
+    // Only a stream socket can take part of the record. The descriptors are
+    // out by then, flushSendQueue() writes the rest before anything else.
+    if (size_t(written) < Message::size) {
+        m_fdCarrier = message;
+        m_fdCarrierWritten = written;
+    }
+    return true;
+}
+
+bool Channel::finishFdCarrier()
+{
+    while (m_fdCarrierWritten < Message::size) {
+        ssize_t written = send(g_socket_get_fd(m_socket), Message::data(m_fdCarrier) + m_fdCarrierWritten,
+            Message::size - m_fdCarrierWritten, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return false;
+            fprintf(stderr, "IPC::Channel: failed to send descriptors\n");
+            break;
+        }
+        m_fdCarrierWritten += written;
+    }
+
+    m_fdCarrierWritten = 0;
+    return true;
+}
+
+// The socket tells when it can take more data. The shared ring does not, so
+// it is retried shortly instead.
+void Channel::scheduleFlush()
+{
+    if (m_sendSource)
+        return;
+
+    const int* fds;
+    if (m_ringSendActive && !m_fdCarrierWritten && !m_sendQueue.offset() && !m_sendQueue.fds(0, &fds) && !isHandshakeRecord(m_sendQueue.record(0))) {
+        m_sendSource = g_timeout_source_new(1);
+        g_source_set_callback(m_sendSource, sendTimeoutCallback, this, nullptr);
+    } else {
+#if USE_IPC_IO_URING
+        // The completion of the send in flight flushes the rest.
+        if (m_uring && m_uring->sendInFlight())
+            return;
+#endif
+        m_sendSource = g_socket_create_source(m_socket, G_IO_OUT, nullptr);
+        g_source_set_callback(m_sendSource, reinterpret_cast<GSourceFunc>(sendSocketCallback), this, nullptr);
+    }
+
+    g_source_set_name(m_sendSource, "[WPE] IPC outgoing queue");
+    g_source_set_priority(m_sendSource, m_priority);
+    g_source_attach(m_sendSource, m_context);
+}
+
+gboolean Channel::sendSocketCallback(GSocket*, GIOCondition, gpointer data)
+{
+    return sendTimeoutCallback(data);
+}
+
+gboolean Channel::sendTimeoutCallback(gpointer data)
+{
+    auto& channel = *static_cast<Channel*>(data);
+
+    g_source_unref(channel.m_sendSource);
+    channel.m_sendSource = nullptr;
+
+    channel.flushSendQueue();
+    if (!channel.m_sendQueue.isEmpty())
+        channel.scheduleFlush();
+    return G_SOURCE_REMOVE;
+}
+
+void Channel::startSharedRingReceive()
+{
+    m_doorbellSource = g_source_new(&DoorbellSource::sourceFuncs, sizeof(DoorbellSource));
+    auto& source = *reinterpret_cast<DoorbellSource*>(m_doorbellSource);
+    source.channel = this;
+
+    source.pfd.fd = m_ring->doorbellFd(incomingDirection(m_side));
+    source.pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    source.pfd.revents = 0;
+    g_source_add_poll(m_doorbellSource, &source.pfd);
+
+    g_source_set_name(m_doorbellSource, "[WPE] IPC shared ring");
+    g_source_set_priority(m_doorbellSource, m_priority);
+    g_source_set_can_recurse(m_doorbellSource, TRUE);
+    g_source_attach(m_doorbellSource, m_context);
+
+    m_ringReceiveActive = true;
+}
+
+bool Channel::drainSharedRing()
+{
+    auto direction = incomingDirection(m_side);
+    m_ring->clearDoorbell(direction);
+
+    bool dispatched = false;
+    Message messages[receiveBatchSize];
+    char* buffer = reinterpret_cast<char*>(messages);
+    do {
+        while (true) {
+            size_t count = 0;
+            while (count < receiveBatchSize && m_ring->pop(direction, Message::data(messages[count]))) {
+                if (!Frame::isFrame(messages[count].messageCode)) {
+                    ++count;
+                    continue;
+                }
+
+                // The producer publishes a frame at once, so its remaining
+                // records are already there. Flush what precedes it first if
+                // they do not fit behind.
+                size_t recordCount = Frame::recordCount(std::min<size_t>(reinterpret_cast<Frame&>(messages[count]).length, size_t(Frame::maxLength)));
+                if (count + recordCount > receiveBatchSize) {
+                    size_t start = 0;
+                    dispatchRecords(buffer, start, count * Message::size);
+                    messages[0] = messages[count];
+                    count = 0;
+                }
+                for (size_t i = 1; i < recordCount; ++i)
+                    m_ring->pop(direction, Message::data(messages[count + i]));
+                count += recordCount;
+            }
+            if (!count)
+                break;
+
+            size_t start = 0;
+            dispatchRecords(buffer, start, count * Message::size);
+            dispatched = true;
+        }
+    } while (!m_ring->prepareToSleep(direction));
+
+    return dispatched;
+}
+
+#if USE_IPC_IO_URING
+void Channel::startUring()
+{
+    m_uringSource = g_source_new(&UringSource::sourceFuncs, sizeof(UringSource));
+    auto& source = *reinterpret_cast<UringSource*>(m_uringSource);
+    source.channel = this;
+
+    source.pfd.fd = m_uring->eventFd();
+    source.pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    source.pfd.revents = 0;
+    g_source_add_poll(m_uringSource, &source.pfd);
+
+    g_source_set_name(m_uringSource, "[WPE] IPC io_uring");
+    g_source_set_priority(m_uringSource, m_priority);
+    g_source_set_can_recurse(m_uringSource, TRUE);
+    g_source_attach(m_uringSource, m_context);
+}
+
+bool Channel::drainUring()
+{
+    m_uring->clearEventFd();
+    // Descriptors claimed by a ring message may not have been posted yet.
+    m_uring->submit(m_receiveDepth > 1);
+
+    bool keepSource = true;
+    while (keepSource) {
+        if (m_uringBacklog.active) {
+            keepSource = receiveBytes(m_uringBacklog.data, m_uringBacklog.length);
+            // Still no room, the outer receive picks it up again.
+            if (keepSource && m_uringBacklog.length)
+                break;
+
+            m_uring->releaseBuffer(m_uringBacklog.buffer);
+            m_uringBacklog.active = false;
+            continue;
+        }
+
+        Uring::Completion completion;
+        if (!m_uring->nextCompletion(completion))
+            break;
+
+        switch (completion.event) {
+        case Uring::Event::Received:
+            queueReceivedFds(completion.header);
+            if (m_seqpacket && (completion.length != Message::size || (completion.header.msg_flags & MSG_TRUNC))) {
+                fprintf(stderr, "IPC::Channel: received a malformed packet, closing the channel\n");
+                m_uring->releaseBuffer(completion.buffer);
+                keepSource = false;
+                break;
+            }
+            m_uringBacklog = { completion.data, completion.length, completion.buffer, true };
+            break;
+        case Uring::Event::Sent:
+            completeUringSend(completion.result);
+            break;
+        case Uring::Event::ReceiveFailed:
+            // Sends keep going through io_uring, only reading falls back.
+            fprintf(stderr, "IPC::Channel: io_uring receive failed (%s), reading the socket directly\n", strerror(-completion.result));
+            attachSocketSource();
+            return true;
+        case Uring::Event::Closed:
+            keepSource = false;
+            break;
+        }
+    }
+
+    if (m_receiveDepth <= 1)
+        m_uring->submit();
+    return keepSource;
+}
+
+// Copies as much as fits behind the unread records and hands it out, data and
+// length are advanced past what was taken.
+bool Channel::receiveBytes(const char*& data, size_t& length)
+{
+    char* buffer = reinterpret_cast<char*>(m_receiveBuffer);
+
+    while (length) {
+        compactReceiveBuffer();
+
+        size_t space = sizeof(m_receiveBuffer) - m_receiveEnd;
+        if (!space)
+            return true;
+
+        size_t chunk = std::min(space, length);
+        memcpy(buffer + m_receiveEnd, data, chunk);
+        m_receiveEnd += chunk;
+        data += chunk;
+        length -= chunk;
+
+        if (!dispatchRecords(buffer, m_receiveStart, m_receiveEnd))
+            return false;
+    }
+    return true;
+}
+
+void Channel::completeUringSend(ssize_t result)
+{
+    if (result < 0) {
+        fprintf(stderr, "IPC::Channel: failed to send, discarding the outgoing queue\n");
+        m_sendQueue.consume(m_sendQueue.size() * Message::size - m_sendQueue.offset());
+        m_bulkQueue.consume(m_bulkQueue.size() * Message::size);
+        return;
+    }
+
+    m_sendQueue.consume(result);
+    flushSendQueue();
+}
+#endif
+
+void Channel::startLoopbackReceive()
+{
+    m_loopback->setReceiveContext(incomingLoopbackDirection(m_side), m_context ? m_context : g_main_context_default());
+
+    m_loopbackSource = g_source_new(&LoopbackSource::sourceFuncs, sizeof(LoopbackSource));
+    auto& source = *reinterpret_cast<LoopbackSource*>(m_loopbackSource);
+    source.channel = this;
+
+    g_source_set_name(m_loopbackSource, "[WPE] IPC loopback");
+    g_source_set_priority(m_loopbackSource, m_priority);
+    g_source_set_can_recurse(m_loopbackSource, TRUE);
+    g_source_attach(m_loopbackSource, m_context);
+
+    m_loopbackReceiveActive = true;
+}
+
+bool Channel::drainLoopback()
+{
+    // A handler reading synchronously ends up in here again, it gets a batch
+    // of its own.
+    Loopback::Batch batch;
+    std::swap(batch, m_loopbackBatch);
+    m_loopback->take(incomingLoopbackDirection(m_side), batch);
+
+    bool dispatched = !batch.records.empty();
+    char* buffer = reinterpret_cast<char*>(batch.records.data());
+    size_t start = 0;
+
+    // Descriptors become pending right before the message owning them.
+    for (auto& entry : batch.fds) {
+        dispatchRecords(buffer, start, entry.record * Message::size);
+        queuePendingFds(entry.fds, entry.count);
+    }
+    dispatchRecords(buffer, start, batch.records.size() * Message::size);
+
+    std::swap(batch, m_loopbackBatch);
+    return dispatched;
+}
+
+void Channel::queueReceivedFds(struct msghdr& header)
+{
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header); cmsg; cmsg = CMSG_NXTHDR(&header, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+            queuePendingFds(reinterpret_cast<int*>(CMSG_DATA(cmsg)), (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    }
+    if (header.msg_flags & MSG_CTRUNC)
+        fprintf(stderr, "IPC::Channel: too many descriptors in one message, some were lost\n");
+}
+
+void Channel::queuePendingFds(const int* fds, size_t nFds)
+{
+    for (size_t i = 0; i < nFds; ++i) {
+        if (m_pendingFdCount == maxPendingFds) {
+            fprintf(stderr, "IPC::Channel: too many unclaimed descriptors, closing one\n");
+            close(fds[i]);
+            continue;
+        }
+        m_pendingFds[m_pendingFdCount++] = fds[i];
+    }
+}
+
+// Descriptors for a message that came through the ring may still sit in the
+// socket, they were written there before the message was pushed.
+size_t Channel::claimFds(int* fds, size_t nFds)
+{
+    if (m_pendingFdCount < nFds && m_ringReceiveActive)
+        receive();
+
+    return takePendingFds(fds, nFds);
+}
+
+size_t Channel::takePendingFds(int* fds, size_t nFds)
+{
+    if (nFds > m_pendingFdCount)
+        nFds = m_pendingFdCount;
+
+    memcpy(fds, m_pendingFds, nFds * sizeof(int));
+    memmove(m_pendingFds, m_pendingFds + nFds, (m_pendingFdCount - nFds) * sizeof(int));
+    m_pendingFdCount -= nFds;
+    return nFds;
+}
+
+void Channel::closePendingFds()
+{
+    for (size_t i = 0; i < m_pendingFdCount; ++i)
+        close(m_pendingFds[i]);
+    m_pendingFdCount = 0;
+}
+
+} // namespace IPC
@@ -0,0 +1,546 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_channel_h
+#define wpe_platform_ipc_channel_h
+
+#include "ipc.h"
+#include "ipc-latency.h"
+#include "ipc-loopback.h"
+#include "ipc-send-queue.h"
+#include <atomic>
+#include <gio/gio.h>
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct msghdr;
+
+namespace IPC {
+
+class Capture;
+class SharedRing;
+#if USE_IPC_IO_URING
+class Uring;
+#endif
+
+// Messages the channels exchange among themselves. They live at the top of
+// the code space and are never handed to a Host or Client handler.
+namespace Internal {
+
+static const uint32_t codeBase = 0x7fff0000;
+
+static inline bool isInternal(uint32_t code) { return code >= codeBase; }
+
+struct SharedRingOffer {
+    uint32_t capacity;
+    uint8_t padding[32];
+
+    static const uint32_t code = codeBase + 1;
+    static void construct(Message& message, uint32_t capacity)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<SharedRingOffer*>(std::addressof(message.messageData));
+        messageData.capacity = capacity;
+    }
+    static SharedRingOffer& cast(Message& message)
+    {
+        return *reinterpret_cast<SharedRingOffer*>(std::addressof(message.messageData));
+    }
+};
+static_assert(sizeof(SharedRingOffer) == Message::dataSize, "SharedRingOffer is of correct size");
+
+struct SharedRingAccept {
+    uint8_t padding[Message::dataSize];
+
+    static const uint32_t code = codeBase + 2;
+    static void construct(Message& message)
+    {
+        message.messageCode = code;
+    }
+};
+static_assert(sizeof(SharedRingAccept) == Message::dataSize, "SharedRingAccept is of correct size");
+
+struct SharedRingSwitch {
+    uint8_t padding[Message::dataSize];
+
+    static const uint32_t code = codeBase + 3;
+    static void construct(Message& message)
+    {
+        message.messageCode = code;
+    }
+};
+static_assert(sizeof(SharedRingSwitch) == Message::dataSize, "SharedRingSwitch is of correct size");
+
+// Carries the descriptor of a sendFd() call, so the stream stays a sequence
+// of whole records.
+struct FdTransfer {
+    uint8_t padding[Message::dataSize];
+
+    static const uint32_t code = codeBase + 4;
+    static void construct(Message& message)
+    {
+        message.messageCode = code;
+    }
+};
+static_assert(sizeof(FdTransfer) == Message::dataSize, "FdTransfer is of correct size");
+
+// Brings the descriptors of a message that goes through the shared ring,
+// which cannot carry them itself. It is written to the socket right before
+// the message is pushed.
+struct FdCarrier {
+    uint8_t padding[Message::dataSize];
+
+    static const uint32_t code = codeBase + 5;
+    static void construct(Message& message)
+    {
+        message.messageCode = code;
+    }
+};
+static_assert(sizeof(FdCarrier) == Message::dataSize, "FdCarrier is of correct size");
+
+// Sent over the socket by a client that found its host in the same process.
+// Everything it sends afterwards goes through the loopback queues.
+struct LoopbackAccept {
+    uint8_t padding[Message::dataSize];
+
+    static const uint32_t code = codeBase + 6;
+    static void construct(Message& message)
+    {
+        message.messageCode = code;
+    }
+};
+static_assert(sizeof(LoopbackAccept) == Message::dataSize, "LoopbackAccept is of correct size");
+
+// The host's answer, the last thing it writes to the socket.
+struct LoopbackSwitch {
+    uint8_t padding[Message::dataSize];
+
+    static const uint32_t code = codeBase + 7;
+    static void construct(Message& message)
+    {
+        message.messageCode = code;
+    }
+};
+static_assert(sizeof(LoopbackSwitch) == Message::dataSize, "LoopbackSwitch is of correct size");
+
+// First record of a connection handed out by a host-side Multiplexer.
+struct MultiplexHello {
+    uint32_t multiplexerLow;
+    uint32_t multiplexerHigh;
+    uint32_t endpoint;
+    uint8_t padding[24];
+
+    static const uint32_t code = codeBase + 8;
+    static void construct(Message& message, uint64_t multiplexer, uint32_t endpoint)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<MultiplexHello*>(std::addressof(message.messageData));
+        messageData.multiplexerLow = multiplexer;
+        messageData.multiplexerHigh = multiplexer >> 32;
+        messageData.endpoint = endpoint;
+    }
+    static MultiplexHello& cast(Message& message)
+    {
+        return *reinterpret_cast<MultiplexHello*>(std::addressof(message.messageData));
+    }
+
+    uint64_t multiplexer() const { return uint64_t(multiplexerHigh) << 32 | multiplexerLow; }
+};
+static_assert(sizeof(MultiplexHello) == Message::dataSize, "MultiplexHello is of correct size");
+
+// The messages that follow belong to another endpoint of a multiplexed
+// connection.
+struct ChannelSelect {
+    uint32_t endpoint;
+    uint8_t padding[32];
+
+    static const uint32_t code = codeBase + 9;
+    static void construct(Message& message, uint32_t endpoint)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<ChannelSelect*>(std::addressof(message.messageData));
+        messageData.endpoint = endpoint;
+    }
+    static ChannelSelect& cast(Message& message)
+    {
+        return *reinterpret_cast<ChannelSelect*>(std::addressof(message.messageData));
+    }
+};
+static_assert(sizeof(ChannelSelect) == Message::dataSize, "ChannelSelect is of correct size");
+
+// Sent by a client that serves the endpoint over this connection from now on.
+struct ChannelAttach {
+    uint32_t endpoint;
+    uint8_t padding[32];
+
+    static const uint32_t code = codeBase + 10;
+    static void construct(Message& message, uint32_t endpoint)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<ChannelAttach*>(std::addressof(message.messageData));
+        messageData.endpoint = endpoint;
+    }
+    static ChannelAttach& cast(Message& message)
+    {
+        return *reinterpret_cast<ChannelAttach*>(std::addressof(message.messageData));
+    }
+};
+static_assert(sizeof(ChannelAttach) == Message::dataSize, "ChannelAttach is of correct size");
+
+// Precedes every message of a channel that stamps what it sends. Sequence
+// numbers count the stamped messages, including those that were dropped.
+struct Stamp {
+    uint32_t sequenceLow;
+    uint32_t sequenceHigh;
+    uint32_t sentLow;
+    uint32_t sentHigh;
+    uint8_t padding[20];
+
+    static const uint32_t code = codeBase + 11;
+    static void construct(Message& message, uint64_t sequence, uint64_t sent)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<Stamp*>(std::addressof(message.messageData));
+        messageData.sequenceLow = sequence;
+        messageData.sequenceHigh = sequence >> 32;
+        messageData.sentLow = sent;
+        messageData.sentHigh = sent >> 32;
+    }
+    static Stamp& cast(Message& message)
+    {
+        return *reinterpret_cast<Stamp*>(std::addressof(message.messageData));
+    }
+
+    uint64_t sequence() const { return uint64_t(sequenceHigh) << 32 | sequenceLow; }
+    // CLOCK_MONOTONIC, in nanoseconds.
+    uint64_t sent() const { return uint64_t(sentHigh) << 32 | sentLow; }
+};
+static_assert(sizeof(Stamp) == Message::dataSize, "Stamp is of correct size");
+
+// Headers of the request and response frames, followed by the payload.
+// Answers carry the id of the request they belong to.
+struct RpcRequest {
+    uint32_t id;
+    uint32_t messageCode;
+
+    static const uint32_t code = codeBase + 12;
+    static const size_t maxPayload = Frame::maxLength - 2 * sizeof(uint32_t);
+};
+static_assert(sizeof(RpcRequest) == 2 * sizeof(uint32_t), "RpcRequest is of correct size");
+
+struct RpcResponse {
+    uint32_t id;
+
+    static const uint32_t code = codeBase + 13;
+    static const size_t maxPayload = Frame::maxLength - sizeof(uint32_t);
+};
+static_assert(sizeof(RpcResponse) == sizeof(uint32_t), "RpcResponse is of correct size");
+
+// What the sending end supports, see Features. Sent once per connection,
+// before anything else the channel itself writes.
+struct Capabilities {
+    uint32_t version;
+    uint32_t features;
+    uint8_t padding[28];
+
+    static const uint32_t currentVersion = 1;
+
+    static const uint32_t code = codeBase + 14;
+    static void construct(Message& message, uint32_t features)
+    {
+        message.messageCode = code;
+
+        auto& messageData = *reinterpret_cast<Capabilities*>(std::addressof(message.messageData));
+        messageData.version = currentVersion;
+        messageData.features = features;
+    }
+    static Capabilities& cast(Message& message)
+    {
+        return *reinterpret_cast<Capabilities*>(std::addressof(message.messageData));
+    }
+};
+static_assert(sizeof(Capabilities) == Message::dataSize, "Capabilities is of correct size");
+
+static inline bool isRpc(uint32_t code)
+{
+    return code == RpcRequest::code || code == RpcResponse::code;
+}
+
+static inline bool isMultiplex(uint32_t code)
+{
+    return code >= MultiplexHello::code && code <= ChannelAttach::code;
+}
+
+// The shared ring and loopback handshakes always go through the socket.
+static inline bool isHandshake(uint32_t code)
+{
+    return (code >= SharedRingOffer::code && code <= SharedRingSwitch::code)
+        || code == LoopbackAccept::code || code == LoopbackSwitch::code;
+}
+
+} // namespace Internal
+
+class Channel {
+public:
+    struct Receiver {
+        void (*message)(void*, char*, size_t);
+        void (*messages)(void*, Message*, size_t);
+        void (*messageWithFds)(void*, char*, size_t, int*, size_t);
+        void (*fd)(void*, int);
+        // Optional, the multiplexing records.
+        void (*multiplex)(void*, Message&);
+        // Optional, the peer went away.
+        void (*closed)(void*);
+        // Optional, request and response frames, starting at the code.
+        void (*rpc)(void*, char*, size_t);
+        // Optional, what both ends support, once the peer told.
+        void (*features)(void*, uint32_t);
+    };
+
+    enum class Side { Host, Client };
+
+    Channel(Side, const Receiver&, void*);
+    ~Channel();
+
+    // SOCK_SEQPACKET with WPE_IPC_SEQPACKET=1, otherwise SOCK_STREAM.
+    static bool createSocketPair(int sockets[2]);
+
+    bool initialize(int fd, gint priority, gboolean blocking);
+
+    // Applies WPE_IPC_SEND_QUEUE_LIMIT, WPE_IPC_TIMESTAMPS and WPE_IPC_IO_URING, before
+    // initialize(). The host offers a shared ring if WPE_IPC_SHARED_RING asks
+    // for it.
+    void configureFromEnvironment();
+    void offerSharedRingFromEnvironment();
+
+    void offerSharedRing(uint32_t capacity);
+    void setSendQueueLimit(size_t records);
+    void setMergeFunction(MergeFunction);
+    // Sends a Stamp ahead of every message. Stamped messages are never
+    // superseded.
+    void setStampMessages(bool stampMessages) { m_stampMessages = stampMessages; }
+
+    // Tells the peer which features this end supports, the backend ones
+    // passed in on top of those of the channel itself. Goes out ahead of the
+    // shared ring and loopback handshakes.
+    void advertiseFeatures(uint32_t backendFeatures);
+    // Zero until the peer advertised its features. Safe to call from any
+    // thread.
+    uint32_t commonFeatures() const;
+    // Whether the features may be used with the peer. Until it advertised
+    // its own, or if this end advertised none, everything is used as it
+    // always was. Safe to call from any thread.
+    bool canUse(uint32_t features) const;
+
+    // The host side keeps the loopback around until a client in the same
+    // process accepts it, the client side accepts right away.
+    void setLoopback(Loopback*);
+    void acceptLoopback(Loopback*);
+#if USE_IPC_IO_URING
+    // Has to be called before initialize(), the socket is used directly if
+    // io_uring turns out to be unavailable.
+    void setUseUring(bool useUring) { m_useUring = useUring; }
+#endif
+
+    // Sizes other than Message::size are sent as a frame, the data starting
+    // with the message code.
+    void sendMessage(const char*, size_t, Delivery = Delivery::Always, Lane = Lane::Control);
+    void sendFrame(uint32_t code, const void* payload, size_t length, const int* fds = nullptr, size_t fdCount = 0, Lane = Lane::Control);
+    void sendFd(int);
+    // Records encoded by encodeFrame() or a plain Message, sent as they are.
+    void sendRecords(const char*, size_t recordCount, const int* fds, size_t fdCount);
+
+    // Makes the endpoint the receiver of whatever is sent next over a
+    // multiplexed connection. Fails if the outgoing queue has no room left.
+    bool selectEndpoint(uint32_t);
+
+    // Returns the number of records written, zero if it is too large.
+    static size_t encodeFrame(uint32_t code, const void* payload, size_t length, size_t fdCount, Message* records);
+
+    SendStatistics sendStatistics() const;
+    LaneStatistics laneStatistics(Lane) const;
+    // Safe to call from any thread.
+    size_t latencyStatistics(LatencyStatistics*, size_t capacity) const;
+    uint64_t lostMessages() const;
+
+    // See Client::readSynchronously().
+    ReadStatus readSynchronously(int timeoutMilliseconds = -1);
+    // Whether something arrived that readSynchronously() or the sources
+    // would dispatch, or the peer went away. Dispatches nothing. With
+    // io_uring a completed send counts as well.
+    bool hasIncoming() const;
+
+private:
+    static const size_t receiveBatchSize = 128;
+    static_assert(receiveBatchSize >= Frame::maxRecordCount, "a whole frame fits in the receive buffer");
+    static const uint32_t noEndpoint = 0;
+    static const size_t maxPendingFds = 16;
+    static const size_t packetBatchSize = 64;
+    static const size_t maxPacketFds = 4;
+
+    static gboolean socketCallback(GSocket*, GIOCondition, gpointer);
+
+    void attachSocketSource();
+    bool receive();
+    bool receiveStream();
+    bool receivePackets();
+    void compactReceiveBuffer();
+    bool dispatchRecords(char*, size_t& start, size_t end);
+    void handleInternalMessage(Message&);
+    void handleStamp(Message&);
+    void handleCapabilities(Message&);
+    void recordLatency(uint32_t code);
+    void sendInternalMessage(Message&, const int*, int);
+
+    bool queueRecords(const char*, size_t recordCount, const int* fds, size_t fdCount, Delivery, bool internal);
+    bool queueBulkRecords(const char*, size_t recordCount, const int* fds, size_t fdCount, Delivery);
+    void drainBulkQueue();
+    void flushSendQueue();
+    bool sendFdCarrier(const int* fds, size_t fdCount);
+    bool finishFdCarrier();
+    void scheduleFlush();
+    static gboolean sendSocketCallback(GSocket*, GIOCondition, gpointer);
+    static gboolean sendTimeoutCallback(gpointer);
+
+    size_t claimFds(int*, size_t);
+    void queueReceivedFds(struct msghdr&);
+    void queuePendingFds(const int*, size_t);
+    size_t takePendingFds(int*, size_t);
+    void closePendingFds();
+
+    void startSharedRingReceive();
+    bool drainSharedRing();
+
+    void startLoopbackReceive();
+    bool drainLoopback();
+    class LoopbackSource;
+
+#if USE_IPC_IO_URING
+    void startUring();
+    bool drainUring();
+    bool receiveBytes(const char*&, size_t&);
+    void completeUringSend(ssize_t);
+    class UringSource;
+#endif
+
+    class DoorbellSource;
+
+    Side m_side;
+    const Receiver& m_receiver;
+    void* m_receiverData;
+    // Tells channels apart in the flight recorder and in captures.
+    uint32_t m_id { 0 };
+    Capture* m_capture { nullptr };
+
+    GSocket* m_socket { nullptr };
+    GSource* m_source { nullptr };
+    GMainContext* m_context { nullptr };
+    gboolean m_blocking { TRUE };
+    gint m_priority { 0 };
+
+    // SOCK_SEQPACKET keeps every record in its own packet, SOCK_STREAM needs
+    // records to be put back together from the byte stream.
+    bool m_seqpacket { false };
+
+    // Records are read straight into this buffer and handed out from there.
+    // A partial record at the end stays in place until the rest arrives.
+    // Offsets are in bytes.
+    Message m_receiveBuffer[receiveBatchSize];
+    size_t m_receiveStart { 0 };
+    size_t m_receiveEnd { 0 };
+    unsigned m_receiveDepth { 0 };
+
+    int m_pendingFds[maxPendingFds];
+    size_t m_pendingFdCount { 0 };
+
+    SendQueue m_sendQueue;
+    size_t m_sendPeakDepth { 0 };
+    // Bulk messages wait here while anything else is queued, and move to
+    // the send queue one at a time once it ran empty.
+    SendQueue m_bulkQueue;
+    size_t m_bulkPeakDepth { 0 };
+    bool m_drainingBulkQueue { false };
+    GSource* m_sendSource { nullptr };
+    uint32_t m_outgoingEndpoint { noEndpoint };
+    bool m_sendOverflowReported { false };
+    // A descriptor carrier the socket only took part of. Its descriptors are
+    // out, the rest goes ahead of everything else.
+    Message m_fdCarrier;
+    size_t m_fdCarrierWritten { 0 };
+
+    bool m_stampMessages { false };
+    uint64_t m_sendSequence { 0 };
+    // The stamp of the message that is received next. Histograms are only
+    // allocated once the peer turns out to stamp its messages.
+    uint64_t m_receiveSequence { 0 };
+    uint64_t m_stampSent { 0 };
+    bool m_stampPending { false };
+    std::atomic<LatencyRecorder*> m_latency { nullptr };
+
+    uint32_t m_features { 0 };
+    std::atomic<uint32_t> m_commonFeatures { 0 };
+    std::atomic<bool> m_peerAdvertised { false };
+    // A shared ring offered before the peer told whether it supports one.
+    uint32_t m_deferredRingCapacity { 0 };
+
+    std::unique_ptr<SharedRing> m_ring;
+    GSource* m_doorbellSource { nullptr };
+    bool m_ringSendActive { false };
+    bool m_ringReceiveActive { false };
+
+    Loopback* m_loopback { nullptr };
+    GSource* m_loopbackSource { nullptr };
+    // Swapped with the incoming queue, so both keep their capacity.
+    Loopback::Batch m_loopbackBatch;
+    bool m_loopbackSendActive { false };
+    bool m_loopbackReceiveActive { false };
+
+#if USE_IPC_IO_URING
+    bool m_useUring { false };
+    std::unique_ptr<Uring> m_uring;
+    GSource* m_uringSource { nullptr };
+
+    // What is left of a received buffer that did not fit behind the unread
+    // records of an outer receive yet.
+    struct {
+        const char* data;
+        size_t length;
+        uint16_t buffer;
+        bool active;
+    } m_uringBacklog { nullptr, 0, 0, false };
+#endif
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_channel_h
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_dmabuf_h
+#define wpe_platform_ipc_dmabuf_h
+
+#include "ipc.h"
+#include <stdint.h>
+
+namespace IPC {
+
+namespace DMABuf {
+
+// Layout of a buffer made of one descriptor per plane. It is the payload of
+// a message sent with sendMessageWithFds(), the descriptors following the
+// plane order.
+struct Planes {
+    static const size_t maxPlanes = Frame::maxFds;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t planeCount;
+    // Split in halves, frame payloads are only 4-byte aligned.
+    uint32_t modifierLow;
+    uint32_t modifierHigh;
+    uint32_t offsets[maxPlanes];
+    uint32_t strides[maxPlanes];
+
+    uint64_t modifier() const { return uint64_t(modifierHigh) << 32 | modifierLow; }
+    void setModifier(uint64_t modifier)
+    {
+        modifierLow = modifier & 0xffffffff;
+        modifierHigh = modifier >> 32;
+    }
+
+    // Returns nullptr unless the message is a plane list matching fdCount.
+    static const Planes* cast(char* data, size_t size, size_t fdCount)
+    {
+        if (size != sizeof(uint32_t) + sizeof(Planes))
+            return nullptr;
+
+        auto* planes = reinterpret_cast<const Planes*>(Frame::payload(data));
+        if (!planes->planeCount || planes->planeCount > maxPlanes || planes->planeCount != fdCount)
+            return nullptr;
+        return planes;
+    }
+};
+static_assert(sizeof(Planes) + sizeof(uint32_t) <= Frame::maxLength, "Planes fit in a frame");
+
+template<typename Sender>
+static void send(Sender& sender, uint32_t code, const Planes& planes, const int* fds)
+{
+    sender.sendMessageWithFds(code, &planes, sizeof(planes), fds, planes.planeCount);
+}
+
+} // namespace DMABuf
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_dmabuf_h
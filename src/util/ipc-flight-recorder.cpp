@@ -0,0 +1,167 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-flight-recorder.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace IPC {
+
+std::atomic<bool> FlightRecorder::s_enabled { false };
+
+static FlightRecorder::Entry s_entries[FlightRecorder::capacity];
+static std::atomic<uint64_t> s_next { 0 };
+static std::atomic<uint32_t> s_nextChannel { 1 };
+static char s_dumpPath[256];
+
+static uint64_t monotonicTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static bool writeAll(int fd, const void* data, size_t length)
+{
+    auto* bytes = static_cast<const char*>(data);
+    while (length) {
+        ssize_t written = write(fd, bytes, length);
+        if (written == -1 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return false;
+        bytes += written;
+        length -= written;
+    }
+    return true;
+}
+
+void FlightRecorder::initialize()
+{
+    static bool initialized = enable();
+    (void)initialized;
+}
+
+bool FlightRecorder::enable()
+{
+    const char* value = std::getenv("WPE_IPC_FLIGHT_RECORDER");
+    if (value && !std::strtoul(value, nullptr, 10))
+        return false;
+
+    const char* path = std::getenv("WPE_IPC_FLIGHT_RECORDER_PATH");
+    if (path)
+        snprintf(s_dumpPath, sizeof(s_dumpPath), "%s", path);
+    else
+        snprintf(s_dumpPath, sizeof(s_dumpPath), "/tmp/wpe-ipc-%d.flight", getpid());
+
+    struct sigaction action;
+    if (!sigaction(SIGUSR2, nullptr, &action) && action.sa_handler == SIG_DFL && !(action.sa_flags & SA_SIGINFO)) {
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = signalHandler;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR2, &action, nullptr);
+    }
+
+    s_enabled.store(true, std::memory_order_relaxed);
+    return true;
+}
+
+uint32_t FlightRecorder::registerChannel()
+{
+    return s_nextChannel.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FlightRecorder::append(uint32_t channel, Direction direction, const Message& message)
+{
+    uint64_t position = s_next.fetch_add(1, std::memory_order_relaxed);
+    Entry& entry = s_entries[position % capacity];
+
+    __atomic_store_n(&entry.sequence, 0, __ATOMIC_RELAXED);
+    std::atomic_thread_fence(std::memory_order_release);
+    entry.timestamp = monotonicTime();
+    entry.channel = channel;
+    entry.direction = static_cast<uint8_t>(direction);
+    memcpy(&entry.message, &message, Message::size);
+    __atomic_store_n(&entry.sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+bool FlightRecorder::dump(int fd)
+{
+    uint64_t next = s_next.load(std::memory_order_acquire);
+    uint64_t count = next < capacity ? next : capacity;
+
+    FileHeader header;
+    memcpy(header.magic, magic, sizeof(header.magic));
+    header.version = version;
+    header.entrySize = sizeof(Entry);
+    header.entryCount = count;
+    header.pid = getpid();
+    header.dumpTime = monotonicTime();
+    if (!writeAll(fd, &header, sizeof(header)))
+        return false;
+
+    // Entries still being written carry a zero sequence, the decoder skips
+    // them.
+    uint64_t first = next - count;
+    for (uint64_t position = first; position < next;) {
+        size_t index = position % capacity;
+        size_t length = std::min<uint64_t>(capacity - index, next - position);
+        if (!writeAll(fd, &s_entries[index], length * sizeof(Entry)))
+            return false;
+        position += length;
+    }
+    return true;
+}
+
+bool FlightRecorder::dump(const char* path)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+        return false;
+
+    bool result = dump(fd);
+    close(fd);
+    return result;
+}
+
+void FlightRecorder::signalHandler(int)
+{
+    int savedErrno = errno;
+    dump(s_dumpPath);
+    errno = savedErrno;
+}
+
+} // namespace IPC
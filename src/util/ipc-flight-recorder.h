@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_flight_recorder_h
+#define wpe_platform_ipc_flight_recorder_h
+
+#include "ipc.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace IPC {
+
+// Keeps the last messages every channel of the process sent or received in a
+// fixed-size ring, to find out what happened around a hiccup afterwards. The
+// ring is written to a file on SIGUSR2 or through dump(), and
+// ipc-flight-decoder turns it into text.
+//
+// WPE_IPC_FLIGHT_RECORDER=0 turns it off. WPE_IPC_FLIGHT_RECORDER_PATH names
+// the file, /tmp/wpe-ipc-<pid>.flight by default.
+class FlightRecorder {
+public:
+    static const size_t capacity = 4096;
+
+    enum class Direction : uint8_t { Sent, Received };
+
+    struct Entry {
+        // Position in the ring plus one, zero while the entry is written.
+        uint64_t sequence;
+        // CLOCK_MONOTONIC, in nanoseconds.
+        uint64_t timestamp;
+        uint32_t channel;
+        uint8_t direction;
+        uint8_t padding[3];
+        // The first record of a frame.
+        Message message;
+    };
+    static_assert(sizeof(Entry) == 64, "Entry is of correct size");
+
+    struct FileHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t entrySize;
+        uint32_t entryCount;
+        uint32_t pid;
+        uint64_t dumpTime;
+    };
+    static_assert(sizeof(FileHeader) == 32, "FileHeader is of correct size");
+
+    static constexpr const char* magic = "WPEIPCFR";
+    static const uint32_t version = 1;
+
+    // Reads the environment and installs the SIGUSR2 handler, unless the
+    // signal is taken already. Called by every channel, only the first call
+    // does anything.
+    static void initialize();
+    static uint32_t registerChannel();
+
+    static void record(uint32_t channel, Direction direction, const Message& message)
+    {
+        if (s_enabled.load(std::memory_order_relaxed))
+            append(channel, direction, message);
+    }
+
+    // Only uses async-signal-safe calls. The entries are written oldest first.
+    static bool dump(int fd);
+    static bool dump(const char* path);
+
+private:
+    static bool enable();
+    static void append(uint32_t channel, Direction, const Message&);
+    static void signalHandler(int);
+
+    static std::atomic<bool> s_enabled;
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_flight_recorder_h
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-frame-pipeline.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace IPC {
+
+const unsigned FramePipeline::maxDepth;
+
+unsigned FramePipeline::depthFromEnvironment()
+{
+    const char* value = std::getenv("WPE_FRAMES_IN_FLIGHT");
+    if (!value)
+        return 1;
+    return std::min<unsigned long>(std::max<unsigned long>(std::strtoul(value, nullptr, 10), 1), maxDepth);
+}
+
+FramePipeline::FramePipeline()
+    : FramePipeline(depthFromEnvironment())
+{
+}
+
+FramePipeline::FramePipeline(unsigned depth)
+    : m_depth(std::min(std::max(depth, 1u), maxDepth))
+{
+}
+
+bool FramePipeline::commit()
+{
+    if (++m_outstanding < m_depth)
+        return true;
+    ++m_owed;
+    return false;
+}
+
+bool FramePipeline::displayed()
+{
+    if (m_outstanding)
+        --m_outstanding;
+    if (!m_owed)
+        return false;
+    --m_owed;
+    return true;
+}
+
+} // namespace IPC
@@ -0,0 +1,68 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_frame_pipeline_h
+#define wpe_platform_ipc_frame_pipeline_h
+
+namespace IPC {
+
+// Decides when a view backend tells its renderer that a frame completed. Up to
+// depth frames may be committed without having been displayed yet. With the
+// default depth of 1 a frame completes once it was displayed, the strict
+// lockstep. Deeper pipelines complete frames right away while there is room,
+// which lets rendering overlap with display latencies beyond one refresh at
+// the cost of that much more latency.
+class FramePipeline {
+public:
+    static const unsigned maxDepth = 3;
+
+    // WPE_FRAMES_IN_FLIGHT, clamped to 1 to maxDepth.
+    static unsigned depthFromEnvironment();
+
+    FramePipeline();
+    explicit FramePipeline(unsigned depth);
+
+    unsigned depth() const { return m_depth; }
+    // Frames committed but not displayed yet.
+    unsigned outstanding() const { return m_outstanding; }
+
+    // A frame was committed. Returns whether its completion can be sent now,
+    // otherwise it is owed until a frame is displayed.
+    bool commit();
+    // The oldest outstanding frame was displayed. Returns whether an owed
+    // completion has to be sent now.
+    bool displayed();
+
+private:
+    unsigned m_depth;
+    unsigned m_outstanding { 0 };
+    unsigned m_owed { 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_frame_pipeline_h
@@ -0,0 +1,717 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-io-thread.h"
+
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace IPC {
+
+class IOThread::Loop {
+public:
+    static Loop* acquire();
+    void release();
+
+    GMainContext* context() const { return m_context; }
+
+private:
+    Loop();
+    ~Loop();
+
+    static gpointer threadFunction(gpointer);
+
+    static std::mutex s_lock;
+    static Loop* s_loop;
+
+    GMainContext* m_context;
+    GMainLoop* m_mainLoop;
+    GThread* m_thread;
+    unsigned m_refCount { 0 };
+};
+
+std::mutex IOThread::Loop::s_lock;
+IOThread::Loop* IOThread::Loop::s_loop { nullptr };
+
+IOThread::Loop* IOThread::Loop::acquire()
+{
+    std::lock_guard<std::mutex> lock(s_lock);
+    if (!s_loop)
+        s_loop = new Loop;
+    ++s_loop->m_refCount;
+    return s_loop;
+}
+
+void IOThread::Loop::release()
+{
+    std::lock_guard<std::mutex> lock(s_lock);
+    if (--m_refCount)
+        return;
+
+    s_loop = nullptr;
+    delete this;
+}
+
+IOThread::Loop::Loop()
+    : m_context(g_main_context_new())
+    , m_mainLoop(g_main_loop_new(m_context, FALSE))
+{
+    m_thread = g_thread_new("WPE IPC I/O", threadFunction, this);
+}
+
+IOThread::Loop::~Loop()
+{
+    g_main_loop_quit(m_mainLoop);
+    g_thread_join(m_thread);
+
+    g_main_loop_unref(m_mainLoop);
+    g_main_context_unref(m_context);
+}
+
+gpointer IOThread::Loop::threadFunction(gpointer data)
+{
+    auto& loop = *static_cast<Loop*>(data);
+
+    g_main_context_push_thread_default(loop.m_context);
+    g_main_loop_run(loop.m_mainLoop);
+    g_main_context_pop_thread_default(loop.m_context);
+    return nullptr;
+}
+
+// Queued on either side. The data follows the event in the same allocation.
+// Descriptors belong to the event until they are handed on.
+class IOThread::Event {
+public:
+    enum class Kind : uint8_t { Message, Messages, MessageWithFds, Fd, Frame, Rpc, Closed, Features };
+
+    static Event* create(Kind, const void* data, size_t size);
+    static void destroy(Event*);
+
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+
+    std::atomic<Event*> next { nullptr };
+    Kind kind { Kind::Message };
+    Delivery delivery { Delivery::Always };
+    Lane lane { Lane::Control };
+    uint32_t code { 0 };
+    size_t size { 0 };
+    int fds[Frame::maxFds];
+    size_t fdCount { 0 };
+};
+
+IOThread::Event* IOThread::Event::create(Kind kind, const void* data, size_t size)
+{
+    auto* event = new (malloc(sizeof(Event) + size)) Event;
+    event->kind = kind;
+    event->size = size;
+    if (data && size)
+        memcpy(event->data(), data, size);
+    return event;
+}
+
+void IOThread::Event::destroy(Event* event)
+{
+    for (size_t i = 0; i < event->fdCount; ++i)
+        close(event->fds[i]);
+
+    event->~Event();
+    free(event);
+}
+
+// Intrusive multiple-producer single-consumer queue. A producer links its
+// event with one exchange and wakes the consumer through the eventfd, unless
+// a wakeup is already pending.
+class IOThread::EventQueue {
+public:
+    EventQueue();
+    ~EventQueue();
+
+    int fd() const { return m_fd; }
+
+    // Any thread.
+    void push(Event*);
+
+    // The consumer's thread only. Clears the wakeup, then whatever was pushed
+    // before can be popped. Returns nullptr while a push is half way done,
+    // that producer wakes the consumer again.
+    void acknowledge();
+    Event* pop();
+
+private:
+    void link(Event*);
+
+    std::atomic<Event*> m_head;
+    Event* m_tail;
+    Event m_stub;
+
+    int m_fd;
+    std::atomic<bool> m_signalled { false };
+};
+
+IOThread::EventQueue::EventQueue()
+    : m_head(&m_stub)
+    , m_tail(&m_stub)
+    , m_fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+    if (m_fd == -1)
+        fprintf(stderr, "IPC::IOThread: failed to create the wakeup eventfd\n");
+}
+
+IOThread::EventQueue::~EventQueue()
+{
+    while (Event* event = pop())
+        Event::destroy(event);
+
+    if (m_fd != -1)
+        close(m_fd);
+}
+
+void IOThread::EventQueue::link(Event* event)
+{
+    event->next.store(nullptr, std::memory_order_relaxed);
+    Event* previous = m_head.exchange(event, std::memory_order_acq_rel);
+    previous->next.store(event, std::memory_order_release);
+}
+
+void IOThread::EventQueue::push(Event* event)
+{
+    link(event);
+
+    if (m_signalled.exchange(true))
+        return;
+
+    uint64_t value = 1;
+    if (write(m_fd, &value, sizeof(value)) != sizeof(value))
+        fprintf(stderr, "IPC::IOThread: failed to write to the wakeup eventfd\n");
+}
+
+void IOThread::EventQueue::acknowledge()
+{
+    uint64_t value;
+    if (read(m_fd, &value, sizeof(value)) == -1 && errno != EAGAIN)
+        fprintf(stderr, "IPC::IOThread: failed to read from the wakeup eventfd\n");
+    m_signalled.store(false);
+}
+
+IOThread::Event* IOThread::EventQueue::pop()
+{
+    Event* tail = m_tail;
+    Event* next = tail->next.load(std::memory_order_acquire);
+    if (tail == &m_stub) {
+        if (!next)
+            return nullptr;
+        m_tail = next;
+        tail = next;
+        next = next->next.load(std::memory_order_acquire);
+    }
+
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+
+    if (tail != m_head.load(std::memory_order_acquire))
+        return nullptr;
+
+    // The last event can only go once the stub took its place.
+    link(&m_stub);
+    next = tail->next.load(std::memory_order_acquire);
+    if (next) {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+class IOThread::WakeupSource {
+public:
+    static GSourceFuncs sourceFuncs;
+    static GSource* create(IOThread&, EventQueue&, bool incoming, gint priority, GMainContext*);
+
+    GSource source;
+    GPollFD pfd;
+    IOThread* thread;
+    bool incoming;
+};
+
+GSourceFuncs IOThread::WakeupSource::sourceFuncs = {
+    // prepare
+    [](GSource*, gint* timeout) -> gboolean
+    {
+        *timeout = -1;
+        return FALSE;
+    },
+    // check
+    [](GSource* base) -> gboolean
+    {
+        auto& source = *reinterpret_cast<WakeupSource*>(base);
+        return !!source.pfd.revents;
+    },
+    // dispatch
+    [](GSource* base, GSourceFunc, gpointer) -> gboolean
+    {
+        auto& source = *reinterpret_cast<WakeupSource*>(base);
+
+        if (source.pfd.revents & (G_IO_ERR | G_IO_HUP))
+            return FALSE;
+
+        source.pfd.revents = 0;
+        if (source.incoming)
+            source.thread->dispatchIncoming();
+        else
+            source.thread->dispatchOutgoing();
+        return TRUE;
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+GSource* IOThread::WakeupSource::create(IOThread& thread, EventQueue& queue, bool incoming, gint priority, GMainContext* context)
+{
+    GSource* base = g_source_new(&sourceFuncs, sizeof(WakeupSource));
+    auto& source = *reinterpret_cast<WakeupSource*>(base);
+    source.thread = &thread;
+    source.incoming = incoming;
+
+    source.pfd.fd = queue.fd();
+    source.pfd.events = G_IO_IN | G_IO_ERR | G_IO_HUP;
+    source.pfd.revents = 0;
+    g_source_add_poll(base, &source.pfd);
+
+    g_source_set_name(base, incoming ? "[WPE] IPC I/O thread incoming" : "[WPE] IPC I/O thread outgoing");
+    g_source_set_priority(base, priority);
+    g_source_set_can_recurse(base, TRUE);
+    g_source_attach(base, context);
+    return base;
+}
+
+const Channel::Receiver IOThread::s_channelReceiver = {
+    // message
+    [](void* data, char* buffer, size_t size)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        if (thread.isInline(*reinterpret_cast<uint32_t*>(buffer))) {
+            thread.m_inlineMessage(thread.m_receiverData, buffer, size);
+            return;
+        }
+        thread.postIncoming(Event::create(Event::Kind::Message, buffer, size));
+    },
+    // messages
+    [](void* data, Message* messages, size_t count)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        if (!thread.m_inlineCodeCount.load(std::memory_order_acquire)) {
+            thread.postIncoming(Event::create(Event::Kind::Messages, messages, count * Message::size));
+            return;
+        }
+
+        // The inline ones go first, the rest keeps its order.
+        auto* event = Event::create(Event::Kind::Messages, nullptr, count * Message::size);
+        auto* queued = reinterpret_cast<Message*>(event->data());
+        size_t queuedCount = 0;
+        for (size_t i = 0; i < count; ++i) {
+            if (thread.isInline(messages[i].messageCode))
+                thread.m_inlineMessage(thread.m_receiverData, Message::data(messages[i]), Message::size);
+            else
+                queued[queuedCount++] = messages[i];
+        }
+
+        if (!queuedCount) {
+            Event::destroy(event);
+            return;
+        }
+        event->size = queuedCount * Message::size;
+        thread.postIncoming(event);
+    },
+    // messageWithFds
+    [](void* data, char* buffer, size_t size, int* fds, size_t fdCount)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        auto* event = Event::create(Event::Kind::MessageWithFds, buffer, size);
+        memcpy(event->fds, fds, fdCount * sizeof(int));
+        event->fdCount = fdCount;
+        thread.postIncoming(event);
+    },
+    // fd
+    [](void* data, int fd)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        auto* event = Event::create(Event::Kind::Fd, nullptr, 0);
+        event->fds[0] = fd;
+        event->fdCount = 1;
+        thread.postIncoming(event);
+    },
+    nullptr, // multiplex
+    // closed
+    [](void* data)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        thread.postIncoming(Event::create(Event::Kind::Closed, nullptr, 0));
+    },
+    // rpc
+    [](void* data, char* buffer, size_t size)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        thread.postIncoming(Event::create(Event::Kind::Rpc, buffer, size));
+    },
+    // features
+    [](void* data, uint32_t common)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        // The features travel in place of a message code.
+        auto* event = Event::create(Event::Kind::Features, nullptr, 0);
+        event->code = common;
+        thread.postIncoming(event);
+    },
+};
+
+bool IOThread::enabledFromEnvironment()
+{
+    const char* value = std::getenv("WPE_IPC_IO_THREAD");
+    return value && std::strtoul(value, nullptr, 10);
+}
+
+IOThread::IOThread(const Channel::Receiver& receiver, void* receiverData, void (*inlineMessage)(void*, char*, size_t), gint priority)
+    : m_receiver(receiver)
+    , m_receiverData(receiverData)
+    , m_inlineMessage(inlineMessage)
+    , m_loop(Loop::acquire())
+    , m_priority(priority)
+    , m_incoming(new EventQueue)
+    , m_outgoing(new EventQueue)
+{
+    m_incomingSource = WakeupSource::create(*this, *m_incoming, true, priority, g_main_context_get_thread_default());
+    m_outgoingSource = WakeupSource::create(*this, *m_outgoing, false, priority, m_loop->context());
+}
+
+IOThread::~IOThread()
+{
+    run([](void* data)
+    {
+        auto& thread = *static_cast<IOThread*>(data);
+        g_source_destroy(thread.m_outgoingSource);
+        g_source_unref(thread.m_outgoingSource);
+        thread.m_outgoingSource = nullptr;
+
+        delete thread.m_channel;
+        thread.m_channel = nullptr;
+    }, this);
+
+    delete m_outgoing;
+
+    g_source_destroy(m_incomingSource);
+    g_source_unref(m_incomingSource);
+    delete m_incoming;
+
+    m_loop->release();
+}
+
+bool IOThread::createChannel(Channel::Side side, int fd, gboolean blocking, void (*setUp)(Channel&, void*), void* data)
+{
+    struct Creation {
+        IOThread* thread;
+        Channel::Side side;
+        int fd;
+        gboolean blocking;
+        void (*setUp)(Channel&, void*);
+        void* data;
+        bool created;
+    } creation { this, side, fd, blocking, setUp, data, false };
+
+    run([](void* data)
+    {
+        auto& creation = *static_cast<Creation*>(data);
+        auto& thread = *creation.thread;
+
+        auto* channel = new Channel(creation.side, s_channelReceiver, &thread);
+        channel->configureFromEnvironment();
+        if (!channel->initialize(creation.fd, thread.m_priority, creation.blocking)) {
+            delete channel;
+            return;
+        }
+
+        creation.setUp(*channel, creation.data);
+        thread.m_channel = channel;
+        creation.created = true;
+    }, &creation);
+
+    return creation.created;
+}
+
+void IOThread::addInlineCode(uint32_t code)
+{
+    size_t count = m_inlineCodeCount.load(std::memory_order_relaxed);
+    if (count == maxInlineCodes) {
+        fprintf(stderr, "IPC::IOThread: too many inline message codes\n");
+        return;
+    }
+
+    m_inlineCodes[count] = code;
+    m_inlineCodeCount.store(count + 1, std::memory_order_release);
+}
+
+void IOThread::setMergeFunction(MergeFunction mergeFunction)
+{
+    struct Update {
+        IOThread* thread;
+        MergeFunction mergeFunction;
+    } update { this, mergeFunction };
+
+    run([](void* data)
+    {
+        auto& update = *static_cast<Update*>(data);
+        if (update.thread->m_channel)
+            update.thread->m_channel->setMergeFunction(update.mergeFunction);
+    }, &update);
+}
+
+bool IOThread::isInline(uint32_t code) const
+{
+    size_t count = m_inlineCodeCount.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; ++i) {
+        if (m_inlineCodes[i] == code)
+            return true;
+    }
+    return false;
+}
+
+void IOThread::sendMessage(const char* data, size_t size, Delivery delivery, Lane lane)
+{
+    auto* event = Event::create(Event::Kind::Message, data, size);
+    event->delivery = delivery;
+    event->lane = lane;
+    postOutgoing(event);
+}
+
+void IOThread::sendFrame(uint32_t code, const void* payload, size_t length, const int* fds, size_t fdCount, Lane lane)
+{
+    if (fdCount > Frame::maxFds) {
+        fprintf(stderr, "IPC::IOThread: too many descriptors for one message, dropping it\n");
+        return;
+    }
+
+    auto* event = Event::create(Event::Kind::Frame, payload, length);
+    event->code = code;
+    event->lane = lane;
+    for (size_t i = 0; i < fdCount; ++i) {
+        int fd = dup(fds[i]);
+        if (fd == -1) {
+            fprintf(stderr, "IPC::IOThread: failed to duplicate a descriptor, dropping the message\n");
+            Event::destroy(event);
+            return;
+        }
+        event->fds[event->fdCount++] = fd;
+    }
+    postOutgoing(event);
+}
+
+void IOThread::sendFd(int fd)
+{
+    auto* event = Event::create(Event::Kind::Fd, nullptr, 0);
+    event->fds[0] = dup(fd);
+    if (event->fds[0] == -1) {
+        fprintf(stderr, "IPC::IOThread: failed to duplicate a descriptor\n");
+        Event::destroy(event);
+        return;
+    }
+    event->fdCount = 1;
+    postOutgoing(event);
+}
+
+SendStatistics IOThread::sendStatistics() const
+{
+    struct Query {
+        const IOThread* thread;
+        SendStatistics statistics;
+    } query { this, { 0, 0, 0, 0 } };
+
+    run([](void* data)
+    {
+        auto& query = *static_cast<Query*>(data);
+        if (query.thread->m_channel)
+            query.statistics = query.thread->m_channel->sendStatistics();
+    }, &query);
+    return query.statistics;
+}
+
+LaneStatistics IOThread::laneStatistics(Lane lane) const
+{
+    struct Query {
+        const IOThread* thread;
+        Lane lane;
+        LaneStatistics statistics;
+    } query { this, lane, { 0, 0, { 0, 0, 0, 0 } } };
+
+    run([](void* data)
+    {
+        auto& query = *static_cast<Query*>(data);
+        if (query.thread->m_channel)
+            query.statistics = query.thread->m_channel->laneStatistics(query.lane);
+    }, &query);
+    return query.statistics;
+}
+
+ReadStatus IOThread::readSynchronously(int timeoutMilliseconds)
+{
+    if (!dispatchIncoming() && !m_closed) {
+        GPollFD pfd = { m_incoming->fd(), G_IO_IN, 0 };
+        if (!g_poll(&pfd, 1, timeoutMilliseconds))
+            return ReadStatus::TimedOut;
+        dispatchIncoming();
+    }
+    return m_closed ? ReadStatus::Closed : ReadStatus::Dispatched;
+}
+
+bool IOThread::hasIncoming() const
+{
+    GPollFD pfd = { m_incoming->fd(), G_IO_IN, 0 };
+    return m_closed || g_poll(&pfd, 1, 0) > 0;
+}
+
+void IOThread::run(void (*function)(void*), void* data) const
+{
+    GMainContext* context = m_loop->context();
+    if (g_main_context_is_owner(context)) {
+        function(data);
+        return;
+    }
+
+    struct Call {
+        void (*function)(void*);
+        void* data;
+        std::mutex lock;
+        std::condition_variable condition;
+        bool done;
+    } call { function, data, { }, { }, false };
+
+    g_main_context_invoke_full(context, G_PRIORITY_HIGH,
+        [](gpointer data) -> gboolean
+        {
+            auto& call = *static_cast<Call*>(data);
+            call.function(call.data);
+
+            std::lock_guard<std::mutex> lock(call.lock);
+            call.done = true;
+            call.condition.notify_one();
+            return G_SOURCE_REMOVE;
+        }, &call, nullptr);
+
+    std::unique_lock<std::mutex> lock(call.lock);
+    call.condition.wait(lock, [&] { return call.done; });
+}
+
+void IOThread::postIncoming(Event* event)
+{
+    m_incoming->push(event);
+}
+
+void IOThread::postOutgoing(Event* event)
+{
+    m_outgoing->push(event);
+}
+
+bool IOThread::dispatchIncoming()
+{
+    m_incoming->acknowledge();
+
+    bool dispatched = false;
+    while (Event* event = m_incoming->pop()) {
+        dispatched = true;
+
+        switch (event->kind) {
+        case Event::Kind::Message:
+            m_receiver.message(m_receiverData, event->data(), event->size);
+            break;
+        case Event::Kind::Messages:
+            m_receiver.messages(m_receiverData, reinterpret_cast<Message*>(event->data()), event->size / Message::size);
+            break;
+        case Event::Kind::MessageWithFds:
+        {
+            size_t fdCount = event->fdCount;
+            event->fdCount = 0;
+            m_receiver.messageWithFds(m_receiverData, event->data(), event->size, event->fds, fdCount);
+            break;
+        }
+        case Event::Kind::Fd:
+            event->fdCount = 0;
+            m_receiver.fd(m_receiverData, event->fds[0]);
+            break;
+        case Event::Kind::Rpc:
+            if (m_receiver.rpc)
+                m_receiver.rpc(m_receiverData, event->data(), event->size);
+            break;
+        case Event::Kind::Closed:
+            m_closed = true;
+            if (m_receiver.closed)
+                m_receiver.closed(m_receiverData);
+            break;
+        case Event::Kind::Features:
+            if (m_receiver.features)
+                m_receiver.features(m_receiverData, event->code);
+            break;
+        case Event::Kind::Frame:
+            break;
+        }
+
+        Event::destroy(event);
+    }
+    return dispatched;
+}
+
+void IOThread::dispatchOutgoing()
+{
+    m_outgoing->acknowledge();
+
+    while (Event* event = m_outgoing->pop()) {
+        if (m_channel) {
+            switch (event->kind) {
+            case Event::Kind::Message:
+                m_channel->sendMessage(event->data(), event->size, event->delivery, event->lane);
+                break;
+            case Event::Kind::Frame:
+                m_channel->sendFrame(event->code, event->data(), event->size, event->fds, event->fdCount, event->lane);
+                break;
+            case Event::Kind::Fd:
+                m_channel->sendFd(event->fds[0]);
+                break;
+            default:
+                break;
+            }
+        }
+        Event::destroy(event);
+    }
+}
+
+} // namespace IPC
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_io_thread_h
+#define wpe_platform_ipc_io_thread_h
+
+#include "ipc-channel.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace IPC {
+
+// Runs the channel of one Host or Client on a thread shared by all of them
+// in the process, so reading the socket does not wait for the main loop.
+// Everything the channel receives is queued and handed to the owner's
+// receiver on the main context it was created on, by a single source. What
+// the owner sends is queued the other way. Both queues are lock-free with a
+// single consumer.
+//
+// Messages with a code registered through addInlineCode() skip the queue and
+// go to the inline function right on the I/O thread. Multiplexed connections
+// stay on the main context.
+class IOThread {
+public:
+    // WPE_IPC_IO_THREAD=1.
+    static bool enabledFromEnvironment();
+
+    IOThread(const Channel::Receiver&, void*, void (*inlineMessage)(void*, char*, size_t), gint priority);
+    ~IOThread();
+
+    // Creates the channel on the I/O thread and waits for it. The setup
+    // function runs there as well, once the channel is initialized.
+    bool createChannel(Channel::Side, int fd, gboolean blocking, void (*setUp)(Channel&, void*), void*);
+    // Safe to call from any thread, see Channel::latencyStatistics().
+    const Channel* channel() const { return m_channel; }
+
+    void addInlineCode(uint32_t);
+    void setMergeFunction(MergeFunction);
+
+    void sendMessage(const char*, size_t, Delivery, Lane);
+    void sendFrame(uint32_t code, const void*, size_t, const int* fds, size_t fdCount, Lane);
+    void sendFd(int);
+    SendStatistics sendStatistics() const;
+    LaneStatistics laneStatistics(Lane) const;
+
+    ReadStatus readSynchronously(int timeoutMilliseconds);
+    // See Channel::hasIncoming(), for what the I/O thread passed on.
+    bool hasIncoming() const;
+
+private:
+    class Loop;
+    class Event;
+    class EventQueue;
+    class WakeupSource;
+
+    static const size_t maxInlineCodes = 8;
+    static const Channel::Receiver s_channelReceiver;
+
+    // Calls the function on the I/O thread and waits for it to return.
+    void run(void (*)(void*), void*) const;
+
+    bool isInline(uint32_t code) const;
+    void postIncoming(Event*);
+    void postOutgoing(Event*);
+    bool dispatchIncoming();
+    void dispatchOutgoing();
+
+    const Channel::Receiver& m_receiver;
+    void* m_receiverData;
+    void (*m_inlineMessage)(void*, char*, size_t);
+
+    Loop* m_loop;
+    Channel* m_channel { nullptr };
+    gint m_priority;
+
+    EventQueue* m_incoming;
+    GSource* m_incomingSource;
+    EventQueue* m_outgoing;
+    GSource* m_outgoingSource { nullptr };
+
+    uint32_t m_inlineCodes[maxInlineCodes];
+    std::atomic<size_t> m_inlineCodeCount { 0 };
+
+    // Set on the owner's side once it dispatched the closure.
+    bool m_closed { false };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_io_thread_h
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-latency.h"
+
+#include <algorithm>
+
+namespace IPC {
+
+void LatencyRecorder::record(uint32_t code, uint64_t nanoseconds)
+{
+    Histogram& histogram = *this->histogram(code);
+    auto& bucket = histogram.buckets[bucketIndex(nanoseconds)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if (nanoseconds > histogram.max.load(std::memory_order_relaxed))
+        histogram.max.store(nanoseconds, std::memory_order_relaxed);
+    histogram.count.store(histogram.count.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+size_t LatencyRecorder::statistics(LatencyStatistics* statistics, size_t capacity) const
+{
+    size_t filled = 0;
+    for (auto& histogram : m_histograms) {
+        if (filled == capacity)
+            break;
+
+        if (!histogram.used.load(std::memory_order_acquire))
+            continue;
+        uint64_t count = histogram.count.load(std::memory_order_acquire);
+        if (!count)
+            continue;
+
+        auto& entry = statistics[filled++];
+        entry.messageCode = histogram.code.load(std::memory_order_relaxed);
+        entry.count = count;
+        entry.p50 = percentile(histogram, count, 0.5);
+        entry.p99 = percentile(histogram, count, 0.99);
+        entry.p999 = percentile(histogram, count, 0.999);
+        entry.max = histogram.max.load(std::memory_order_relaxed);
+    }
+    return filled;
+}
+
+size_t LatencyRecorder::bucketIndex(uint64_t value)
+{
+    if (value < subBucketCount)
+        return value;
+
+    unsigned exponent = std::min<unsigned>(63 - __builtin_clzll(value), maxExponent);
+    if (exponent == maxExponent)
+        value = std::min<uint64_t>(value, (uint64_t(2) << maxExponent) - 1);
+    size_t subBucket = (value >> (exponent - subBucketBits)) & (subBucketCount - 1);
+    return (exponent - subBucketBits + 1) * subBucketCount + subBucket;
+}
+
+// The highest value a bucket holds.
+uint64_t LatencyRecorder::bucketValue(size_t index)
+{
+    if (index < subBucketCount)
+        return index;
+
+    unsigned exponent = index / subBucketCount + subBucketBits - 1;
+    uint64_t subBucket = index % subBucketCount;
+    return ((subBucketCount + subBucket + 1) << (exponent - subBucketBits)) - 1;
+}
+
+uint64_t LatencyRecorder::percentile(const Histogram& histogram, uint64_t count, double fraction)
+{
+    uint64_t target = std::max<uint64_t>(1, static_cast<uint64_t>(fraction * count + 0.5));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < bucketCount; ++i) {
+        seen += histogram.buckets[i].load(std::memory_order_relaxed);
+        if (seen >= target)
+            return bucketValue(i);
+    }
+    return histogram.max.load(std::memory_order_relaxed);
+}
+
+LatencyRecorder::Histogram* LatencyRecorder::histogram(uint32_t code)
+{
+    for (auto& histogram : m_histograms) {
+        if (!histogram.used.load(std::memory_order_relaxed)) {
+            histogram.code.store(code, std::memory_order_relaxed);
+            histogram.used.store(true, std::memory_order_release);
+            return &histogram;
+        }
+        if (histogram.code.load(std::memory_order_relaxed) == code)
+            return &histogram;
+    }
+    return &m_histograms[maxCodes - 1];
+}
+
+} // namespace IPC
@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_latency_h
+#define wpe_platform_ipc_latency_h
+
+#include "ipc.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace IPC {
+
+// Per message code histograms of how long stamped messages took from being
+// sent to being handed to the receiver. Only the receiving thread records,
+// any thread may read at the same time.
+//
+// Buckets are log-linear like an HDR histogram: every power of two is split
+// in subBucketCount equal parts, which bounds the error to 1/subBucketCount
+// from a nanosecond up to half an hour.
+class LatencyRecorder {
+public:
+    static const size_t maxCodes = 32;
+
+    LatencyRecorder() = default;
+
+    void record(uint32_t code, uint64_t nanoseconds);
+    void addLost(uint64_t count) { m_lost.store(m_lost.load(std::memory_order_relaxed) + count, std::memory_order_relaxed); }
+
+    size_t statistics(LatencyStatistics*, size_t capacity) const;
+    uint64_t lost() const { return m_lost.load(std::memory_order_relaxed); }
+
+private:
+    static const unsigned subBucketBits = 3;
+    static const size_t subBucketCount = 1 << subBucketBits;
+    static const unsigned maxExponent = 40;
+    static const size_t bucketCount = (maxExponent - subBucketBits + 2) * subBucketCount;
+
+    struct Histogram {
+        // Set once the code is written.
+        std::atomic<bool> used;
+        std::atomic<uint32_t> code;
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> max;
+        std::atomic<uint64_t> buckets[bucketCount];
+    };
+
+    static size_t bucketIndex(uint64_t);
+    static uint64_t bucketValue(size_t);
+    static uint64_t percentile(const Histogram&, uint64_t count, double fraction);
+
+    Histogram* histogram(uint32_t code);
+
+    // The last one also takes the codes that found no free histogram.
+    Histogram m_histograms[maxCodes] { };
+    std::atomic<uint64_t> m_lost { 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_latency_h
@@ -0,0 +1,154 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-loopback.h"
+
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace IPC {
+
+static void closeFds(const std::vector<Loopback::FdEntry>& entries)
+{
+    for (auto& entry : entries) {
+        for (size_t i = 0; i < entry.count; ++i)
+            ::close(entry.fds[i]);
+    }
+}
+
+Loopback::~Loopback()
+{
+    for (auto& queue : m_queues)
+        closeFds(queue.batch.fds);
+}
+
+void Loopback::ref()
+{
+    m_refCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Loopback::deref()
+{
+    if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        delete this;
+}
+
+void Loopback::setReceiveContext(Direction direction, GMainContext* context)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_queues[direction].context = context;
+}
+
+bool Loopback::push(Direction direction, const char* data, size_t recordCount, const int* fds, size_t fdCount)
+{
+    if (fdCount > Frame::maxFds)
+        return false;
+
+    FdEntry entry;
+    entry.count = 0;
+    for (size_t i = 0; i < fdCount; ++i) {
+        int fd = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+        if (fd == -1) {
+            closeFds({ entry });
+            return false;
+        }
+        entry.fds[entry.count++] = fd;
+    }
+
+    GMainContext* context;
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (isClosed()) {
+            closeFds({ entry });
+            return false;
+        }
+
+        auto& queue = m_queues[direction];
+        auto& records = queue.batch.records;
+        size_t first = records.size();
+        records.resize(first + recordCount);
+        memcpy(Message::data(records[first]), data, recordCount * Message::size);
+
+        if (entry.count) {
+            entry.record = first;
+            queue.batch.fds.push_back(entry);
+        }
+
+        // Only the first record after the queue was drained needs to wake
+        // the receiver up.
+        context = queue.pending.exchange(true, std::memory_order_acq_rel) ? nullptr : queue.context;
+    }
+
+    m_condition.notify_all();
+    if (context)
+        g_main_context_wakeup(context);
+    return true;
+}
+
+void Loopback::take(Direction direction, Batch& batch)
+{
+    batch.records.clear();
+    batch.fds.clear();
+
+    std::lock_guard<std::mutex> lock(m_lock);
+    auto& queue = m_queues[direction];
+    std::swap(queue.batch.records, batch.records);
+    std::swap(queue.batch.fds, batch.fds);
+    queue.pending.store(false, std::memory_order_release);
+}
+
+bool Loopback::wait(Direction direction, int timeoutMilliseconds)
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+    auto ready = [&] { return hasPending(direction) || isClosed(); };
+    if (timeoutMilliseconds < 0) {
+        m_condition.wait(lock, ready);
+        return true;
+    }
+    return m_condition.wait_for(lock, std::chrono::milliseconds(timeoutMilliseconds), ready);
+}
+
+void Loopback::close()
+{
+    GMainContext* contexts[2];
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_closed.store(true, std::memory_order_release);
+        for (size_t i = 0; i < 2; ++i)
+            contexts[i] = m_queues[i].context;
+    }
+
+    m_condition.notify_all();
+    for (auto* context : contexts) {
+        if (context)
+            g_main_context_wakeup(context);
+    }
+}
+
+} // namespace IPC
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_loopback_h
+#define wpe_platform_ipc_loopback_h
+
+#include "ipc.h"
+#include <atomic>
+#include <condition_variable>
+#include <glib.h>
+#include <mutex>
+#include <vector>
+
+namespace IPC {
+
+// Stands in for the socket when host and client live in the same process.
+// Each direction is a queue of records together with the descriptors that
+// belong to them. The receiving main context is woken up when its queue
+// stops being empty. Shared by both channels, hence reference counted.
+class Loopback {
+public:
+    enum Direction {
+        HostToClient = 0,
+        ClientToHost = 1,
+    };
+
+    struct FdEntry {
+        // Index of the first record of the message owning the descriptors.
+        size_t record;
+        int fds[Frame::maxFds];
+        size_t count;
+    };
+
+    struct Batch {
+        std::vector<Message> records;
+        std::vector<FdEntry> fds;
+    };
+
+    static Loopback* create() { return new Loopback; }
+
+    void ref();
+    void deref();
+
+    void setReceiveContext(Direction, GMainContext*);
+
+    // The descriptors are duplicated. Fails once either side went away.
+    bool push(Direction, const char*, size_t recordCount, const int* fds, size_t fdCount);
+
+    bool hasPending(Direction direction) const { return m_queues[direction].pending.load(std::memory_order_acquire); }
+    // Replaces the contents of the batch with everything queued so far.
+    void take(Direction, Batch&);
+    // Blocks until something is queued for the direction or a side went away,
+    // at most for the timeout unless that is negative. False if it ran out.
+    bool wait(Direction, int timeoutMilliseconds = -1);
+
+    void close();
+    bool isClosed() const { return m_closed.load(std::memory_order_acquire); }
+
+private:
+    Loopback() = default;
+    ~Loopback();
+
+    struct Queue {
+        Batch batch;
+        GMainContext* context { nullptr };
+        std::atomic<bool> pending { false };
+    };
+
+    std::atomic<unsigned> m_refCount { 1 };
+    std::atomic<bool> m_closed { false };
+
+    std::mutex m_lock;
+    std::condition_variable m_condition;
+    Queue m_queues[2];
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_loopback_h
@@ -0,0 +1,415 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-multiplex.h"
+
+#include <algorithm>
+#include <cstring>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace IPC {
+
+static Multiplexer* s_hostMultiplexer;
+static std::vector<Multiplexer*> s_clientMultiplexers;
+
+const Channel::Receiver Multiplexer::s_receiver = {
+    // message
+    [](void* data, char* buffer, size_t size)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        if (auto* endpoint = connection.multiplexer->endpoint(connection.incomingEndpoint))
+            endpoint->receiver->message(endpoint->data, buffer, size);
+    },
+    // messages
+    [](void* data, Message* messages, size_t count)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        if (auto* endpoint = connection.multiplexer->endpoint(connection.incomingEndpoint))
+            endpoint->receiver->messages(endpoint->data, messages, count);
+    },
+    // messageWithFds
+    [](void* data, char* buffer, size_t size, int* fds, size_t fdCount)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        if (auto* endpoint = connection.multiplexer->endpoint(connection.incomingEndpoint)) {
+            endpoint->receiver->messageWithFds(endpoint->data, buffer, size, fds, fdCount);
+            return;
+        }
+        for (size_t i = 0; i < fdCount; ++i)
+            close(fds[i]);
+    },
+    // fd
+    [](void* data, int fd)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        if (auto* endpoint = connection.multiplexer->endpoint(connection.incomingEndpoint)) {
+            endpoint->receiver->fd(endpoint->data, fd);
+            return;
+        }
+        close(fd);
+    },
+    // multiplex
+    [](void* data, Message& message)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        connection.multiplexer->handleMultiplexMessage(connection, message);
+    },
+    // closed
+    [](void* data)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        connection.multiplexer->destroyConnection(&connection);
+    },
+    // rpc
+    [](void* data, char* buffer, size_t size)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        auto* endpoint = connection.multiplexer->endpoint(connection.incomingEndpoint);
+        if (endpoint && endpoint->receiver->rpc)
+            endpoint->receiver->rpc(endpoint->data, buffer, size);
+    },
+    // features
+    [](void* data, uint32_t common)
+    {
+        auto& connection = *static_cast<Connection*>(data);
+        connection.multiplexer->notifyFeatures(connection, common);
+    },
+};
+
+Multiplexer* Multiplexer::hostInstance(GMainContext* context)
+{
+    if (!s_hostMultiplexer) {
+        uint64_t id = uint64_t(g_random_int()) << 32 | g_random_int();
+        s_hostMultiplexer = new Multiplexer(Channel::Side::Host, id, context);
+    }
+
+    return s_hostMultiplexer->m_context == context ? s_hostMultiplexer : nullptr;
+}
+
+Multiplexer* Multiplexer::attachClient(int fd, const Channel::Receiver& receiver, void* data, uint32_t& endpoint)
+{
+    // The host wrote the hello before handing out the descriptor, anything
+    // else means an ordinary connection.
+    Message hello;
+    if (recv(fd, Message::data(hello), Message::size, MSG_PEEK | MSG_DONTWAIT) != Message::size
+        || hello.messageCode != Internal::MultiplexHello::code)
+        return nullptr;
+    if (recv(fd, Message::data(hello), Message::size, MSG_DONTWAIT) != Message::size)
+        return nullptr;
+
+    auto& helloData = Internal::MultiplexHello::cast(hello);
+    uint64_t id = helloData.multiplexer();
+
+    auto it = std::find_if(s_clientMultiplexers.begin(), s_clientMultiplexers.end(),
+        [id](Multiplexer* multiplexer) { return multiplexer->m_id == id && !multiplexer->m_connections.empty(); });
+
+    Multiplexer* multiplexer;
+    if (it != s_clientMultiplexers.end()) {
+        multiplexer = *it;
+        close(fd);
+    } else {
+        multiplexer = new Multiplexer(Channel::Side::Client, id, g_main_context_get_thread_default());
+        if (!multiplexer->createConnection(fd)) {
+            delete multiplexer;
+            close(fd);
+            return nullptr;
+        }
+        s_clientMultiplexers.push_back(multiplexer);
+        multiplexer->m_connections.front()->channel->advertiseFeatures(0);
+    }
+
+    endpoint = helloData.endpoint;
+    auto& entry = multiplexer->m_endpoints[endpoint];
+    entry.receiver = &receiver;
+    entry.data = data;
+    entry.connection = multiplexer->m_connections.front();
+
+    Message attach;
+    Internal::ChannelAttach::construct(attach, endpoint);
+    entry.connection->channel->sendRecords(Message::data(attach), 1, nullptr, 0);
+    if (uint32_t common = entry.connection->channel->commonFeatures()) {
+        if (receiver.features)
+            receiver.features(data, common);
+    }
+    return multiplexer;
+}
+
+Multiplexer::Multiplexer(Channel::Side side, uint64_t id, GMainContext* context)
+    : m_side(side)
+    , m_id(id)
+    , m_context(context)
+{
+}
+
+Multiplexer::~Multiplexer()
+{
+    while (!m_connections.empty())
+        destroyConnection(m_connections.back());
+}
+
+uint32_t Multiplexer::addEndpoint(const Channel::Receiver& receiver, void* data)
+{
+    uint32_t id = m_nextEndpoint++;
+    auto& entry = m_endpoints[id];
+    entry.receiver = &receiver;
+    entry.data = data;
+    entry.connection = nullptr;
+    entry.pending.reset(new SendQueue);
+    entry.pending->setLimit(SendQueue::defaultLimit);
+    return id;
+}
+
+void Multiplexer::removeEndpoint(uint32_t id)
+{
+    m_endpoints.erase(id);
+
+    // A client process is connected for as long as one of its views is.
+    if (m_side == Channel::Side::Client && m_endpoints.empty()) {
+        s_clientMultiplexers.erase(std::find(s_clientMultiplexers.begin(), s_clientMultiplexers.end(), this));
+        delete this;
+    }
+}
+
+int Multiplexer::createClientFd(uint32_t endpoint)
+{
+    int sockets[2];
+    if (!Channel::createSocketPair(sockets))
+        return -1;
+
+    Connection* connection = createConnection(sockets[0]);
+    if (!connection) {
+        close(sockets[0]);
+        close(sockets[1]);
+        return -1;
+    }
+
+    Message hello;
+    Internal::MultiplexHello::construct(hello, m_id, endpoint);
+    connection->channel->sendRecords(Message::data(hello), 1, nullptr, 0);
+    // Only after the hello, which the client has to find first.
+    connection->channel->advertiseFeatures(0);
+    connection->channel->offerSharedRingFromEnvironment();
+    return sockets[1];
+}
+
+void Multiplexer::sendMessage(uint32_t id, const char* data, size_t size, Delivery delivery)
+{
+    if (size != Message::size) {
+        if (size >= sizeof(uint32_t))
+            sendFrame(id, *reinterpret_cast<const uint32_t*>(data), data + sizeof(uint32_t), size - sizeof(uint32_t), nullptr, 0);
+        return;
+    }
+
+    Endpoint* entry = endpoint(id);
+    if (!entry)
+        return;
+
+    if (!entry->connection) {
+        if (entry->pending)
+            entry->pending->append(data, 1, nullptr, 0, delivery, false);
+        return;
+    }
+
+    Channel& channel = *entry->connection->channel;
+    if (channel.selectEndpoint(id))
+        channel.sendMessage(data, size, delivery);
+}
+
+void Multiplexer::sendFrame(uint32_t id, uint32_t code, const void* payload, size_t length, const int* fds, size_t fdCount)
+{
+    Message records[Frame::maxRecordCount];
+    size_t recordCount = Channel::encodeFrame(code, payload, length, fdCount, records);
+    if (recordCount)
+        sendRecords(id, Message::data(records[0]), recordCount, fds, fdCount);
+}
+
+void Multiplexer::sendFd(uint32_t id, int fd)
+{
+    Message message;
+    Internal::FdTransfer::construct(message);
+    sendRecords(id, Message::data(message), 1, &fd, 1);
+}
+
+SendStatistics Multiplexer::sendStatistics(uint32_t id) const
+{
+    const Endpoint* entry = endpoint(id);
+    if (entry && entry->connection)
+        return entry->connection->channel->sendStatistics();
+    if (entry && entry->pending)
+        return entry->pending->statistics();
+    return SendStatistics { 0, 0, 0, 0 };
+}
+
+ReadStatus Multiplexer::readSynchronously(uint32_t id, int timeoutMilliseconds)
+{
+    Endpoint* entry = endpoint(id);
+    if (!entry || !entry->connection)
+        return ReadStatus::Closed;
+    return entry->connection->channel->readSynchronously(timeoutMilliseconds);
+}
+
+bool Multiplexer::hasIncoming(uint32_t id) const
+{
+    const Channel* connectionChannel = channel(id);
+    return !connectionChannel || connectionChannel->hasIncoming();
+}
+
+const Channel* Multiplexer::channel(uint32_t id) const
+{
+    const Endpoint* entry = endpoint(id);
+    return entry && entry->connection ? entry->connection->channel : nullptr;
+}
+
+Multiplexer::Connection* Multiplexer::createConnection(int fd)
+{
+    auto* connection = new Connection { this, nullptr, 0 };
+    connection->channel = new Channel(m_side, s_receiver, connection);
+    connection->channel->configureFromEnvironment();
+
+    bool isHost = m_side == Channel::Side::Host;
+    if (!connection->channel->initialize(fd, isHost ? G_PRIORITY_DEFAULT : G_PRIORITY_HIGH + 30, isHost)) {
+        delete connection->channel;
+        delete connection;
+        return nullptr;
+    }
+
+    m_connections.push_back(connection);
+    return connection;
+}
+
+// Endpoints served by the connection keep what is sent to them from now on,
+// in case their client attaches again.
+void Multiplexer::destroyConnection(Connection* connection)
+{
+    std::vector<std::pair<const Channel::Receiver*, void*>> closed;
+    for (auto& it : m_endpoints) {
+        if (it.second.connection != connection)
+            continue;
+        it.second.connection = nullptr;
+        if (it.second.receiver->closed)
+            closed.emplace_back(it.second.receiver, it.second.data);
+    }
+
+    m_connections.erase(std::find(m_connections.begin(), m_connections.end(), connection));
+    delete connection->channel;
+    delete connection;
+
+    // Last, a receiver may well remove its endpoint in there.
+    for (auto& it : closed)
+        it.first->closed(it.second);
+}
+
+Multiplexer::Endpoint* Multiplexer::endpoint(uint32_t id)
+{
+    auto it = m_endpoints.find(id);
+    return it != m_endpoints.end() ? &it->second : nullptr;
+}
+
+const Multiplexer::Endpoint* Multiplexer::endpoint(uint32_t id) const
+{
+    auto it = m_endpoints.find(id);
+    return it != m_endpoints.end() ? &it->second : nullptr;
+}
+
+void Multiplexer::sendRecords(uint32_t id, const char* data, size_t recordCount, const int* fds, size_t fdCount)
+{
+    Endpoint* entry = endpoint(id);
+    if (!entry)
+        return;
+
+    if (!entry->connection) {
+        uint32_t code = *reinterpret_cast<const uint32_t*>(data);
+        if (entry->pending)
+            entry->pending->append(data, recordCount, fds, fdCount, Delivery::Always, !Frame::isFrame(code) && Internal::isInternal(code));
+        return;
+    }
+
+    Channel& channel = *entry->connection->channel;
+    if (channel.selectEndpoint(id))
+        channel.sendRecords(data, recordCount, fds, fdCount);
+}
+
+void Multiplexer::handleMultiplexMessage(Connection& connection, Message& message)
+{
+    switch (message.messageCode) {
+    case Internal::ChannelSelect::code:
+        connection.incomingEndpoint = Internal::ChannelSelect::cast(message).endpoint;
+        break;
+    case Internal::ChannelAttach::code:
+        if (m_side == Channel::Side::Host)
+            attach(connection, Internal::ChannelAttach::cast(message).endpoint);
+        break;
+    default:
+        break;
+    }
+}
+
+// Endpoints that attach later are told from attach() or attachClient().
+void Multiplexer::notifyFeatures(Connection& connection, uint32_t common)
+{
+    std::vector<std::pair<const Channel::Receiver*, void*>> attached;
+    for (auto& it : m_endpoints) {
+        if (it.second.connection == &connection && it.second.receiver->features)
+            attached.emplace_back(it.second.receiver, it.second.data);
+    }
+
+    for (auto& it : attached)
+        it.first->features(it.second, common);
+}
+
+void Multiplexer::attach(Connection& connection, uint32_t id)
+{
+    Endpoint* entry = endpoint(id);
+    if (!entry)
+        return;
+
+    entry->connection = &connection;
+    if (uint32_t common = connection.channel->commonFeatures()) {
+        if (entry->receiver->features)
+            entry->receiver->features(entry->data, common);
+    }
+    if (!entry->pending)
+        return;
+
+    // What was kept for the endpoint goes out first, in order.
+    auto& pending = *entry->pending;
+    Message records[Frame::maxRecordCount];
+    while (!pending.isEmpty()) {
+        size_t recordCount = pending.messageRecordCount(0);
+        for (size_t i = 0; i < recordCount; ++i)
+            memcpy(Message::data(records[i]), pending.record(i), Message::size);
+
+        const int* fds = nullptr;
+        size_t fdCount = pending.fds(0, &fds);
+        if (connection.channel->selectEndpoint(id))
+            connection.channel->sendRecords(Message::data(records[0]), recordCount, fds, fdCount);
+        pending.consume(recordCount * Message::size);
+    }
+}
+
+} // namespace IPC
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_multiplex_h
+#define wpe_platform_ipc_multiplex_h
+
+#include "ipc-channel.h"
+#include "ipc-send-queue.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace IPC {
+
+// Serves the Host or Client objects of many views over one connection per
+// pair of processes. Every view is an endpoint with an id of its own, and a
+// ChannelSelect record goes out whenever consecutive messages are for
+// different endpoints.
+//
+// On the host side releaseClientFD() hands out a new connection that starts
+// with a MultiplexHello naming the multiplexer and the endpoint. A client
+// process already connected to that multiplexer closes it and attaches the
+// endpoint to its existing connection. Until the client attached, the host
+// keeps what it sends to the endpoint.
+class Multiplexer {
+public:
+    // Only hosts running on the same main context share a multiplexer.
+    static Multiplexer* hostInstance(GMainContext*);
+    // Returns nullptr, leaving the descriptor alone, unless it leads to a
+    // multiplexer. Takes it over otherwise.
+    static Multiplexer* attachClient(int fd, const Channel::Receiver&, void*, uint32_t& endpoint);
+
+    uint32_t addEndpoint(const Channel::Receiver&, void*);
+    void removeEndpoint(uint32_t);
+    int createClientFd(uint32_t endpoint);
+
+    void sendMessage(uint32_t endpoint, const char*, size_t, Delivery);
+    void sendFrame(uint32_t endpoint, uint32_t code, const void*, size_t, const int* fds, size_t fdCount);
+    void sendFd(uint32_t endpoint, int);
+    SendStatistics sendStatistics(uint32_t endpoint) const;
+    ReadStatus readSynchronously(uint32_t endpoint, int timeoutMilliseconds);
+    // See Channel::hasIncoming(). Counts what arrived for any endpoint of
+    // the connection.
+    bool hasIncoming(uint32_t endpoint) const;
+
+    // The connection the endpoint is attached to, if any.
+    const Channel* channel(uint32_t endpoint) const;
+
+private:
+    struct Connection {
+        Multiplexer* multiplexer;
+        Channel* channel;
+        uint32_t incomingEndpoint;
+    };
+
+    struct Endpoint {
+        const Channel::Receiver* receiver;
+        void* data;
+        Connection* connection;
+        std::unique_ptr<SendQueue> pending;
+    };
+
+    static const Channel::Receiver s_receiver;
+
+    Multiplexer(Channel::Side, uint64_t id, GMainContext*);
+    ~Multiplexer();
+
+    Connection* createConnection(int fd);
+    void destroyConnection(Connection*);
+    Endpoint* endpoint(uint32_t);
+    const Endpoint* endpoint(uint32_t) const;
+
+    void sendRecords(uint32_t endpoint, const char*, size_t recordCount, const int* fds, size_t fdCount);
+    void handleMultiplexMessage(Connection&, Message&);
+    void attach(Connection&, uint32_t endpoint);
+    void notifyFeatures(Connection&, uint32_t common);
+
+    Channel::Side m_side;
+    uint64_t m_id;
+    GMainContext* m_context;
+
+    uint32_t m_nextEndpoint { 1 };
+    std::unordered_map<uint32_t, Endpoint> m_endpoints;
+    std::vector<Connection*> m_connections;
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_multiplex_h
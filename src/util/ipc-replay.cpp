@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-replay.h"
+
+#include "ipc-capture.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace IPC {
+
+static uint64_t monotonicTime()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+static uint32_t messageCode(const char* data)
+{
+    uint32_t code;
+    memcpy(&code, data, sizeof(code));
+    return code;
+}
+
+Replay* Replay::load(const char* path, uint32_t channel)
+{
+    FILE* file = fopen(path, "rbe");
+    if (!file) {
+        fprintf(stderr, "IPC::Replay: unable to open %s\n", path);
+        return nullptr;
+    }
+
+    Capture::FileHeader fileHeader;
+    if (fread(&fileHeader, sizeof(fileHeader), 1, file) != 1 || memcmp(fileHeader.magic, Capture::magic, sizeof(fileHeader.magic))
+        || fileHeader.version != Capture::version) {
+        fprintf(stderr, "IPC::Replay: %s is not a capture\n", path);
+        fclose(file);
+        return nullptr;
+    }
+
+    auto* replay = new Replay;
+    replay->m_channel = channel;
+
+    // A capture cut short by a crash ends with a partial record, which is
+    // left out.
+    Capture::RecordHeader header;
+    std::vector<char> data;
+    while (fread(&header, sizeof(header), 1, file) == 1) {
+        data.resize(header.size);
+        if (header.size && fread(data.data(), header.size, 1, file) != 1)
+            break;
+
+        if (!header.hostSide || header.kind > static_cast<uint8_t>(Capture::Kind::Fd))
+            continue;
+        if (!replay->m_channel)
+            replay->m_channel = header.channel;
+        if (header.channel != replay->m_channel)
+            continue;
+
+        replay->m_records.push_back({ header.timestamp, header.kind, header.fdCount, replay->m_data.size(), header.size });
+        replay->m_data.insert(replay->m_data.end(), data.begin(), data.end());
+    }
+    fclose(file);
+    return replay;
+}
+
+Replay::Result Replay::run(Host::Handler& handler, double speed)
+{
+    static const size_t flatOutIterationInterval = 64;
+
+    Result result { 0, 0, { } };
+    auto statistics = [&result](uint32_t code) -> CodeStatistics& {
+        for (auto& entry : result.codes) {
+            if (entry.messageCode == code)
+                return entry;
+        }
+        result.codes.push_back({ code, 0, 0, 0 });
+        return result.codes.back();
+    };
+    auto account = [&statistics](uint32_t code, uint64_t time) {
+        auto& entry = statistics(code);
+        ++entry.count;
+        entry.total += time;
+        entry.max = std::max(entry.max, time);
+    };
+
+    GMainContext* context = g_main_context_get_thread_default();
+    std::vector<char> buffer;
+    uint64_t start = monotonicTime();
+
+    for (size_t i = 0; i < m_records.size(); ++i) {
+        auto& record = m_records[i];
+
+        if (speed > 0) {
+            uint64_t target = start + static_cast<uint64_t>((record.timestamp - m_records[0].timestamp) / speed);
+            for (uint64_t now = monotonicTime(); now < target; now = monotonicTime()) {
+                if (!g_main_context_iteration(context, FALSE))
+                    usleep(std::min<uint64_t>(target - now, 1000000) / 1000);
+            }
+        } else if (!(i % flatOutIterationInterval))
+            while (g_main_context_iteration(context, FALSE)) { }
+
+        // Handlers may write to what they are given.
+        buffer.assign(m_data.begin() + record.offset, m_data.begin() + record.offset + record.size);
+        int fds[Frame::maxFds];
+        size_t fdCount = std::min<size_t>(record.fdCount, size_t(Frame::maxFds));
+        for (size_t j = 0; j < fdCount; ++j)
+            fds[j] = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+        uint64_t before = monotonicTime();
+        switch (static_cast<Capture::Kind>(record.kind)) {
+        case Capture::Kind::Messages:
+        {
+            size_t count = record.size / Message::size;
+            if (!count)
+                break;
+            handler.handleMessages(reinterpret_cast<Message*>(buffer.data()), count);
+
+            // The batch is split evenly among the messages in it.
+            uint64_t time = (monotonicTime() - before) / count;
+            for (size_t j = 0; j < count; ++j)
+                account(messageCode(m_data.data() + record.offset + j * Message::size), time);
+            result.messages += count;
+            continue;
+        }
+        case Capture::Kind::Message:
+            if (record.size < sizeof(uint32_t))
+                break;
+            handler.handleMessage(buffer.data(), buffer.size());
+            account(messageCode(m_data.data() + record.offset), monotonicTime() - before);
+            break;
+        case Capture::Kind::MessageWithFds:
+            if (record.size < sizeof(uint32_t))
+                break;
+            handler.handleMessageWithFds(buffer.data(), buffer.size(), fds, fdCount);
+            account(messageCode(m_data.data() + record.offset), monotonicTime() - before);
+            fdCount = 0;
+            break;
+        case Capture::Kind::Fd:
+            if (!fdCount)
+                break;
+            handler.handleFd(fds[0]);
+            account(0, monotonicTime() - before);
+            fdCount = 0;
+            break;
+        }
+        ++result.messages;
+
+        for (size_t j = 0; j < fdCount; ++j)
+            close(fds[j]);
+    }
+
+    while (g_main_context_iteration(context, FALSE)) { }
+    result.seconds = (monotonicTime() - start) / 1e9;
+    std::sort(result.codes.begin(), result.codes.end(),
+        [](const CodeStatistics& a, const CodeStatistics& b) { return a.messageCode < b.messageCode; });
+    return result;
+}
+
+} // namespace IPC
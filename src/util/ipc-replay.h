@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_replay_h
+#define wpe_platform_ipc_replay_h
+
+#include "ipc.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace IPC {
+
+// Feeds what a capture (see IPC::Capture) recorded on the host side of a
+// channel to a Host::Handler again, typically a view backend, without a
+// renderer on the other end. Descriptors are replaced with /dev/null.
+class Replay {
+public:
+    struct CodeStatistics {
+        uint32_t messageCode;
+        uint64_t count;
+        // Time spent in the handler, in nanoseconds.
+        uint64_t total;
+        uint64_t max;
+    };
+
+    struct Result {
+        uint64_t messages;
+        double seconds;
+        std::vector<CodeStatistics> codes;
+    };
+
+    // Picks the first host-side channel of the capture, or the given one.
+    // Returns nullptr if the file cannot be read.
+    static Replay* load(const char* path, uint32_t channel = 0);
+
+    size_t messageCount() const { return m_records.size(); }
+    uint32_t channel() const { return m_channel; }
+
+    // With a speed of 1 the captured pauses between messages are kept, 2
+    // halves them and 0 leaves them out. The thread default main context is
+    // iterated while waiting, and every few messages when running flat out.
+    Result run(Host::Handler&, double speed);
+
+private:
+    struct Record {
+        uint64_t timestamp;
+        uint8_t kind;
+        uint8_t fdCount;
+        size_t offset;
+        size_t size;
+    };
+
+    Replay() = default;
+
+    std::vector<Record> m_records;
+    std::vector<char> m_data;
+    uint32_t m_channel { 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_replay_h
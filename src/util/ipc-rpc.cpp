@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-rpc.h"
+
+#include "ipc-channel.h"
+#include <cstdio>
+#include <cstring>
+
+namespace IPC {
+
+Rpc::Rpc(SendFunction send, RequestFunction request, void* data)
+    : m_send(send)
+    , m_request(request)
+    , m_data(data)
+    , m_context(g_main_context_get_thread_default())
+{
+}
+
+Rpc::~Rpc()
+{
+    closeAll();
+}
+
+RequestId Rpc::sendRequest(uint32_t code, const void* payload, size_t length, unsigned timeoutMilliseconds, ResponseCallback callback, void* callbackData)
+{
+    if (length > Internal::RpcRequest::maxPayload) {
+        fprintf(stderr, "IPC::Rpc: request of %zu bytes is too large\n", length);
+        return 0;
+    }
+
+    RequestId id = m_nextId++;
+    if (!m_nextId)
+        m_nextId = 1;
+
+    auto& pending = m_pending[id];
+    pending = { this, id, callback, callbackData, nullptr };
+    if (timeoutMilliseconds) {
+        pending.timeoutSource = g_timeout_source_new(timeoutMilliseconds);
+        g_source_set_callback(pending.timeoutSource, timeoutCallback, &pending, nullptr);
+        g_source_attach(pending.timeoutSource, m_context);
+    }
+
+    char buffer[Frame::maxLength];
+    Internal::RpcRequest header { id, code };
+    memcpy(buffer, &header, sizeof(header));
+    if (length)
+        memcpy(buffer + sizeof(header), payload, length);
+    m_send(m_data, Internal::RpcRequest::code, buffer, sizeof(header) + length);
+    return id;
+}
+
+bool Rpc::cancelRequest(RequestId id)
+{
+    if (!m_pending.count(id))
+        return false;
+
+    complete(id, RequestStatus::Cancelled, nullptr, 0);
+    return true;
+}
+
+void Rpc::respond(RequestId id, const void* payload, size_t length)
+{
+    if (length > Internal::RpcResponse::maxPayload) {
+        fprintf(stderr, "IPC::Rpc: response of %zu bytes is too large\n", length);
+        return;
+    }
+
+    char buffer[Frame::maxLength];
+    Internal::RpcResponse header { id };
+    memcpy(buffer, &header, sizeof(header));
+    if (length)
+        memcpy(buffer + sizeof(header), payload, length);
+    m_send(m_data, Internal::RpcResponse::code, buffer, sizeof(header) + length);
+}
+
+void Rpc::handleFrame(char* data, size_t size)
+{
+    uint32_t code = *reinterpret_cast<uint32_t*>(data);
+    char* payload = Frame::payload(data);
+    size_t length = Frame::payloadSize(size);
+
+    switch (code) {
+    case Internal::RpcRequest::code:
+    {
+        if (length < sizeof(Internal::RpcRequest))
+            break;
+        Internal::RpcRequest header;
+        memcpy(&header, payload, sizeof(header));
+        if (m_request)
+            m_request(m_data, header.id, header.messageCode, payload + sizeof(header), length - sizeof(header));
+        break;
+    }
+    case Internal::RpcResponse::code:
+    {
+        if (length < sizeof(Internal::RpcResponse))
+            break;
+        Internal::RpcResponse header;
+        memcpy(&header, payload, sizeof(header));
+        // Late answers to requests that timed out or were cancelled.
+        if (!m_pending.count(header.id))
+            break;
+        complete(header.id, RequestStatus::Answered, payload + sizeof(header), length - sizeof(header));
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void Rpc::closeAll()
+{
+    while (!m_pending.empty())
+        complete(m_pending.begin()->first, RequestStatus::Closed, nullptr, 0);
+}
+
+gboolean Rpc::timeoutCallback(gpointer data)
+{
+    auto& pending = *static_cast<Pending*>(data);
+    pending.rpc->complete(pending.id, RequestStatus::TimedOut, nullptr, 0);
+    return G_SOURCE_REMOVE;
+}
+
+// The entry is gone before the callback runs, which may well send the next
+// request or cancel others.
+void Rpc::complete(RequestId id, RequestStatus status, char* payload, size_t length)
+{
+    auto it = m_pending.find(id);
+    Pending pending = it->second;
+    m_pending.erase(it);
+
+    if (pending.timeoutSource) {
+        g_source_destroy(pending.timeoutSource);
+        g_source_unref(pending.timeoutSource);
+    }
+
+    if (pending.callback)
+        pending.callback(pending.callbackData, status, payload, length);
+}
+
+} // namespace IPC
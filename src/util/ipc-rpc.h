@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_rpc_h
+#define wpe_platform_ipc_rpc_h
+
+#include "ipc.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+
+namespace IPC {
+
+// Requests and responses of one Host or Client. Both travel as internal
+// frames: a request carries its id and message code ahead of the payload, a
+// response only the id. Callbacks run on the main context the owner was
+// initialized on, either from the channel's dispatch or from the timeout.
+class Rpc {
+public:
+    // Sends an internal frame through the owner.
+    using SendFunction = void (*)(void*, uint32_t code, const void* payload, size_t length);
+    // Called for every incoming request, the owner answers with respond().
+    // Without one, requests are ignored.
+    using RequestFunction = void (*)(void*, RequestId, uint32_t code, char* payload, size_t length);
+
+    Rpc(SendFunction, RequestFunction, void*);
+    ~Rpc();
+
+    RequestId sendRequest(uint32_t code, const void* payload, size_t length, unsigned timeoutMilliseconds, ResponseCallback, void* callbackData);
+    bool cancelRequest(RequestId);
+    bool isPending(RequestId id) const { return m_pending.count(id); }
+    void respond(RequestId, const void* payload, size_t length);
+
+    // An internal frame of the channel, starting at its code.
+    void handleFrame(char* data, size_t size);
+    // Ends every pending request with RequestStatus::Closed.
+    void closeAll();
+
+private:
+    struct Pending {
+        Rpc* rpc;
+        RequestId id;
+        ResponseCallback callback;
+        void* callbackData;
+        GSource* timeoutSource;
+    };
+
+    static gboolean timeoutCallback(gpointer);
+    void complete(RequestId, RequestStatus, char* payload, size_t length);
+
+    SendFunction m_send;
+    RequestFunction m_request;
+    void* m_data;
+    GMainContext* m_context;
+
+    RequestId m_nextId { 1 };
+    std::unordered_map<RequestId, Pending> m_pending;
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_rpc_h
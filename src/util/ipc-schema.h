@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_schema_h
+#define wpe_platform_ipc_schema_h
+
+#include "ipc.h"
+#include <cstring>
+#include <stddef.h>
+#include <stdint.h>
+#include <type_traits>
+#include <utility>
+
+namespace IPC {
+
+namespace Schema {
+
+// A fixed-size message, its fields following the code in Message::messageData.
+// Fields is a plain struct of 32-bit wide or smaller members, whatever part of
+// the message data it leaves is sent as zeroes:
+//
+//     struct BufferCommitFields {
+//         uint32_t width;
+//         uint32_t height;
+//     };
+//     using BufferCommit = Schema::MessageType<3, BufferCommitFields>;
+template<uint32_t messageCode, typename Fields>
+struct MessageType : Fields {
+    static const uint32_t code = messageCode;
+
+    static_assert(messageCode && messageCode < 0x10000, "message codes are small and not zero");
+    static_assert(sizeof(Fields) <= Message::dataSize, "fields fit in a message");
+    static_assert(alignof(Fields) <= alignof(uint32_t), "fields need no stricter alignment than the message data");
+    static_assert(std::is_trivially_copyable<Fields>::value, "fields can be sent as they are");
+
+    // Takes the fields in the order they are declared.
+    template<typename... Arguments>
+    static void construct(Message& message, Arguments&&... arguments)
+    {
+        Fields fields { std::forward<Arguments>(arguments)... };
+        message.messageCode = code;
+        std::memcpy(message.messageData, &fields, sizeof(Fields));
+        std::memset(message.messageData + sizeof(Fields), 0, Message::dataSize - sizeof(Fields));
+    }
+
+    // Points right into the message, nothing is copied.
+    static const MessageType& cast(const Message& message)
+    {
+        return *reinterpret_cast<const MessageType*>(message.messageData);
+    }
+    static MessageType& cast(Message& message)
+    {
+        return *reinterpret_cast<MessageType*>(message.messageData);
+    }
+};
+
+template<uint32_t messageCode, typename Fields>
+const uint32_t MessageType<messageCode, Fields>::code;
+
+struct NoFields { };
+
+// Hands messages of one type to a member function of the target.
+template<typename Type, typename Target, void (Target::*function)(const Type&)>
+struct Handler {
+    using MessageType = Type;
+
+    static void call(Target& target, const Message& message)
+    {
+        (target.*function)(Type::cast(message));
+    }
+};
+
+// Table of handlers indexed by message code, built at compile time:
+//
+//     using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+//         IPC::Schema::Handler<BufferCommit, ViewBackend, &ViewBackend::handleBufferCommit>>;
+//     if (Dispatcher::dispatch(*this, data, size))
+//         return;
+//
+// Messages nobody handles, and frames, are left to the caller.
+template<typename Target, typename... Handlers>
+class Dispatcher {
+public:
+    static bool dispatch(Target& target, const char* data, size_t size)
+    {
+        static constexpr Table s_table = createTable();
+
+        if (size != Message::size)
+            return false;
+
+        auto& message = *reinterpret_cast<const Message*>(data);
+        if (message.messageCode >= tableSize || !s_table.functions[message.messageCode])
+            return false;
+
+        s_table.functions[message.messageCode](target, message);
+        return true;
+    }
+
+private:
+    using Function = void (*)(Target&, const Message&);
+
+    static constexpr uint32_t maxCode()
+    {
+        uint32_t codes[] = { Handlers::MessageType::code... };
+        uint32_t max = 0;
+        for (uint32_t code : codes)
+            max = code > max ? code : max;
+        return max;
+    }
+
+    static constexpr bool codesAreDistinct()
+    {
+        uint32_t codes[] = { Handlers::MessageType::code... };
+        for (size_t i = 0; i < sizeof...(Handlers); ++i) {
+            for (size_t j = i + 1; j < sizeof...(Handlers); ++j) {
+                if (codes[i] == codes[j])
+                    return false;
+            }
+        }
+        return true;
+    }
+
+    static const uint32_t tableSize = maxCode() + 1;
+    static_assert(sizeof...(Handlers), "there is something to dispatch");
+    static_assert(codesAreDistinct(), "every code has a single handler");
+    static_assert(tableSize <= 256, "message codes are dense enough for a table");
+
+    struct Table {
+        Function functions[tableSize];
+    };
+
+    static constexpr Table createTable()
+    {
+        Table table { };
+        uint32_t codes[] = { Handlers::MessageType::code... };
+        Function functions[] = { &Handlers::call... };
+        for (size_t i = 0; i < sizeof...(Handlers); ++i)
+            table.functions[codes[i]] = functions[i];
+        return table;
+    }
+};
+
+template<typename Target, typename... Handlers>
+const uint32_t Dispatcher<Target, Handlers...>::tableSize;
+
+} // namespace Schema
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_schema_h
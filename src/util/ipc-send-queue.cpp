@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-send-queue.h"
+
+#include "ipc.h"
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace IPC {
+
+SendQueue::~SendQueue()
+{
+    while (m_fdEntryCount)
+        popFdEntry();
+
+    delete[] m_records;
+    delete[] m_flags;
+}
+
+void SendQueue::setLimit(size_t records)
+{
+    delete[] m_records;
+    delete[] m_flags;
+
+    m_limit = records;
+    m_capacity = records + reservedRecords;
+    m_records = new char[m_capacity * Message::size];
+    m_flags = new uint8_t[m_capacity];
+    m_head = m_tail = m_last = m_inFlightEnd = 0;
+    m_offset = 0;
+}
+
+SendQueue::Result SendQueue::append(const char* data, size_t recordCount, const int* fds, size_t fdCount, Delivery delivery, bool internal)
+{
+    uint8_t foldFlag = 0;
+    if (delivery == Delivery::Supersedable)
+        foldFlag = Supersedable;
+    else if (delivery == Delivery::Mergeable && m_mergeFunction)
+        foldFlag = Mergeable;
+
+    if (foldFlag && recordCount == 1 && !fdCount && m_last >= m_head && m_last >= m_inFlightEnd && m_tail - m_last == 1
+        && !(m_last == m_head && m_offset)) {
+        size_t lastSlot = slot(m_last);
+        char* last = m_records + lastSlot * Message::size;
+        if ((m_flags[lastSlot] & foldFlag) && !memcmp(last, data, sizeof(uint32_t))) {
+            bool merged = true;
+            if (foldFlag == Supersedable)
+                memcpy(last, data, Message::size);
+            else
+                merged = m_mergeFunction(Message::cast(last), *reinterpret_cast<const Message*>(data));
+            if (merged) {
+                ++m_statistics.merged;
+                return Result::Merged;
+            }
+        }
+    }
+
+    size_t limit = internal ? m_capacity : m_limit;
+    if (size() + recordCount > limit || fdCount > maxFds || (fdCount && m_fdEntryCount == maxFdEntries)) {
+        ++m_statistics.dropped;
+        return Result::Dropped;
+    }
+
+    if (fdCount) {
+        auto& entry = m_fdEntries[m_fdEntryCount];
+        entry.sequence = m_tail;
+        entry.count = 0;
+        for (size_t i = 0; i < fdCount; ++i) {
+            int fd = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+            if (fd == -1) {
+                for (size_t j = 0; j < entry.count; ++j)
+                    close(entry.fds[j]);
+                ++m_statistics.dropped;
+                return Result::Dropped;
+            }
+            entry.fds[entry.count++] = fd;
+        }
+        ++m_fdEntryCount;
+    }
+
+    for (size_t i = 0; i < recordCount; ++i) {
+        size_t index = slot(m_tail + i);
+        memcpy(m_records + index * Message::size, data + i * Message::size, Message::size);
+        m_flags[index] = 0;
+    }
+    m_flags[slot(m_tail)] = MessageStart | foldFlag | (fdCount ? HasFds : 0);
+
+    m_last = m_tail;
+    m_tail += recordCount;
+    return Result::Appended;
+}
+
+void SendQueue::markLastWaiting()
+{
+    if (m_last < m_head || m_last < m_inFlightEnd || m_last == m_tail)
+        return;
+
+    uint8_t& flags = m_flags[slot(m_last)];
+    if (flags & Waiting)
+        return;
+
+    flags |= Waiting;
+    ++m_statistics.queued;
+}
+
+char* SendQueue::record(size_t index) const
+{
+    return m_records + slot(m_head + index) * Message::size;
+}
+
+bool SendQueue::isMessageStart(size_t index) const
+{
+    return m_flags[slot(m_head + index)] & MessageStart;
+}
+
+size_t SendQueue::messageRecordCount(size_t index) const
+{
+    size_t end = index + 1;
+    while (end < size() && !isMessageStart(end))
+        ++end;
+    return end - index;
+}
+
+size_t SendQueue::fds(size_t index, const int** fds) const
+{
+    if (!(m_flags[slot(m_head + index)] & HasFds))
+        return 0;
+
+    for (size_t i = 0; i < m_fdEntryCount; ++i) {
+        if (m_fdEntries[i].sequence == m_head + index) {
+            *fds = m_fdEntries[i].fds;
+            return m_fdEntries[i].count;
+        }
+    }
+    return 0;
+}
+
+void SendQueue::consume(size_t bytes)
+{
+    while (bytes && !isEmpty()) {
+        uint8_t flags = m_flags[slot(m_head)];
+        if (flags & MessageStart && !m_offset) {
+            // Descriptors travel with the first byte of their message.
+            if (flags & HasFds)
+                popFdEntry();
+            m_consumedFlags = flags;
+        }
+
+        size_t length = std::min(bytes, Message::size - m_offset);
+        m_offset += length;
+        bytes -= length;
+        if (m_offset < Message::size)
+            break;
+
+        m_offset = 0;
+        ++m_head;
+        if ((isEmpty() || isMessageStart(0)) && (m_consumedFlags & Waiting))
+            ++m_statistics.flushed;
+    }
+}
+
+void SendQueue::releaseHeadFds()
+{
+    uint8_t& flags = m_flags[slot(m_head)];
+    if (!(flags & HasFds))
+        return;
+
+    popFdEntry();
+    flags &= ~HasFds;
+}
+
+void SendQueue::popFdEntry()
+{
+    for (size_t i = 0; i < m_fdEntries[0].count; ++i)
+        close(m_fdEntries[0].fds[i]);
+
+    std::move(m_fdEntries + 1, m_fdEntries + m_fdEntryCount, m_fdEntries);
+    --m_fdEntryCount;
+}
+
+} // namespace IPC
@@ -0,0 +1,125 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_send_queue_h
+#define wpe_platform_ipc_send_queue_h
+
+#include "ipc.h"
+#include <stddef.h>
+#include <stdint.h>
+
+namespace IPC {
+
+// Bounded FIFO of outgoing Message records that could not be written yet. A
+// message is one record, or several for a frame. Descriptors attached to a
+// message are duplicated and closed once its first byte left.
+class SendQueue {
+public:
+    enum class Result { Appended, Merged, Dropped };
+
+    static const size_t defaultLimit = 512;
+    static const size_t maxFds = Frame::maxFds;
+
+    SendQueue() = default;
+    ~SendQueue();
+
+    // Room beyond the limit is kept for the channel's own messages.
+    void setLimit(size_t records);
+    void setMergeFunction(MergeFunction mergeFunction) { m_mergeFunction = mergeFunction; }
+
+    bool isEmpty() const { return m_head == m_tail; }
+    size_t size() const { return m_tail - m_head; }
+
+    // A supersedable message replaces the last queued one if that has the
+    // same code, was supersedable as well and has not started going out.
+    // Mergeable ones are combined with it the same way, provided there is a
+    // merge function.
+    Result append(const char* data, size_t recordCount, const int* fds, size_t fdCount, Delivery, bool internal);
+
+    // The message appended last is still waiting, count it as queued.
+    void markLastWaiting();
+
+    // The first records were handed to the kernel and must not change until
+    // they are consumed.
+    void markInFlight(size_t records) { m_inFlightEnd = m_head + records; }
+
+    // Records are addressed relative to the head. offset() is the number of
+    // bytes of the head record that were already written.
+    char* record(size_t index) const;
+    size_t offset() const { return m_offset; }
+    bool isMessageStart(size_t index) const;
+    size_t messageRecordCount(size_t index) const;
+    size_t fds(size_t index, const int** fds) const;
+
+    void consume(size_t bytes);
+    // The head message's descriptors were sent separately.
+    void releaseHeadFds();
+
+    const SendStatistics& statistics() const { return m_statistics; }
+
+private:
+    enum : uint8_t {
+        MessageStart = 1 << 0,
+        Supersedable = 1 << 1,
+        Waiting = 1 << 2,
+        HasFds = 1 << 3,
+        Mergeable = 1 << 4,
+    };
+
+    struct FdEntry {
+        uint64_t sequence;
+        int fds[maxFds];
+        size_t count;
+    };
+    static const size_t maxFdEntries = 8;
+    static const size_t reservedRecords = 16;
+
+    size_t slot(uint64_t sequence) const { return sequence % m_capacity; }
+    void popFdEntry();
+
+    char* m_records { nullptr };
+    uint8_t* m_flags { nullptr };
+    size_t m_capacity { 0 };
+    size_t m_limit { 0 };
+    MergeFunction m_mergeFunction { nullptr };
+
+    uint64_t m_head { 0 };
+    uint64_t m_tail { 0 };
+    size_t m_offset { 0 };
+    uint64_t m_last { 0 };
+    uint64_t m_inFlightEnd { 0 };
+    uint8_t m_consumedFlags { 0 };
+
+    FdEntry m_fdEntries[maxFdEntries];
+    size_t m_fdEntryCount { 0 };
+
+    SendStatistics m_statistics { 0, 0, 0, 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_send_queue_h
@@ -0,0 +1,271 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-shm.h"
+
+#include "ipc.h"
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <new>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_ALLOW_SEALING
+#define MFD_ALLOW_SEALING 0x0002U
+#endif
+#ifndef F_ADD_SEALS
+#define F_ADD_SEALS (1024 + 9)
+#define F_SEAL_SEAL 0x0001
+#define F_SEAL_SHRINK 0x0002
+#define F_SEAL_GROW 0x0004
+#define F_SEAL_WRITE 0x0008
+#endif
+
+namespace IPC {
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "shared ring indices have to be lock-free");
+
+static const uint32_t s_ringMagic = 0x52455057; // "WPER"
+static const uint32_t s_ringVersion = 1;
+
+struct RingIndices {
+    alignas(64) std::atomic<uint32_t> tail;
+    alignas(64) std::atomic<uint32_t> head;
+    alignas(64) std::atomic<uint32_t> consumerSleeping;
+};
+
+struct RingHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;
+    uint32_t recordSize;
+    RingIndices indices[2];
+};
+
+static size_t layoutSize(uint32_t capacity)
+{
+    return sizeof(RingHeader) + 2 * size_t(capacity) * Message::size;
+}
+
+static RingHeader& header(void* memory)
+{
+    return *static_cast<RingHeader*>(memory);
+}
+
+static char* slot(void* memory, uint32_t capacity, SharedRing::Direction direction, uint32_t index)
+{
+    char* slots = static_cast<char*>(memory) + sizeof(RingHeader);
+    return slots + (size_t(direction) * capacity + (index & (capacity - 1))) * Message::size;
+}
+
+int SharedRing::createMemoryFd(const char* name, size_t size)
+{
+#ifdef SYS_memfd_create
+    int fd = syscall(SYS_memfd_create, name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#else
+    int fd = -1;
+    errno = ENOSYS;
+#endif
+    if (fd == -1) {
+        fprintf(stderr, "IPC::SharedRing: memfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (ftruncate(fd, size) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    // The size is fixed from now on, so the peer can trust what it maps.
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW);
+    return fd;
+}
+
+SharedRing* SharedRing::create(uint32_t capacity)
+{
+    if (!capacity || (capacity & (capacity - 1)))
+        return nullptr;
+
+    std::unique_ptr<SharedRing> ring(new SharedRing);
+    ring->m_capacity = capacity;
+
+    size_t size = layoutSize(capacity);
+    ring->m_fds[0] = createMemoryFd("wpe-ipc-ring", size);
+    if (ring->m_fds[0] == -1)
+        return nullptr;
+
+    for (size_t i = 1; i < transferFdCount; ++i) {
+        ring->m_fds[i] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (ring->m_fds[i] == -1)
+            return nullptr;
+    }
+
+    if (!ring->map(size))
+        return nullptr;
+
+    auto& ringHeader = *new (ring->m_memory) RingHeader;
+    ringHeader.magic = s_ringMagic;
+    ringHeader.version = s_ringVersion;
+    ringHeader.capacity = capacity;
+    ringHeader.recordSize = Message::size;
+    for (auto& indices : ringHeader.indices) {
+        indices.tail.store(0);
+        indices.head.store(0);
+        indices.consumerSleeping.store(1);
+    }
+
+    return ring.release();
+}
+
+SharedRing* SharedRing::adopt(const int* fds, size_t fdCount)
+{
+    std::unique_ptr<SharedRing> ring(new SharedRing);
+    for (size_t i = 0; i < fdCount; ++i) {
+        if (i < transferFdCount)
+            ring->m_fds[i] = fds[i];
+        else
+            close(fds[i]);
+    }
+    if (fdCount != transferFdCount)
+        return nullptr;
+
+    struct stat memoryStat;
+    if (fstat(ring->m_fds[0], &memoryStat) == -1 || size_t(memoryStat.st_size) < sizeof(RingHeader))
+        return nullptr;
+    if (!ring->map(memoryStat.st_size))
+        return nullptr;
+
+    auto& ringHeader = header(ring->m_memory);
+    uint32_t capacity = ringHeader.capacity;
+    if (ringHeader.magic != s_ringMagic || ringHeader.version != s_ringVersion || ringHeader.recordSize != Message::size
+        || !capacity || (capacity & (capacity - 1)) || layoutSize(capacity) > ring->m_memorySize) {
+        fprintf(stderr, "IPC::SharedRing: incompatible ring layout\n");
+        return nullptr;
+    }
+    ring->m_capacity = capacity;
+
+    // The mapping keeps the memory alive, the descriptor is of no further use.
+    close(ring->m_fds[0]);
+    ring->m_fds[0] = -1;
+
+    return ring.release();
+}
+
+SharedRing::~SharedRing()
+{
+    if (m_memory)
+        munmap(m_memory, m_memorySize);
+
+    for (int fd : m_fds) {
+        if (fd != -1)
+            close(fd);
+    }
+}
+
+bool SharedRing::map(size_t size)
+{
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fds[0], 0);
+    if (memory == MAP_FAILED)
+        return false;
+
+    m_memory = memory;
+    m_memorySize = size;
+    return true;
+}
+
+bool SharedRing::push(Direction direction, const char* data, size_t count)
+{
+    auto& indices = header(m_memory).indices[direction];
+
+    uint32_t tail = indices.tail.load(std::memory_order_relaxed);
+    uint32_t head = indices.head.load(std::memory_order_acquire);
+    if (tail - head + count > m_capacity)
+        return false;
+
+    for (size_t i = 0; i < count; ++i)
+        std::memcpy(slot(m_memory, m_capacity, direction, tail + i), data + i * Message::size, Message::size);
+    indices.tail.store(tail + count, std::memory_order_seq_cst);
+
+    // Only ring the doorbell when the consumer announced it is going idle,
+    // a busy consumer picks the record up on its own.
+    if (indices.consumerSleeping.load(std::memory_order_seq_cst) && indices.consumerSleeping.exchange(0)) {
+        uint64_t value = 1;
+        if (write(doorbellFd(direction), &value, sizeof(value)) != sizeof(value))
+            fprintf(stderr, "IPC::SharedRing: failed to ring the doorbell\n");
+    }
+    return true;
+}
+
+bool SharedRing::pop(Direction direction, char* data)
+{
+    auto& indices = header(m_memory).indices[direction];
+
+    uint32_t head = indices.head.load(std::memory_order_relaxed);
+    uint32_t tail = indices.tail.load(std::memory_order_acquire);
+    if (head == tail || tail - head > m_capacity)
+        return false;
+
+    std::memcpy(data, slot(m_memory, m_capacity, direction, head), Message::size);
+    indices.head.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+bool SharedRing::isEmpty(Direction direction) const
+{
+    auto& indices = header(m_memory).indices[direction];
+    return indices.tail.load(std::memory_order_acquire) == indices.head.load(std::memory_order_relaxed);
+}
+
+bool SharedRing::prepareToSleep(Direction direction)
+{
+    auto& indices = header(m_memory).indices[direction];
+
+    indices.consumerSleeping.store(1, std::memory_order_seq_cst);
+    if (indices.tail.load(std::memory_order_seq_cst) == indices.head.load(std::memory_order_relaxed))
+        return true;
+
+    indices.consumerSleeping.store(0, std::memory_order_relaxed);
+    return false;
+}
+
+void SharedRing::clearDoorbell(Direction direction)
+{
+    uint64_t value;
+    while (read(doorbellFd(direction), &value, sizeof(value)) == sizeof(value)) { }
+}
+
+} // namespace IPC
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_shm_h
+#define wpe_platform_ipc_shm_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace IPC {
+
+// Two single-producer/single-consumer rings of Message records living in a
+// memfd shared between the host and the client process. Each direction has
+// its own eventfd doorbell, which is only rung when the consumer went idle.
+class SharedRing {
+public:
+    enum Direction {
+        HostToClient = 0,
+        ClientToHost = 1,
+    };
+
+    static const uint32_t defaultCapacity = 1024;
+    static const size_t transferFdCount = 3;
+
+    static SharedRing* create(uint32_t capacity);
+    static SharedRing* adopt(const int* fds, size_t fdCount);
+    ~SharedRing();
+
+    // memfd, host->client doorbell, client->host doorbell, in that order.
+    const int* transferFds() const { return m_fds; }
+    uint32_t capacity() const { return m_capacity; }
+
+    int doorbellFd(Direction direction) const { return m_fds[1 + direction]; }
+
+    // Publishes count consecutive records at once, or none if they do not fit.
+    bool push(Direction, const char*, size_t count = 1);
+    bool pop(Direction, char*);
+    // Whether the consumer would find anything, without taking it.
+    bool isEmpty(Direction) const;
+
+    // Called by the consumer once the ring looks empty. Returns false if new
+    // records were published in the meantime and draining has to continue.
+    bool prepareToSleep(Direction);
+    void clearDoorbell(Direction);
+
+    static int createMemoryFd(const char* name, size_t size);
+
+private:
+    SharedRing() = default;
+
+    bool map(size_t);
+
+    int m_fds[transferFdCount] { -1, -1, -1 };
+    uint32_t m_capacity { 0 };
+
+    void* m_memory { nullptr };
+    size_t m_memorySize { 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_shm_h
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_touch_h
+#define wpe_platform_ipc_touch_h
+
+#include "ipc.h"
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+#include <wpe/wpe.h>
+
+namespace IPC {
+
+namespace Touch {
+
+static const size_t maxTouchpoints = 10;
+
+// A touch event is sent as a frame: this header followed by the touch points.
+struct Header {
+    uint32_t type;
+    int32_t id;
+    uint32_t time;
+    uint32_t modifiers;
+    uint32_t touchpointsLength;
+};
+
+struct Payload {
+    Header header;
+    wpe_input_touch_event_raw touchpoints[maxTouchpoints];
+};
+static_assert(sizeof(Payload) + sizeof(uint32_t) <= Frame::maxLength, "touch event must fit in a frame");
+
+// Touch points past maxTouchpoints are dropped.
+template<typename Sender>
+static void send(Sender& sender, uint32_t code, const wpe_input_touch_event& event)
+{
+    Payload payload;
+    size_t length = std::min<size_t>(event.touchpoints_length, maxTouchpoints);
+    payload.header = { static_cast<uint32_t>(event.type), event.id, event.time, event.modifiers, static_cast<uint32_t>(length) };
+    memcpy(payload.touchpoints, event.touchpoints, length * sizeof(wpe_input_touch_event_raw));
+    sender.sendFrame(code, &payload, sizeof(Header) + length * sizeof(wpe_input_touch_event_raw), Lane::Bulk);
+}
+
+// Points event at the touch points inside payload.
+inline bool decode(char* payload, size_t size, wpe_input_touch_event& event)
+{
+    if (size < sizeof(Header))
+        return false;
+
+    auto& header = *reinterpret_cast<Header*>(payload);
+    if (header.touchpointsLength > maxTouchpoints || size < sizeof(Header) + header.touchpointsLength * sizeof(wpe_input_touch_event_raw))
+        return false;
+
+    event = { reinterpret_cast<wpe_input_touch_event_raw*>(payload + sizeof(Header)), header.touchpointsLength,
+        static_cast<wpe_input_touch_event_type>(header.type), header.id, header.time, header.modifiers };
+    return true;
+}
+
+} // namespace Touch
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_touch_h
@@ -0,0 +1,401 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ipc-uring.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <linux/io_uring.h>
+#include <memory>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace IPC {
+
+static const uint64_t s_receiveTag = 1;
+static const uint64_t s_sendTag = 2;
+static const unsigned s_queueEntries = 128;
+static_assert(s_queueEntries > Uring::maxSendVectors, "a whole batch of packets fits in the submission queue");
+static_assert(!(Uring::bufferCount & (Uring::bufferCount - 1)), "the buffer ring size is a power of two");
+
+static int uringSetup(unsigned entries, struct io_uring_params* params)
+{
+#ifdef __NR_io_uring_setup
+    return syscall(__NR_io_uring_setup, entries, params);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned flags)
+{
+#ifdef __NR_io_uring_enter
+    return syscall(__NR_io_uring_enter, fd, toSubmit, 0, flags, nullptr, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int uringRegister(int fd, unsigned opcode, void* argument, unsigned count)
+{
+#ifdef __NR_io_uring_register
+    return syscall(__NR_io_uring_register, fd, opcode, argument, count);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+Uring* Uring::create(int socketFd)
+{
+    std::unique_ptr<Uring> uring(new Uring);
+    uring->m_socketFd = socketFd;
+    if (!uring->setup())
+        return nullptr;
+
+    uring->m_receiveActive = true;
+    uring->submit();
+    return uring.release();
+}
+
+Uring::~Uring()
+{
+    // Closing the instance cancels whatever is still in flight.
+    if (m_fd != -1)
+        close(m_fd);
+    if (m_eventFd != -1)
+        close(m_eventFd);
+
+    if (m_sqes)
+        munmap(m_sqes, m_sqesSize);
+    if (m_cqRing && m_cqRing != m_sqRing)
+        munmap(m_cqRing, m_cqRingSize);
+    if (m_sqRing)
+        munmap(m_sqRing, m_sqRingSize);
+    if (m_bufferRing)
+        munmap(m_bufferRing, bufferCount * sizeof(struct io_uring_buf));
+    if (m_buffers)
+        munmap(m_buffers, bufferCount * bufferSize);
+}
+
+bool Uring::setup()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CLAMP;
+
+    m_fd = uringSetup(s_queueEntries, &params);
+    if (m_fd == -1) {
+        fprintf(stderr, "IPC::Uring: io_uring is not available: %s\n", strerror(errno));
+        return false;
+    }
+
+    static const unsigned probeOps = 256;
+    alignas(struct io_uring_probe) char probeData[sizeof(struct io_uring_probe) + probeOps * sizeof(struct io_uring_probe_op)] = { };
+    auto& probe = *reinterpret_cast<struct io_uring_probe*>(probeData);
+    if (uringRegister(m_fd, IORING_REGISTER_PROBE, &probe, probeOps) == -1
+        || probe.ops_len <= IORING_OP_RECVMSG || probe.ops_len <= IORING_OP_SENDMSG
+        || !(probe.ops[IORING_OP_RECVMSG].flags & IO_URING_OP_SUPPORTED)
+        || !(probe.ops[IORING_OP_SENDMSG].flags & IO_URING_OP_SUPPORTED)) {
+        fprintf(stderr, "IPC::Uring: the kernel does not support socket messages through io_uring\n");
+        return false;
+    }
+
+    m_sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        m_sqRingSize = m_cqRingSize = std::max(m_sqRingSize, m_cqRingSize);
+
+    void* sqRing = mmap(nullptr, m_sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING);
+    if (sqRing == MAP_FAILED)
+        return false;
+    m_sqRing = sqRing;
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        m_cqRing = m_sqRing;
+    else {
+        void* cqRing = mmap(nullptr, m_cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_CQ_RING);
+        if (cqRing == MAP_FAILED)
+            return false;
+        m_cqRing = cqRing;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+        return false;
+    m_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(m_sqRing);
+    m_sqHead = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    m_sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    m_sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    m_sqEntries = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    m_sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    m_sqLocalTail = m_sqSubmitted = *m_sqTail;
+
+    char* cq = static_cast<char*>(m_cqRing);
+    m_cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    m_cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+
+    m_eventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (m_eventFd == -1 || uringRegister(m_fd, IORING_REGISTER_EVENTFD, &m_eventFd, 1) == -1)
+        return false;
+
+    if (!setupBufferRing()) {
+        fprintf(stderr, "IPC::Uring: provided buffer rings are not supported: %s\n", strerror(errno));
+        return false;
+    }
+
+    // Room for the ancillary data in front of every received payload.
+    m_receiveHeader.msg_controllen = CMSG_SPACE(sizeof(int) * maxFds);
+    return true;
+}
+
+bool Uring::setupBufferRing()
+{
+    void* ring = mmap(nullptr, bufferCount * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED)
+        return false;
+    m_bufferRing = static_cast<struct io_uring_buf_ring*>(ring);
+
+    void* buffers = mmap(nullptr, bufferCount * bufferSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED)
+        return false;
+    m_buffers = static_cast<char*>(buffers);
+
+    struct io_uring_buf_reg registration;
+    memset(&registration, 0, sizeof(registration));
+    registration.ring_addr = reinterpret_cast<uintptr_t>(m_bufferRing);
+    registration.ring_entries = bufferCount;
+    registration.bgid = 0;
+    if (uringRegister(m_fd, IORING_REGISTER_PBUF_RING, &registration, 1) == -1)
+        return false;
+
+    for (size_t i = 0; i < bufferCount; ++i)
+        releaseBuffer(i);
+    return true;
+}
+
+struct io_uring_sqe* Uring::nextSqe()
+{
+    if (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE) >= m_sqEntries)
+        return nullptr;
+
+    unsigned index = m_sqLocalTail & m_sqMask;
+    struct io_uring_sqe* sqe = &m_sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    m_sqArray[index] = index;
+    ++m_sqLocalTail;
+    return sqe;
+}
+
+bool Uring::armReceive()
+{
+    struct io_uring_sqe* sqe = nextSqe();
+    if (!sqe)
+        return false;
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = m_socketFd;
+    sqe->addr = reinterpret_cast<uintptr_t>(&m_receiveHeader);
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->msg_flags = MSG_CMSG_CLOEXEC;
+    sqe->user_data = s_receiveTag;
+
+    m_receiveArmed = true;
+    return true;
+}
+
+bool Uring::queueSend(const struct iovec* vectors, size_t count, const int* fds, size_t fdCount, bool packetPerVector)
+{
+    count = std::min(count, maxSendVectors);
+    size_t sqeCount = packetPerVector ? count : 1;
+    if (m_sendOutstanding || !count || fdCount > maxFds
+        || m_sqEntries - (m_sqLocalTail - __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE)) < sqeCount)
+        return false;
+
+    std::copy(vectors, vectors + count, m_sendVectors);
+
+    for (size_t i = 0; i < sqeCount; ++i) {
+        struct msghdr& header = m_sendHeaders[i];
+        memset(&header, 0, sizeof(header));
+        header.msg_iov = &m_sendVectors[i];
+        header.msg_iovlen = packetPerVector ? 1 : count;
+
+        if (!i && fdCount) {
+            header.msg_control = m_sendControl;
+            header.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&header);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+            memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+        }
+
+        struct io_uring_sqe* sqe = nextSqe();
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = m_socketFd;
+        sqe->addr = reinterpret_cast<uintptr_t>(&header);
+        sqe->len = 1;
+        sqe->msg_flags = MSG_NOSIGNAL;
+        sqe->user_data = s_sendTag;
+        // Packets have to leave in order, a failed one cancels the rest.
+        if (i + 1 < sqeCount)
+            sqe->flags = IOSQE_IO_LINK;
+    }
+
+    m_sendOutstanding = sqeCount;
+    m_sendBytes = 0;
+    m_sendError = 0;
+    return true;
+}
+
+void Uring::submit(bool reap)
+{
+    // A multishot receive ends when it ran out of buffers, it is restarted
+    // once some of them were released.
+    if (m_receiveActive && !m_receiveArmed)
+        armReceive();
+
+    unsigned pending = m_sqLocalTail - m_sqSubmitted;
+    if (!pending && !reap)
+        return;
+
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+    int submitted = uringEnter(m_fd, pending, reap ? IORING_ENTER_GETEVENTS : 0);
+    if (submitted == -1) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            fprintf(stderr, "IPC::Uring: failed to submit: %s\n", strerror(errno));
+        return;
+    }
+    m_sqSubmitted += submitted;
+}
+
+bool Uring::nextCompletion(Completion& completion)
+{
+    unsigned head = *m_cqHead;
+    while (head != __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe cqe = m_cqes[head & m_cqMask];
+        __atomic_store_n(m_cqHead, ++head, __ATOMIC_RELEASE);
+
+        if (cqe.user_data == s_sendTag) {
+            if (cqe.res >= 0 && !m_sendError)
+                m_sendBytes += cqe.res;
+            else if (cqe.res < 0 && !m_sendError)
+                m_sendError = -cqe.res;
+
+            if (--m_sendOutstanding)
+                continue;
+
+            completion.event = Event::Sent;
+            completion.result = m_sendBytes ? m_sendBytes : -m_sendError;
+            return true;
+        }
+
+        if (cqe.user_data != s_receiveTag)
+            continue;
+
+        if (!(cqe.flags & IORING_CQE_F_MORE))
+            m_receiveArmed = false;
+
+        if (cqe.res < 0) {
+            if (cqe.res == -ENOBUFS)
+                continue;
+
+            m_receiveActive = false;
+            completion.event = Event::ReceiveFailed;
+            completion.result = cqe.res;
+            return true;
+        }
+
+        if (!(cqe.flags & IORING_CQE_F_BUFFER)) {
+            completion.event = Event::Closed;
+            return true;
+        }
+
+        uint16_t buffer = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        char* data = m_buffers + size_t(buffer) * bufferSize;
+        auto& out = *reinterpret_cast<struct io_uring_recvmsg_out*>(data);
+        char* control = data + sizeof(out) + m_receiveHeader.msg_namelen;
+
+        memset(&completion.header, 0, sizeof(completion.header));
+        completion.header.msg_control = control;
+        completion.header.msg_controllen = out.controllen;
+        completion.header.msg_flags = out.flags;
+
+        completion.data = control + m_receiveHeader.msg_controllen;
+        completion.length = std::min<size_t>(out.payloadlen, bufferSize - (completion.data - data));
+        completion.buffer = buffer;
+
+        // A read of nothing means the peer went away.
+        if (!completion.length && !out.controllen) {
+            releaseBuffer(buffer);
+            m_receiveActive = false;
+            completion.event = Event::Closed;
+            return true;
+        }
+
+        completion.event = Event::Received;
+        return true;
+    }
+
+    return false;
+}
+
+void Uring::releaseBuffer(uint16_t buffer)
+{
+    // Not through bufs[], whose flexible array declaration is laid out
+    // differently by C++ compilers.
+    auto* entries = reinterpret_cast<struct io_uring_buf*>(m_bufferRing);
+    auto& entry = entries[m_bufferTail & (bufferCount - 1)];
+    entry.addr = reinterpret_cast<uintptr_t>(m_buffers + size_t(buffer) * bufferSize);
+    entry.len = bufferSize;
+    entry.bid = buffer;
+
+    __atomic_store_n(&m_bufferRing->tail, ++m_bufferTail, __ATOMIC_RELEASE);
+}
+
+void Uring::clearEventFd()
+{
+    uint64_t value;
+    while (read(m_eventFd, &value, sizeof(value)) == sizeof(value)) { }
+}
+
+} // namespace IPC
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_platform_ipc_uring_h
+#define wpe_platform_ipc_uring_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+
+namespace IPC {
+
+// Drives the socket of a channel through an io_uring instance. A multishot
+// recvmsg keeps filling buffers from a provided buffer ring, so reading costs
+// no system call per batch, and outgoing records are handed over as a single
+// submission. Completions are signalled on eventFd().
+class Uring {
+public:
+    static const size_t bufferCount = 32;
+    static const size_t bufferSize = 4096;
+    static const size_t maxFds = 16;
+    static const size_t maxSendVectors = 64;
+
+    enum class Event { Received, ReceiveFailed, Closed, Sent };
+
+    struct Completion {
+        Event event;
+
+        // Received: the payload and a header describing its control data,
+        // ready for CMSG_FIRSTHDR(). The buffer has to be released.
+        const char* data;
+        size_t length;
+        struct msghdr header;
+        uint16_t buffer;
+
+        // Sent: the number of bytes written, or a negative errno.
+        ssize_t result;
+    };
+
+    // Returns nullptr when the kernel lacks what is needed.
+    static Uring* create(int socketFd);
+    ~Uring();
+
+    int eventFd() const { return m_eventFd; }
+    bool receiveActive() const { return m_receiveActive; }
+    bool sendInFlight() const { return m_sendOutstanding; }
+
+    // One sendmsg for the whole batch, or one linked sendmsg per vector for
+    // a packet socket. The vectors are copied, the memory they point to has
+    // to stay untouched until the Sent completion.
+    bool queueSend(const struct iovec*, size_t count, const int* fds, size_t fdCount, bool packetPerVector);
+
+    // Hands everything queued since the last call to the kernel. Reaping
+    // also lets the kernel post completions that are still pending.
+    void submit(bool reap = false);
+
+    bool nextCompletion(Completion&);
+    void releaseBuffer(uint16_t);
+    void clearEventFd();
+
+private:
+    Uring() = default;
+
+    bool setup();
+    bool setupBufferRing();
+    struct io_uring_sqe* nextSqe();
+    bool armReceive();
+
+    int m_fd { -1 };
+    int m_socketFd { -1 };
+    int m_eventFd { -1 };
+
+    void* m_sqRing { nullptr };
+    size_t m_sqRingSize { 0 };
+    void* m_cqRing { nullptr };
+    size_t m_cqRingSize { 0 };
+    struct io_uring_sqe* m_sqes { nullptr };
+    size_t m_sqesSize { 0 };
+
+    unsigned* m_sqHead { nullptr };
+    unsigned* m_sqTail { nullptr };
+    unsigned m_sqMask { 0 };
+    unsigned m_sqEntries { 0 };
+    unsigned* m_sqArray { nullptr };
+    unsigned m_sqLocalTail { 0 };
+    unsigned m_sqSubmitted { 0 };
+
+    unsigned* m_cqHead { nullptr };
+    unsigned* m_cqTail { nullptr };
+    unsigned m_cqMask { 0 };
+    struct io_uring_cqe* m_cqes { nullptr };
+
+    struct io_uring_buf_ring* m_bufferRing { nullptr };
+    char* m_buffers { nullptr };
+    uint16_t m_bufferTail { 0 };
+
+    struct msghdr m_receiveHeader { };
+    bool m_receiveActive { false };
+    bool m_receiveArmed { false };
+
+    struct msghdr m_sendHeaders[maxSendVectors];
+    struct iovec m_sendVectors[maxSendVectors];
+    alignas(struct cmsghdr) char m_sendControl[CMSG_SPACE(sizeof(int) * maxFds)];
+    size_t m_sendOutstanding { 0 };
+    ssize_t m_sendBytes { 0 };
+    int m_sendError { 0 };
+};
+
+} // namespace IPC
+
+#endif // wpe_platform_ipc_uring_h
@@ -27,181 +27,748 @@
 
 #include "ipc.h"
 
+#include "ipc-blob.h"
+#include "ipc-busy-poll.h"
+#include "ipc-channel.h"
+#include "ipc-io-thread.h"
+#include "ipc-loopback.h"
+#include "ipc-multiplex.h"
+#include "ipc-rpc.h"
+#include <cerrno>
+#include <climits>
 #include <cstdio>
-#include <gio/gunixfdmessage.h>
-#include <sys/types.h>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
 
 namespace IPC {
 
+int timeoutFromEnvironment(const char* name, int defaultMilliseconds)
+{
+    const char* value = std::getenv(name);
+    if (!value)
+        return defaultMilliseconds;
+
+    char* end;
+    errno = 0;
+    long timeout = std::strtol(value, &end, 10);
+    if (errno || end == value || *end || timeout > INT_MAX) {
+        fprintf(stderr, "IPC: ignoring %s=%s, using %d\n", name, value, defaultMilliseconds);
+        return defaultMilliseconds;
+    }
+    return timeout < 0 ? -1 : int(timeout);
+}
+
+// Client descriptors handed out by hosts of this process. A client that gets
+// one of them talks to its host through the loopback instead of the socket.
+// The inode guards against the number having been reused meanwhile.
+struct LoopbackRegistration {
+    int fd;
+    ino_t inode;
+    Loopback* loopback;
+};
+
+static std::mutex s_loopbackLock;
+static std::vector<LoopbackRegistration> s_loopbackRegistrations;
+
+static ino_t socketInode(int fd)
+{
+    struct stat fdStat;
+    return fstat(fd, &fdStat) == -1 ? 0 : fdStat.st_ino;
+}
+
+static void registerLoopback(int fd, Loopback* loopback)
+{
+    ino_t inode = socketInode(fd);
+    if (!inode)
+        return;
+
+    loopback->ref();
+    std::lock_guard<std::mutex> lock(s_loopbackLock);
+    s_loopbackRegistrations.push_back({ fd, inode, loopback });
+}
+
+static void unregisterLoopback(Loopback* loopback)
+{
+    std::lock_guard<std::mutex> lock(s_loopbackLock);
+    for (auto it = s_loopbackRegistrations.begin(); it != s_loopbackRegistrations.end();) {
+        if (it->loopback != loopback) {
+            ++it;
+            continue;
+        }
+        it->loopback->deref();
+        it = s_loopbackRegistrations.erase(it);
+    }
+}
+
+// Returns a reference the caller has to drop.
+static Loopback* takeLoopback(int fd)
+{
+    ino_t inode = socketInode(fd);
+
+    std::lock_guard<std::mutex> lock(s_loopbackLock);
+    for (auto it = s_loopbackRegistrations.begin(); it != s_loopbackRegistrations.end(); ++it) {
+        if (it->fd != fd)
+            continue;
+
+        LoopbackRegistration registration = *it;
+        s_loopbackRegistrations.erase(it);
+        if (registration.inode == inode)
+            return registration.loopback;
+        registration.loopback->deref();
+        return nullptr;
+    }
+    return nullptr;
+}
+
+void Host::Handler::handleMessageWithFds(char* data, size_t size, int* fds, size_t fdCount)
+{
+    handleMessage(data, size);
+    for (size_t i = 0; i < fdCount; ++i)
+        close(fds[i]);
+}
+
 Host::Host() = default;
 
+void Host::advertiseFeatures(uint32_t features)
+{
+    m_features |= features;
+}
+
 void Host::initialize(Handler& handler)
 {
+    static const Channel::Receiver s_receiver = {
+        // message
+        [](void* data, char* buffer, size_t size)
+        {
+            auto& host = *static_cast<Host*>(data);
+            host.m_handler->handleMessage(buffer, size);
+        },
+        // messages
+        [](void* data, Message* messages, size_t count)
+        {
+            auto& host = *static_cast<Host*>(data);
+            host.m_handler->handleMessages(messages, count);
+        },
+        // messageWithFds
+        [](void* data, char* buffer, size_t size, int* fds, size_t fdCount)
+        {
+            auto& host = *static_cast<Host*>(data);
+            host.m_handler->handleMessageWithFds(buffer, size, fds, fdCount);
+        },
+        // fd
+        [](void* data, int fd)
+        {
+            auto& host = *static_cast<Host*>(data);
+            host.m_handler->handleFd(fd);
+        },
+        nullptr, // multiplex
+        nullptr, // closed
+        // rpc
+        [](void* data, char* buffer, size_t size)
+        {
+            auto& host = *static_cast<Host*>(data);
+            host.m_rpc->handleFrame(buffer, size);
+        },
+        // features
+        [](void* data, uint32_t common)
+        {
+            auto& host = *static_cast<Host*>(data);
+            host.m_handler->handleFeatures(common);
+        },
+    };
+
     m_handler = &handler;
+    m_rpc = new Rpc(
+        [](void* data, uint32_t code, const void* payload, size_t length)
+        {
+            static_cast<Host*>(data)->sendFrame(code, payload, length);
+        },
+        [](void* data, RequestId id, uint32_t code, char* payload, size_t length)
+        {
+            static_cast<Host*>(data)->m_handler->handleRequest(id, code, payload, length);
+        }, this);
+
+    // WPE_IPC_MULTIPLEX=1 serves all views of this process over a single
+    // connection per client process.
+    const char* multiplex = std::getenv("WPE_IPC_MULTIPLEX");
+    if (multiplex && std::strtoul(multiplex, nullptr, 10)) {
+        m_multiplexer = Multiplexer::hostInstance(g_main_context_get_thread_default());
+        if (m_multiplexer) {
+            m_endpoint = m_multiplexer->addEndpoint(s_receiver, this);
+            return;
+        }
+    }
 
     int sockets[2];
-    int ret = socketpair(AF_UNIX, SOCK_STREAM, 0, sockets);
-    if (ret == -1)
+    if (!Channel::createSocketPair(sockets))
         return;
 
-    m_socket = g_socket_new_from_fd(sockets[0], nullptr);
-    if (!m_socket) {
+    // WPE_IPC_LOOPBACK=1 lets a client created in this very process skip the
+    // socket. Any other client keeps using it.
+    const char* loopback = std::getenv("WPE_IPC_LOOPBACK");
+    if (loopback && std::strtoul(loopback, nullptr, 10))
+        m_loopback = Loopback::create();
+
+    auto setUp = [](Channel& channel, void* data)
+    {
+        auto& host = *static_cast<Host*>(data);
+        channel.advertiseFeatures(host.m_features);
+        channel.setMergeFunction(host.m_mergeFunction);
+        if (host.m_loopback)
+            channel.setLoopback(host.m_loopback);
+        channel.offerSharedRingFromEnvironment();
+    };
+
+    // WPE_IPC_IO_THREAD=1 does the socket I/O on a thread of its own.
+    bool created;
+    if (IOThread::enabledFromEnvironment()) {
+        m_ioThread = new IOThread(s_receiver, this,
+            [](void* data, char* buffer, size_t size)
+            {
+                static_cast<Host*>(data)->m_handler->handleMessageOnIOThread(buffer, size);
+            }, G_PRIORITY_DEFAULT);
+        created = m_ioThread->createChannel(Channel::Side::Host, sockets[0], TRUE, setUp, this);
+    } else {
+        m_channel = new Channel(Channel::Side::Host, s_receiver, this);
+        m_channel->configureFromEnvironment();
+        created = m_channel->initialize(sockets[0], G_PRIORITY_DEFAULT, TRUE);
+        if (created)
+            setUp(*m_channel, this);
+    }
+
+    if (!created) {
+        delete m_channel;
+        m_channel = nullptr;
+        delete m_ioThread;
+        m_ioThread = nullptr;
+        if (m_loopback)
+            m_loopback->deref();
+        m_loopback = nullptr;
         close(sockets[0]);
         close(sockets[1]);
         return;
     }
 
-    m_source = g_socket_create_source(m_socket, G_IO_IN, nullptr);
-    g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(socketCallback), this, nullptr);
-    g_source_set_priority(m_source, G_PRIORITY_DEFAULT);
-    g_source_set_can_recurse(m_source, TRUE);
-    g_source_attach(m_source, g_main_context_get_thread_default());
-
     m_clientFd = sockets[1];
 }
 
 void Host::deinitialize()
 {
+    if (m_multiplexer)
+        m_multiplexer->removeEndpoint(m_endpoint);
+    m_multiplexer = nullptr;
+
+    if (m_loopback) {
+        unregisterLoopback(m_loopback);
+        m_loopback->deref();
+        m_loopback = nullptr;
+    }
+
     if (m_clientFd != -1)
         close(m_clientFd);
+    m_clientFd = -1;
+
+    delete m_channel;
+    m_channel = nullptr;
+    delete m_ioThread;
+    m_ioThread = nullptr;
 
-    if (m_source)
-        g_source_destroy(m_source);
-    if (m_socket)
-        g_object_unref(m_socket);
+    delete m_rpc;
+    m_rpc = nullptr;
 
     m_handler = nullptr;
 }
 
 int Host::releaseClientFD()
 {
-    return dup(m_clientFd);
+    if (m_multiplexer)
+        return m_multiplexer->createClientFd(m_endpoint);
+
+    int fd = dup(m_clientFd);
+    if (fd != -1 && m_loopback)
+        registerLoopback(fd, m_loopback);
+    return fd;
 }
 
 void Host::sendMessage(char* data, size_t size)
 {
-    g_socket_send(m_socket, data, size, nullptr, nullptr);
+    if (m_multiplexer)
+        m_multiplexer->sendMessage(m_endpoint, data, size, Delivery::Always);
+    else if (m_ioThread)
+        m_ioThread->sendMessage(data, size, Delivery::Always, Lane::Control);
+    else if (m_channel)
+        m_channel->sendMessage(data, size);
 }
 
-gboolean Host::socketCallback(GSocket* socket, GIOCondition condition, gpointer data)
+void Host::sendMessage(char* data, size_t size, Delivery delivery)
 {
-    if (!(condition & G_IO_IN))
-        return TRUE;
+    sendMessage(data, size, delivery, Lane::Control);
+}
 
-    auto& host = *static_cast<Host*>(data);
+void Host::sendMessage(char* data, size_t size, Delivery delivery, Lane lane)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendMessage(m_endpoint, data, size, delivery);
+    else if (m_ioThread)
+        m_ioThread->sendMessage(data, size, delivery, lane);
+    else if (m_channel)
+        m_channel->sendMessage(data, size, delivery, lane);
+}
 
-    GSocketControlMessage** messages;
-    int nMessages = 0;
-    char* buffer = g_new0(char, Message::size);
-    GInputVector vector = { buffer, Message::size };
-    gssize len = g_socket_receive_message(socket, nullptr, &vector, 1,
-        &messages, &nMessages, nullptr, nullptr, nullptr);
+void Host::sendFrame(uint32_t code, const void* payload, size_t length)
+{
+    sendFrame(code, payload, length, Lane::Control);
+}
 
-    // If nothing is read, give up.
-    if (len == -1) {
-        g_free(buffer);
-        return FALSE;
-    }
+void Host::sendFrame(uint32_t code, const void* payload, size_t length, Lane lane)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendFrame(m_endpoint, code, payload, length, nullptr, 0);
+    else if (m_ioThread)
+        m_ioThread->sendFrame(code, payload, length, nullptr, 0, lane);
+    else if (m_channel)
+        m_channel->sendFrame(code, payload, length, nullptr, 0, lane);
+}
 
-    // Safe to assume only one FD message will arrive.
-    if (nMessages == 1 && G_IS_UNIX_FD_MESSAGE(messages[0])) {
-        int* fds;
-        int nFds = 0;
-        fds = g_unix_fd_message_steal_fds(G_UNIX_FD_MESSAGE(messages[0]), &nFds);
+void Host::sendMessageWithFds(uint32_t code, const void* payload, size_t length, const int* fds, size_t fdCount)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendFrame(m_endpoint, code, payload, length, fds, fdCount);
+    else if (m_ioThread)
+        m_ioThread->sendFrame(code, payload, length, fds, fdCount, Lane::Control);
+    else if (m_channel)
+        m_channel->sendFrame(code, payload, length, fds, fdCount);
+}
 
-        host.m_handler->handleFd(fds[0]);
+bool Host::sendBlob(uint32_t code, const void* data, size_t size)
+{
+    return Blob::send(*this, code, data, size);
+}
 
-        g_free(fds);
-    }
+void Host::respond(RequestId id, const void* payload, size_t length)
+{
+    if (m_rpc)
+        m_rpc->respond(id, payload, length);
+}
 
-    // But just in case, erase any and all messages.
-    if (nMessages > 0) {
-        for (int i = 0; i < nMessages; ++i)
-            g_object_unref(messages[i]);
-        g_free(messages);
+void Host::dispatchOnIOThread(uint32_t code)
+{
+    if (m_ioThread)
+        m_ioThread->addInlineCode(code);
+}
 
-        g_free(buffer);
-        return TRUE;
-    }
+void Host::setMergeFunction(MergeFunction mergeFunction)
+{
+    m_mergeFunction = mergeFunction;
+    if (m_ioThread)
+        m_ioThread->setMergeFunction(mergeFunction);
+    else if (m_channel)
+        m_channel->setMergeFunction(mergeFunction);
+}
+
+SendStatistics Host::sendStatistics() const
+{
+    if (m_multiplexer)
+        return m_multiplexer->sendStatistics(m_endpoint);
+    if (m_ioThread)
+        return m_ioThread->sendStatistics();
+    return m_channel ? m_channel->sendStatistics() : SendStatistics { 0, 0, 0, 0 };
+}
 
-    if (len == Message::size)
-        host.m_handler->handleMessage(buffer, Message::size);
+LaneStatistics Host::laneStatistics(Lane lane) const
+{
+    if (m_ioThread)
+        return m_ioThread->laneStatistics(lane);
+    const Channel* channel = m_multiplexer ? m_multiplexer->channel(m_endpoint) : m_channel;
+    return channel ? channel->laneStatistics(lane) : LaneStatistics { 0, 0, { 0, 0, 0, 0 } };
+}
+
+const Channel* Host::channel() const
+{
+    return m_multiplexer ? m_multiplexer->channel(m_endpoint) : m_ioThread ? m_ioThread->channel() : m_channel;
+}
+
+size_t Host::latencyStatistics(LatencyStatistics* statistics, size_t capacity) const
+{
+    const Channel* channel = this->channel();
+    return channel ? channel->latencyStatistics(statistics, capacity) : 0;
+}
+
+uint64_t Host::lostMessages() const
+{
+    const Channel* channel = this->channel();
+    return channel ? channel->lostMessages() : 0;
+}
+
+uint32_t Host::commonFeatures() const
+{
+    const Channel* channel = this->channel();
+    return channel ? channel->commonFeatures() : 0;
+}
 
-    g_free(buffer);
-    return TRUE;
+void Client::Handler::handleMessageWithFds(char* data, size_t size, int* fds, size_t fdCount)
+{
+    handleMessage(data, size);
+    for (size_t i = 0; i < fdCount; ++i)
+        close(fds[i]);
 }
 
 Client::Client() = default;
 
+void Client::advertiseFeatures(uint32_t features)
+{
+    m_features |= features;
+}
+
 void Client::initialize(Handler& handler, int fd)
 {
-    m_handler = &handler;
+    static const Channel::Receiver s_receiver = {
+        // message
+        [](void* data, char* buffer, size_t size)
+        {
+            auto& client = *static_cast<Client*>(data);
+            if (client.m_busyPollPending)
+                client.finishBusyPoll(!std::memcmp(buffer, &client.m_busyPollCode, sizeof(uint32_t)));
+            client.m_handler->handleMessage(buffer, size);
+        },
+        // messages
+        [](void* data, Message* messages, size_t count)
+        {
+            auto& client = *static_cast<Client*>(data);
+            if (client.m_busyPollPending)
+                client.finishBusyPoll(messages[0].messageCode == client.m_busyPollCode);
+            client.m_handler->handleMessages(messages, count);
+        },
+        // messageWithFds
+        [](void* data, char* buffer, size_t size, int* fds, size_t fdCount)
+        {
+            auto& client = *static_cast<Client*>(data);
+            if (client.m_busyPollPending)
+                client.finishBusyPoll(!std::memcmp(buffer, &client.m_busyPollCode, sizeof(uint32_t)));
+            client.m_handler->handleMessageWithFds(buffer, size, fds, fdCount);
+        },
+        // fd
+        [](void*, int fd)
+        {
+            close(fd);
+        },
+        nullptr, // multiplex
+        // closed
+        [](void* data)
+        {
+            auto& client = *static_cast<Client*>(data);
+            client.m_rpc->closeAll();
+        },
+        // rpc
+        [](void* data, char* buffer, size_t size)
+        {
+            auto& client = *static_cast<Client*>(data);
+            client.m_rpc->handleFrame(buffer, size);
+        },
+        // features
+        [](void* data, uint32_t common)
+        {
+            auto& client = *static_cast<Client*>(data);
+            client.m_handler->handleFeatures(common);
+        },
+    };
 
-    m_socket = g_socket_new_from_fd(fd, nullptr);
-    if (!m_socket)
+    m_handler = &handler;
+    if (uint32_t limit = BusyPoll::limitFromEnvironment())
+        m_busyPoll = new BusyPoll(limit);
+    m_rpc = new Rpc(
+        [](void* data, uint32_t code, const void* payload, size_t length)
+        {
+            static_cast<Client*>(data)->sendFrame(code, payload, length);
+        }, nullptr, this);
+
+    m_multiplexer = Multiplexer::attachClient(fd, s_receiver, this, m_endpoint);
+    if (m_multiplexer)
         return;
-    g_socket_set_blocking(m_socket, FALSE);
 
-    m_source = g_socket_create_source(m_socket, G_IO_IN, nullptr);
-    g_source_set_callback(m_source, reinterpret_cast<GSourceFunc>(socketCallback), this, nullptr);
-    g_source_set_priority(m_source, G_PRIORITY_HIGH + 30);
-    g_source_set_can_recurse(m_source, TRUE);
-    g_source_attach(m_source, g_main_context_get_thread_default());
+    struct SetUpData {
+        Loopback* loopback;
+        uint32_t features;
+        MergeFunction mergeFunction;
+    } setUpData { takeLoopback(fd), m_features, m_mergeFunction };
+    auto setUp = [](Channel& channel, void* data)
+    {
+        auto& setUpData = *static_cast<SetUpData*>(data);
+        channel.advertiseFeatures(setUpData.features);
+        channel.setMergeFunction(setUpData.mergeFunction);
+        if (setUpData.loopback)
+            channel.acceptLoopback(setUpData.loopback);
+    };
+
+    // See Host::initialize().
+    if (IOThread::enabledFromEnvironment()) {
+        m_ioThread = new IOThread(s_receiver, this,
+            [](void* data, char* buffer, size_t size)
+            {
+                static_cast<Client*>(data)->m_handler->handleMessageOnIOThread(buffer, size);
+            }, G_PRIORITY_HIGH + 30);
+        if (!m_ioThread->createChannel(Channel::Side::Client, fd, FALSE, setUp, &setUpData)) {
+            delete m_ioThread;
+            m_ioThread = nullptr;
+        }
+    } else {
+        m_channel = new Channel(Channel::Side::Client, s_receiver, this);
+        m_channel->configureFromEnvironment();
+        if (m_channel->initialize(fd, G_PRIORITY_HIGH + 30, FALSE))
+            setUp(*m_channel, &setUpData);
+        else {
+            delete m_channel;
+            m_channel = nullptr;
+        }
+    }
+
+    if (setUpData.loopback)
+        setUpData.loopback->deref();
 }
 
 void Client::deinitialize()
 {
-    if (m_source)
-        g_source_destroy(m_source);
-    if (m_socket)
-        g_object_unref(m_socket);
+    if (m_multiplexer)
+        m_multiplexer->removeEndpoint(m_endpoint);
+    m_multiplexer = nullptr;
+
+    delete m_channel;
+    m_channel = nullptr;
+    delete m_ioThread;
+    m_ioThread = nullptr;
+
+    delete m_rpc;
+    m_rpc = nullptr;
+    delete m_busyPoll;
+    m_busyPoll = nullptr;
+    m_busyPollPending = false;
 
     m_handler = nullptr;
 }
 
 void Client::readSynchronously()
 {
-    if (g_socket_condition_wait(m_socket, G_IO_IN, nullptr, nullptr))
-        socketCallback(m_socket, G_IO_IN, this);
+    readSynchronously(-1);
 }
 
-gboolean Client::socketCallback(GSocket* socket, GIOCondition condition, gpointer data)
+ReadStatus Client::readSynchronously(int timeoutMilliseconds)
 {
-    if (!(condition & G_IO_IN))
-        return TRUE;
+    if (m_multiplexer)
+        return m_multiplexer->readSynchronously(m_endpoint, timeoutMilliseconds);
+    if (m_ioThread)
+        return m_ioThread->readSynchronously(timeoutMilliseconds);
+    if (m_channel)
+        return m_channel->readSynchronously(timeoutMilliseconds);
+    return ReadStatus::Closed;
+}
 
-    auto& client = *reinterpret_cast<Client*>(data);
+ReadStatus Client::waitForResponse(RequestId id, int timeoutMilliseconds)
+{
+    gint64 deadline = timeoutMilliseconds < 0 ? -1 : g_get_monotonic_time() + gint64(timeoutMilliseconds) * 1000;
+    while (m_rpc && m_rpc->isPending(id)) {
+        int remaining = -1;
+        if (deadline != -1) {
+            gint64 now = g_get_monotonic_time();
+            if (now >= deadline)
+                return ReadStatus::TimedOut;
+            remaining = (deadline - now + 999) / 1000;
+        }
+
+        ReadStatus status = readSynchronously(remaining);
+        if (status == ReadStatus::Closed)
+            return status;
+    }
+    return ReadStatus::Dispatched;
+}
 
-    char* buffer = g_new0(char, Message::size);
-    gssize len = g_socket_receive(socket, buffer, Message::size, nullptr, nullptr);
+bool Client::busyPoll(uint32_t messageCode)
+{
+    if (!m_busyPoll)
+        return false;
+
+    // Dispatching from here would run handlers in the middle of whatever
+    // sent the message, the regular sources take it from here instead.
+    gint64 start = g_get_monotonic_time();
+    gint64 deadline = start + m_busyPoll->budget();
+    gint64 now = start;
+    while (!hasIncoming()) {
+        now = g_get_monotonic_time();
+        if (now >= deadline) {
+            m_busyPollPending = false;
+            m_busyPoll->recordMiss(uint32_t(now - start));
+            return false;
+        }
+    }
 
-    if (len == Message::size)
-        client.m_handler->handleMessage(buffer, Message::size);
+    m_busyPollPending = true;
+    m_busyPollCode = messageCode;
+    m_busyPollElapsed = uint32_t(g_get_monotonic_time() - start);
+    return true;
+}
 
-    g_free(buffer);
-    return TRUE;
+bool Client::hasIncoming() const
+{
+    if (m_multiplexer)
+        return m_multiplexer->hasIncoming(m_endpoint);
+    if (m_ioThread)
+        return m_ioThread->hasIncoming();
+    return !m_channel || m_channel->hasIncoming();
 }
 
-void Client::sendFd(int fd)
+void Client::finishBusyPoll(bool hit)
 {
-    GSocketControlMessage* fdMessage = g_unix_fd_message_new();
-    if (!g_unix_fd_message_append_fd(G_UNIX_FD_MESSAGE(fdMessage), fd, nullptr)) {
-        g_object_unref(fdMessage);
-        return;
-    }
+    m_busyPollPending = false;
+    if (hit)
+        m_busyPoll->recordHit(m_busyPollElapsed);
+    else
+        m_busyPoll->recordMiss(m_busyPollElapsed);
+}
 
-    if (g_socket_send_message(m_socket, nullptr, nullptr, 0, &fdMessage, 1, 0, nullptr, nullptr) == -1) {
-        g_object_unref(fdMessage);
-        return;
-    }
+BusyPollStatistics Client::busyPollStatistics() const
+{
+    return m_busyPoll ? m_busyPoll->statistics() : BusyPollStatistics { 0, 0, 0, 0, 0 };
+}
 
-    g_object_unref(fdMessage);
+void Client::sendFd(int fd)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendFd(m_endpoint, fd);
+    else if (m_ioThread)
+        m_ioThread->sendFd(fd);
+    else if (m_channel)
+        m_channel->sendFd(fd);
 }
 
 void Client::sendMessage(char* data, size_t size)
 {
-    g_socket_send(m_socket, data, size, nullptr, nullptr);
+    if (m_multiplexer)
+        m_multiplexer->sendMessage(m_endpoint, data, size, Delivery::Always);
+    else if (m_ioThread)
+        m_ioThread->sendMessage(data, size, Delivery::Always, Lane::Control);
+    else if (m_channel)
+        m_channel->sendMessage(data, size);
+}
+
+void Client::sendMessage(char* data, size_t size, Delivery delivery)
+{
+    sendMessage(data, size, delivery, Lane::Control);
+}
+
+void Client::sendMessage(char* data, size_t size, Delivery delivery, Lane lane)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendMessage(m_endpoint, data, size, delivery);
+    else if (m_ioThread)
+        m_ioThread->sendMessage(data, size, delivery, lane);
+    else if (m_channel)
+        m_channel->sendMessage(data, size, delivery, lane);
+}
+
+void Client::sendFrame(uint32_t code, const void* payload, size_t length)
+{
+    sendFrame(code, payload, length, Lane::Control);
+}
+
+void Client::sendFrame(uint32_t code, const void* payload, size_t length, Lane lane)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendFrame(m_endpoint, code, payload, length, nullptr, 0);
+    else if (m_ioThread)
+        m_ioThread->sendFrame(code, payload, length, nullptr, 0, lane);
+    else if (m_channel)
+        m_channel->sendFrame(code, payload, length, nullptr, 0, lane);
+}
+
+void Client::sendMessageWithFds(uint32_t code, const void* payload, size_t length, const int* fds, size_t fdCount)
+{
+    if (m_multiplexer)
+        m_multiplexer->sendFrame(m_endpoint, code, payload, length, fds, fdCount);
+    else if (m_ioThread)
+        m_ioThread->sendFrame(code, payload, length, fds, fdCount, Lane::Control);
+    else if (m_channel)
+        m_channel->sendFrame(code, payload, length, fds, fdCount);
+}
+
+bool Client::sendBlob(uint32_t code, const void* data, size_t size)
+{
+    return Blob::send(*this, code, data, size);
+}
+
+RequestId Client::sendRequest(uint32_t code, const void* payload, size_t length, unsigned timeoutMilliseconds, ResponseCallback callback, void* data)
+{
+    if (!m_rpc || (!m_multiplexer && !m_ioThread && !m_channel))
+        return 0;
+    // Nobody would answer.
+    const Channel* channel = this->channel();
+    if (channel && !channel->canUse(Features::Rpc))
+        return 0;
+    return m_rpc->sendRequest(code, payload, length, timeoutMilliseconds, callback, data);
+}
+
+bool Client::cancelRequest(RequestId id)
+{
+    return m_rpc && m_rpc->cancelRequest(id);
+}
+
+void Client::dispatchOnIOThread(uint32_t code)
+{
+    if (m_ioThread)
+        m_ioThread->addInlineCode(code);
+}
+
+void Client::setMergeFunction(MergeFunction mergeFunction)
+{
+    m_mergeFunction = mergeFunction;
+    if (m_ioThread)
+        m_ioThread->setMergeFunction(mergeFunction);
+    else if (m_channel)
+        m_channel->setMergeFunction(mergeFunction);
+}
+
+SendStatistics Client::sendStatistics() const
+{
+    if (m_multiplexer)
+        return m_multiplexer->sendStatistics(m_endpoint);
+    if (m_ioThread)
+        return m_ioThread->sendStatistics();
+    return m_channel ? m_channel->sendStatistics() : SendStatistics { 0, 0, 0, 0 };
+}
+
+LaneStatistics Client::laneStatistics(Lane lane) const
+{
+    if (m_ioThread)
+        return m_ioThread->laneStatistics(lane);
+    const Channel* channel = m_multiplexer ? m_multiplexer->channel(m_endpoint) : m_channel;
+    return channel ? channel->laneStatistics(lane) : LaneStatistics { 0, 0, { 0, 0, 0, 0 } };
+}
+
+const Channel* Client::channel() const
+{
+    return m_multiplexer ? m_multiplexer->channel(m_endpoint) : m_ioThread ? m_ioThread->channel() : m_channel;
+}
+
+size_t Client::latencyStatistics(LatencyStatistics* statistics, size_t capacity) const
+{
+    const Channel* channel = this->channel();
+    return channel ? channel->latencyStatistics(statistics, capacity) : 0;
+}
+
+uint64_t Client::lostMessages() const
+{
+    const Channel* channel = this->channel();
+    return channel ? channel->lostMessages() : 0;
+}
+
+uint32_t Client::commonFeatures() const
+{
+    const Channel* channel = this->channel();
+    return channel ? channel->commonFeatures() : 0;
 }
 
 } // namespace IPC
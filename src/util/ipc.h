@@ -50,28 +50,237 @@ struct Message {
 };
 static_assert(sizeof(Message) == Message::size, "Message is of correct size");
 
+// Header of a variable-length message. On the wire it is followed by the
+// payload, padded up to a whole number of Message records. Handlers get a
+// frame through handleMessage(), starting at messageCode and with a size of
+// sizeof(messageCode) + length, so fixed-size messages are unaffected.
+// Message codes must stay below Frame::marker. The low bits of flags hold the
+// number of descriptors travelling with the frame.
+struct Frame {
+    static const uint32_t marker = 0x80000000;
+    static const uint32_t fdCountMask = 0xff;
+    static const size_t maxLength = 4096;
+    static const size_t maxFds = 4;
+    static const size_t maxRecordCount = (3 * sizeof(uint32_t) + maxLength + Message::size - 1) / Message::size;
+
+    uint32_t flags { marker };
+    uint32_t length { 0 };
+    uint32_t messageCode { 0 };
+
+    static bool isFrame(uint32_t word) { return word & marker; }
+    static size_t recordCount(size_t length) { return (sizeof(Frame) + length + Message::size - 1) / Message::size; }
+
+    static char* payload(char* data) { return data + sizeof(uint32_t); }
+    static size_t payloadSize(size_t size) { return size - sizeof(uint32_t); }
+};
+static_assert(sizeof(Frame) == 12, "Frame is of correct size");
+
+#if !WIN32
+class BusyPoll;
+class Channel;
+class IOThread;
+class Loopback;
+class Multiplexer;
+class Rpc;
+
+// How a message may be treated while it waits in the outgoing queue. Only
+// the message queued last is ever folded into, so the order relative to
+// anything else stays as it was sent.
+enum class Delivery {
+    Always,
+    // Replaced by a newer message with the same code, e.g. pointer motion.
+    Supersedable,
+    // Combined with a newer message with the same code by the merge
+    // function, e.g. axis deltas. Sent as it is without one.
+    Mergeable,
+};
+
+// Folds a newer mergeable message into the queued one with the same code.
+// Returns false if the two have to go out separately.
+using MergeFunction = bool (*)(Message& queued, const Message& newer);
+
+// Outgoing messages wait in one of two lanes while the connection is backed
+// up. Control messages overtake bulk ones, each lane keeps its own order.
+// Multiplexed connections only have the control lane.
+enum class Lane {
+    Control,
+    // Input events and the like.
+    Bulk,
+};
+
+// Messages that could not be written right away were queued. They either
+// left the queue later (flushed) or overflowed (dropped). Superseded and
+// merged messages were folded into a queued one (merged).
+struct SendStatistics {
+    uint64_t queued;
+    uint64_t dropped;
+    uint64_t flushed;
+    uint64_t merged;
+};
+
+// Records waiting in a lane, now and at most so far, and what went through
+// it. The control lane also holds the message being written.
+struct LaneStatistics {
+    size_t depth;
+    size_t peakDepth;
+    SendStatistics send;
+};
+
+// How long messages with one code took from being sent to reaching the
+// handler, in nanoseconds. Only known when the peer stamps its messages, see
+// WPE_IPC_TIMESTAMPS.
+struct LatencyStatistics {
+    uint32_t messageCode;
+    uint64_t count;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+};
+
+// What Client::busyPoll() did so far, times in microseconds. The hit rate is
+// hits / (hits + misses), spun is the time spent spinning all told.
+struct BusyPollStatistics {
+    uint32_t limit;
+    uint32_t budget;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t spun;
+};
+
+// Requests are told apart by an id that is unique per client, see
+// Client::sendRequest() and Host::respond().
+using RequestId = uint32_t;
+
+enum class RequestStatus {
+    Answered,
+    TimedOut,
+    Cancelled,
+    // The connection went away before an answer arrived.
+    Closed,
+};
+
+// The payload is only set for answered requests and only valid during the call.
+using ResponseCallback = void (*)(void*, RequestStatus, char* payload, size_t length);
+
+enum class ReadStatus {
+    // Everything that had arrived was handed to the handler.
+    Dispatched,
+    TimedOut,
+    // The host went away.
+    Closed,
+};
+
+// A timeout in milliseconds for Client::waitForResponse() from an environment
+// variable, negative for none. Falls back to the default, with a warning,
+// when the variable is not a whole number.
+int timeoutFromEnvironment(const char* name, int defaultMilliseconds);
+
+// Both ends of a connection advertise what they support right after setting
+// it up and only make use of what they have in common. Peers that advertise
+// nothing are treated as they always were. A multiplexed connection serves
+// views of any backend, so it only advertises the channel's own features.
+struct Features {
+    enum : uint32_t {
+        Frames = 1 << 0,
+        SharedRing = 1 << 1,
+        // Understands the stamps of WPE_IPC_TIMESTAMPS.
+        Timestamps = 1 << 2,
+        Rpc = 1 << 3,
+        // Bits from 1 << 16 on are up to the backends, see
+        // Host::advertiseFeatures().
+    };
+};
+#endif
+
 class Host {
 public:
     class Handler {
     public:
+        // Takes ownership of the descriptor.
         virtual void handleFd(int) = 0;
         virtual void handleMessage(char*, size_t) = 0;
+
+        // Called with every record that arrived in one go. The default hands
+        // them to handleMessage() one by one.
+        virtual void handleMessages(Message* messages, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                handleMessage(Message::data(messages[i]), Message::size);
+        }
+
+#if !WIN32
+        // A frame sent with sendMessageWithFds(), together with all of its
+        // descriptors. The handler owns them, the default passes the frame
+        // to handleMessage() and closes them.
+        virtual void handleMessageWithFds(char*, size_t, int* fds, size_t fdCount);
+
+        // A request the client waits for, to be answered with respond(),
+        // right away or later on. The default leaves it unanswered.
+        virtual void handleRequest(RequestId, uint32_t, char*, size_t) { }
+
+        // Messages with a code passed to dispatchOnIOThread(), called on the
+        // I/O thread ahead of anything still queued for the main context.
+        virtual void handleMessageOnIOThread(char*, size_t) { }
+
+        // The features both ends support, once the peer advertised its own.
+        // Never called for peers that do not advertise any.
+        virtual void handleFeatures(uint32_t) { }
+#endif
     };
 
     Host();
 
+#if !WIN32
+    // Adds backend features to the ones advertised, before initialize().
+    void advertiseFeatures(uint32_t);
+#endif
+
     void initialize(Handler&);
     void deinitialize();
 
     int releaseClientFD();
 
     void sendMessage(char*, size_t);
+#if !WIN32
+    void sendMessage(char*, size_t, Delivery);
+    void sendMessage(char*, size_t, Delivery, Lane);
+    void sendFrame(uint32_t, const void*, size_t);
+    void sendFrame(uint32_t, const void*, size_t, Lane);
+    // The descriptors are duplicated, the caller keeps its own.
+    void sendMessageWithFds(uint32_t, const void*, size_t, const int* fds, size_t fdCount);
+    // Copies payloads of any size into a sealed memfd and sends that along
+    // with a frame. The handler gets it through handleMessageWithFds() and
+    // maps it with Blob::adopt(). Returns false if the memfd could not be
+    // set up.
+    bool sendBlob(uint32_t, const void*, size_t);
+    void respond(RequestId, const void*, size_t);
+
+    // Only has an effect with WPE_IPC_IO_THREAD=1, see
+    // Handler::handleMessageOnIOThread(). Up to eight codes.
+    void dispatchOnIOThread(uint32_t);
+    // For messages sent with Delivery::Mergeable, may be set before
+    // initialize(). Multiplexed connections have none and send them as they
+    // are.
+    void setMergeFunction(MergeFunction);
+
+    SendStatistics sendStatistics() const;
+    LaneStatistics laneStatistics(Lane) const;
+    // Fills in up to capacity entries, one per message code received.
+    size_t latencyStatistics(LatencyStatistics*, size_t capacity) const;
+    // Stamped messages that never arrived, going by their sequence numbers.
+    uint64_t lostMessages() const;
+
+    // Zero until the peer advertised its features.
+    uint32_t commonFeatures() const;
+#endif
 
 private:
 #if WIN32
     static void socketCallback(size_t size, char *, void *);
 #else
-    static gboolean socketCallback(GSocket*, GIOCondition, gpointer);
+    // The channel underneath, the shared one when multiplexed.
+    const Channel* channel() const;
 #endif
 
     Handler* m_handler;
@@ -80,9 +289,17 @@ private:
     Windows::Pipe* m_pipe;
     HANDLE m_readThreadHandle;
 #else
-    GSocket* m_socket;
-    GSource* m_source;
+    Channel* m_channel { nullptr };
+    IOThread* m_ioThread { nullptr };
     int m_clientFd { -1 };
+    Loopback* m_loopback { nullptr };
+
+    Multiplexer* m_multiplexer { nullptr };
+    uint32_t m_endpoint { 0 };
+
+    Rpc* m_rpc { nullptr };
+    uint32_t m_features { 0 };
+    MergeFunction m_mergeFunction { nullptr };
 #endif
 };
 
@@ -91,23 +308,95 @@ public:
     class Handler {
     public:
         virtual void handleMessage(char*, size_t) = 0;
+
+        // See Host::Handler::handleMessages().
+        virtual void handleMessages(Message* messages, size_t count)
+        {
+            for (size_t i = 0; i < count; ++i)
+                handleMessage(Message::data(messages[i]), Message::size);
+        }
+
+#if !WIN32
+        // See Host::Handler::handleMessageWithFds().
+        virtual void handleMessageWithFds(char*, size_t, int* fds, size_t fdCount);
+        // See Host::Handler::handleMessageOnIOThread().
+        virtual void handleMessageOnIOThread(char*, size_t) { }
+        // See Host::Handler::handleFeatures().
+        virtual void handleFeatures(uint32_t) { }
+#endif
     };
 
     Client();
 
+#if !WIN32
+    // See Host::advertiseFeatures().
+    void advertiseFeatures(uint32_t);
+#endif
+
     void initialize(Handler&, int);
     void deinitialize();
 
     void readSynchronously();
+#if !WIN32
+    // Waits until something arrives or the timeout passes, a negative one
+    // waits for as long as it takes. Dispatches all that arrived.
+    ReadStatus readSynchronously(int timeoutMilliseconds);
+    // Reads until the request completed, the connection closed or the
+    // timeout passed. The request is left pending when it times out.
+    ReadStatus waitForResponse(RequestId, int timeoutMilliseconds);
+    // Right after sending something the host answers quickly, spins on the
+    // connection for up to the current budget until it turns readable,
+    // instead of sleeping until the main loop notices the answer. What
+    // arrived is left to the regular sources, the spin only counts as a hit
+    // once the first message they dispatch has the awaited code. Returns
+    // whether the connection turned readable. Does nothing unless
+    // WPE_IPC_BUSY_POLL is set to the longest spin in microseconds.
+    bool busyPoll(uint32_t messageCode);
+    BusyPollStatistics busyPollStatistics() const;
+#endif
 
     void sendFd(int);
     void sendMessage(char*, size_t);
+#if !WIN32
+    void sendMessage(char*, size_t, Delivery);
+    void sendMessage(char*, size_t, Delivery, Lane);
+    void sendFrame(uint32_t, const void*, size_t);
+    void sendFrame(uint32_t, const void*, size_t, Lane);
+    void sendMessageWithFds(uint32_t, const void*, size_t, const int* fds, size_t fdCount);
+    // See Host::sendBlob().
+    bool sendBlob(uint32_t, const void*, size_t);
+
+    // The callback runs exactly once, on the main context the client was
+    // initialized on. A timeout of 0 waits for as long as the connection
+    // lasts. Returns 0 if the request could not be sent.
+    RequestId sendRequest(uint32_t, const void*, size_t, unsigned timeoutMilliseconds, ResponseCallback, void*);
+    // Runs the callback with RequestStatus::Cancelled, a later answer is
+    // ignored. Returns false if the request already completed.
+    bool cancelRequest(RequestId);
+
+    // See Host::dispatchOnIOThread().
+    void dispatchOnIOThread(uint32_t);
+    // See Host::setMergeFunction().
+    void setMergeFunction(MergeFunction);
+
+    SendStatistics sendStatistics() const;
+    LaneStatistics laneStatistics(Lane) const;
+    // See Host::latencyStatistics() and Host::lostMessages().
+    size_t latencyStatistics(LatencyStatistics*, size_t capacity) const;
+    uint64_t lostMessages() const;
+
+    // See Host::commonFeatures().
+    uint32_t commonFeatures() const;
+#endif
 
 private:
 #if WIN32
     static void socketCallback(size_t size, char *, void *);
 #else
-    static gboolean socketCallback(GSocket*, GIOCondition, gpointer);
+    // See Host::channel().
+    const Channel* channel() const;
+    bool hasIncoming() const;
+    void finishBusyPoll(bool hit);
 #endif
 
     Handler* m_handler;
@@ -116,8 +405,22 @@ private:
     Windows::Pipe* m_pipe;
     HANDLE m_readThreadHandle;
 #else
-    GSocket* m_socket;
-    GSource* m_source;
+    Channel* m_channel { nullptr };
+    IOThread* m_ioThread { nullptr };
+
+    Multiplexer* m_multiplexer { nullptr };
+    uint32_t m_endpoint { 0 };
+
+    Rpc* m_rpc { nullptr };
+    uint32_t m_features { 0 };
+    MergeFunction m_mergeFunction { nullptr };
+
+    BusyPoll* m_busyPoll { nullptr };
+    // Set once busyPoll() saw the connection turn readable. The first
+    // message dispatched afterwards tells whether it was the awaited one.
+    bool m_busyPollPending { false };
+    uint32_t m_busyPollCode { 0 };
+    uint32_t m_busyPollElapsed { 0 };
 #endif
 };
 
@@ -42,6 +42,8 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
 
+    void handleFrameComplete(const IPC::VIVimx6::FrameComplete&);
+
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
@@ -68,16 +70,15 @@ void EGLTarget::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::VIVimx6::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::VIVimx6::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
+}
+
+void EGLTarget::handleFrameComplete(const IPC::VIVimx6::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 } // namespace VIVimx6
@@ -146,6 +147,7 @@ struct wpe_renderer_backend_egl_target_interface viv_imx6_renderer_backend_egl_t
         IPC::Message message;
         IPC::VIVimx6::BufferCommit::construct(message, target.width, target.height);
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::VIVimx6::FrameComplete::code);
     },
 };
 
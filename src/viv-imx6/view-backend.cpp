@@ -32,6 +32,7 @@
 #include "ipc.h"
 #include <cstdio>
 #include "ipc-viv-imx6.h"
+#include <unistd.h>
 
 namespace VIVimx6 {
 
@@ -48,7 +49,7 @@ struct ViewBackend : public IPC::Host::Handler, public WPE::LibinputServer::Clie
     void handleFd(int) override;
     void handleMessage(char*, size_t) override;
 
-    void commitBuffer(uint32_t, uint32_t);
+    void commitBuffer(const IPC::VIVimx6::BufferCommit&);
 
     // WPE::LibinputServer::Client
     void handleKeyboardEvent(struct wpe_input_keyboard_event*) override;
@@ -97,8 +98,9 @@ void ViewBackend::initialize()
     WPE::LibinputServer::singleton().setClient(this);
 }
 
-void ViewBackend::handleFd(int)
+void ViewBackend::handleFd(int fd)
 {
+    close(fd);
 }
 
 void ViewBackend::handleMessage(char* data, size_t size)
@@ -106,22 +108,15 @@ void ViewBackend::handleMessage(char* data, size_t size)
     if (size != IPC::Message::size)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::VIVimx6::BufferCommit::code:
-    {
-        auto& bufferCommit = IPC::VIVimx6::BufferCommit::cast(message);
-        commitBuffer(bufferCommit.width, bufferCommit.height);
-        break;
-    }
-    default:
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::VIVimx6::BufferCommit, ViewBackend, &ViewBackend::commitBuffer>>;
+    if (!Dispatcher::dispatch(*this, data, size))
         fprintf(stderr, "ViewBackend: unhandled message\n");
-    };
 }
 
-void ViewBackend::commitBuffer(uint32_t width, uint32_t height)
+void ViewBackend::commitBuffer(const IPC::VIVimx6::BufferCommit& bufferCommit)
 {
-    if (width != this->width || height != this->height)
+    if (bufferCommit.width != width || bufferCommit.height != height)
         return;
 
     IPC::Message message;
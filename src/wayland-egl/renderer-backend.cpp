@@ -32,7 +32,12 @@
 
 #include "display.h"
 #include "ipc.h"
+#include "ipc-frame-pipeline.h"
 #include "ipc-waylandegl.h"
+#include "presentation.h"
+#include <algorithm>
+#include <glib.h>
+#include <vector>
 #include <wayland-client-protocol.h>
 
 namespace WaylandEGL {
@@ -61,6 +66,13 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
 
+    void frameWillRender();
+    void frameRendered();
+    void frameDisplayed(struct wl_callback*);
+    void frameTimedOut();
+    void frameComplete();
+    void framePresented(const Wayland::Presentation::Feedback&);
+
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
@@ -68,6 +80,23 @@ struct EGLTarget : public IPC::Client::Handler {
     struct wl_shell_surface *m_shellSurface { nullptr };
     struct wl_egl_window* m_window { nullptr };
     Backend* m_backend { nullptr };
+
+    static const struct wl_callback_listener s_frameListener;
+
+    // The compositor tells when it is a good time to draw the next frame,
+    // which counts as the frame having been displayed. Up to the pipeline
+    // depth frames complete before that. In case the compositor never
+    // answers, for instance while the surface is hidden, an owed frame
+    // completes anyway once the timeout passes. A negative timeout waits for
+    // the callback however long it takes.
+    std::vector<struct wl_callback*> m_frameCallbacks;
+    bool m_frameCallbackRequested { false };
+    IPC::FramePipeline m_framePipeline;
+    GSource* m_frameTimeoutSource { nullptr };
+    int m_frameTimeout { 100 };
+
+    // The view backend hears about the frame once it is on screen.
+    bool m_feedbackRequested { false };
 };
 
 static void
@@ -99,6 +128,13 @@ EGLTarget::EGLTarget(struct wpe_renderer_backend_egl_target* target, int hostFd)
 {
     ipcClient.initialize(*this, hostFd);
     Wayland::EventDispatcher::singleton().setIPC( ipcClient );
+
+    m_frameTimeout = IPC::timeoutFromEnvironment("WPE_FRAME_CALLBACK_TIMEOUT", 100);
+    // Completing every frame right away would defeat the callback.
+    if (!m_frameTimeout) {
+        fprintf(stderr, "EGLTarget: ignoring WPE_FRAME_CALLBACK_TIMEOUT=0, using 100\n");
+        m_frameTimeout = 100;
+    }
 }
 
 void EGLTarget::initialize(Backend& backend, uint32_t width, uint32_t height)
@@ -134,6 +170,17 @@ EGLTarget::~EGLTarget()
 {
     ipcClient.deinitialize();
 
+    if (m_backend && m_backend->display.presentation())
+        m_backend->display.presentation()->cancelFeedback(this);
+    for (auto* callback : m_frameCallbacks)
+        wl_callback_destroy(callback);
+    m_frameCallbacks.clear();
+    if (m_frameTimeoutSource) {
+        g_source_destroy(m_frameTimeoutSource);
+        g_source_unref(m_frameTimeoutSource);
+    }
+    m_frameTimeoutSource = nullptr;
+
     if (m_window)
         wl_egl_window_destroy(m_window);
     m_window = nullptr;
@@ -147,21 +194,120 @@ EGLTarget::~EGLTarget()
 
 void EGLTarget::handleMessage(char* data, size_t size)
 {
-    if (size != IPC::Message::size)
+    fprintf(stderr, "EGLTarget: unhandled message\n");
+}
+
+// Like the Westeros target, asks for the frame callback before the buffer
+// swap commits the surface.
+void EGLTarget::frameWillRender()
+{
+    if (!m_surface)
         return;
 
-    auto& message = IPC::Message::cast(data);
-    switch (message.messageCode) {
-    case IPC::WaylandEGL::FrameComplete::code:
-    {
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-        break;
+    auto* callback = wl_surface_frame(m_surface);
+    wl_callback_add_listener(callback, &s_frameListener, this);
+    m_frameCallbacks.push_back(callback);
+    m_frameCallbackRequested = true;
+
+    if (Wayland::Presentation* presentation = m_backend->display.presentation()) {
+        presentation->requestFeedback(m_surface,
+            [](void* data, const Wayland::Presentation::Feedback& feedback)
+            {
+                static_cast<EGLTarget*>(data)->framePresented(feedback);
+            }, this);
+        m_feedbackRequested = true;
     }
-    default:
-        fprintf(stderr, "EGLTarget: unhandled message\n");
-    };
 }
 
+void EGLTarget::frameRendered()
+{
+    wl_display *display = m_backend->display.display();
+    if(display)
+        wl_display_flush(display);
+
+    // Only for the view backend to report the frame as displayed. Nothing
+    // answers it, the frame completes on the compositor's frame callback,
+    // so there is no reply to busy-poll for.
+    if (!m_feedbackRequested) {
+        IPC::Message message;
+        IPC::WaylandEGL::BufferCommit::construct(message);
+        ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
+    m_feedbackRequested = false;
+
+    // Without a callback to wait for, or while the pipeline has room,
+    // complete the frame right away.
+    bool owed = m_frameCallbackRequested && !m_framePipeline.commit();
+    m_frameCallbackRequested = false;
+    if (m_frameTimeoutSource || (owed && m_frameTimeout < 0))
+        return;
+
+    m_frameTimeoutSource = g_timeout_source_new(owed ? m_frameTimeout : 0);
+    if (owed) {
+        g_source_set_callback(m_frameTimeoutSource,
+            [](gpointer data) -> gboolean
+            {
+                static_cast<EGLTarget*>(data)->frameTimedOut();
+                return G_SOURCE_REMOVE;
+            }, this, nullptr);
+    } else {
+        g_source_set_callback(m_frameTimeoutSource,
+            [](gpointer data) -> gboolean
+            {
+                static_cast<EGLTarget*>(data)->frameComplete();
+                return G_SOURCE_REMOVE;
+            }, this, nullptr);
+    }
+    g_source_attach(m_frameTimeoutSource, g_main_context_get_thread_default());
+}
+
+void EGLTarget::frameDisplayed(struct wl_callback* callback)
+{
+    m_frameCallbacks.erase(std::find(m_frameCallbacks.begin(), m_frameCallbacks.end(), callback));
+    wl_callback_destroy(callback);
+
+    if (m_framePipeline.displayed())
+        frameComplete();
+}
+
+// The oldest frame counts as displayed, its callback no longer matters.
+void EGLTarget::frameTimedOut()
+{
+    if (!m_frameCallbacks.empty()) {
+        wl_callback_destroy(m_frameCallbacks.front());
+        m_frameCallbacks.erase(m_frameCallbacks.begin());
+    }
+    m_framePipeline.displayed();
+    frameComplete();
+}
+
+void EGLTarget::frameComplete()
+{
+    if (m_frameTimeoutSource) {
+        g_source_destroy(m_frameTimeoutSource);
+        g_source_unref(m_frameTimeoutSource);
+    }
+    m_frameTimeoutSource = nullptr;
+
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
+}
+
+void EGLTarget::framePresented(const Wayland::Presentation::Feedback& feedback)
+{
+    IPC::Message message;
+    IPC::WaylandEGL::FramePresented::construct(message, uint32_t(feedback.presented),
+        uint32_t(feedback.timestamp >> 32), uint32_t(feedback.timestamp), feedback.refresh, feedback.flags);
+    ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+const struct wl_callback_listener EGLTarget::s_frameListener = {
+    // done
+    [](void* data, struct wl_callback* callback, uint32_t)
+    {
+        static_cast<EGLTarget*>(data)->frameDisplayed(callback);
+    },
+};
+
 } // namespace WaylandEGL
 
 extern "C" {
@@ -218,19 +364,14 @@ struct wpe_renderer_backend_egl_target_interface wayland_egl_renderer_backend_eg
     // frame_will_render
     [](void* data)
     {
+        auto& target = *static_cast<WaylandEGL::EGLTarget*>(data);
+        target.frameWillRender();
     },
     // frame_rendered
     [](void* data)
     {
         auto& target = *static_cast<WaylandEGL::EGLTarget*>(data);
-
-        wl_display *display = target.m_backend->display.display();
-        if(display)
-            wl_display_flush(display);
-
-        IPC::Message message;
-        IPC::WaylandEGL::BufferCommit::construct(message);
-        target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.frameRendered();
     },
 };
 
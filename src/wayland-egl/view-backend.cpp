@@ -29,11 +29,14 @@
 #include <wpe/wpe.h>
 #include "display.h"
 #include "ipc.h"
+#include "ipc-touch.h"
 #include "ipc-waylandegl.h"
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #define WIDTH 1280
 #define HEIGHT 720
@@ -47,20 +50,39 @@ struct ViewBackend : public IPC::Host::Handler {
     virtual ~ViewBackend();
 
     // IPC::Host::Handler
-    void handleFd(int) override { };
+    void handleFd(int fd) override { close(fd); };
     void handleMessage(char*, size_t) override;
 
-    void ackBufferCommit();
+    void ackBufferCommit(const IPC::WaylandEGL::BufferCommit&);
+    void framePresented(const IPC::WaylandEGL::FramePresented&);
     void initialize();
 
+    // The most recent frame the compositor presented, all zero until then.
+    struct Presentation {
+        uint64_t timestamp;
+        uint32_t refresh;
+        uint32_t flags;
+    };
+    const Presentation& lastPresentation() const { return m_lastPresentation; }
+
     struct wpe_view_backend* backend;
     IPC::Host ipcHost;
+
+private:
+    Presentation m_lastPresentation { 0, 0, 0 };
+    uint64_t m_presented { 0 };
+    uint64_t m_discarded { 0 };
+    unsigned long m_reportInterval { 0 };
 };
 
 ViewBackend::ViewBackend(struct wpe_view_backend* backend)
     : backend(backend)
 {
     ipcHost.initialize(*this);
+
+    // Same as in the renderer, see Wayland::Presentation.
+    if (const char* interval = std::getenv("WPE_PRESENTATION_STATISTICS"))
+        m_reportInterval = std::strtoul(interval, nullptr, 10);
 }
 
 ViewBackend::~ViewBackend()
@@ -70,9 +92,23 @@ ViewBackend::~ViewBackend()
 
 void ViewBackend::handleMessage(char* data, size_t size)
 {
+    auto& messageCode = *reinterpret_cast<uint32_t*>(data);
+    if (messageCode == Wayland::EventDispatcher::MsgType::TOUCH) {
+        struct wpe_input_touch_event event;
+        if (IPC::Touch::decode(IPC::Frame::payload(data), IPC::Frame::payloadSize(size), event))
+            wpe_view_backend_dispatch_touch_event(backend, &event);
+        return;
+    }
+
     if (size != IPC::Message::size)
         return;
 
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::WaylandEGL::BufferCommit, ViewBackend, &ViewBackend::ackBufferCommit>,
+        IPC::Schema::Handler<IPC::WaylandEGL::FramePresented, ViewBackend, &ViewBackend::framePresented>>;
+    if (Dispatcher::dispatch(*this, data, size))
+        return;
+
     auto& message = IPC::Message::cast(data);
     switch (message.messageCode) {
     case Wayland::EventDispatcher::MsgType::AXIS:
@@ -87,12 +123,6 @@ void ViewBackend::handleMessage(char* data, size_t size)
         wpe_view_backend_dispatch_pointer_event(backend, event);
         break;
     }
-    case Wayland::EventDispatcher::MsgType::TOUCH:
-    {
-        struct wpe_input_touch_event * event = reinterpret_cast<wpe_input_touch_event*>(std::addressof(message.messageData));
-        wpe_view_backend_dispatch_touch_event(backend, event);
-        break;
-    }
     case Wayland::EventDispatcher::MsgType::TOUCHSIMPLE:
     {
         struct wpe_input_touch_event_raw * touchpoint = reinterpret_cast<wpe_input_touch_event_raw*>(std::addressof(message.messageData));
@@ -106,11 +136,6 @@ void ViewBackend::handleMessage(char* data, size_t size)
         wpe_view_backend_dispatch_keyboard_event(backend, event);
         break;
     }
-    case IPC::WaylandEGL::BufferCommit::code:
-    {
-        ackBufferCommit();
-        break;
-    }
     default:
         fprintf(stderr, "ViewBackend: unhandled message\n");
     }
@@ -189,11 +214,28 @@ void ViewBackend::initialize()
     wpe_view_backend_dispatch_set_size( backend, w, h );
 }
 
-void ViewBackend::ackBufferCommit()
+// The renderer completes its frames once the compositor asks for the next
+// one, there is nothing to answer.
+void ViewBackend::ackBufferCommit(const IPC::WaylandEGL::BufferCommit&)
 {
-    IPC::Message message;
-    IPC::WaylandEGL::FrameComplete::construct(message);
-    ipcHost.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    wpe_view_backend_dispatch_frame_displayed(backend);
+}
+
+// frame-displayed carries no timestamp, dispatching it now is as close to
+// the real presentation as it gets. Discarded frames are reported too, the
+// view would wait for them in vain otherwise.
+void ViewBackend::framePresented(const IPC::WaylandEGL::FramePresented& message)
+{
+    if (message.presented) {
+        m_lastPresentation = { uint64_t(message.timestampHigh) << 32 | message.timestampLow, message.refresh, message.flags };
+        ++m_presented;
+        if (m_reportInterval && !(m_presented % m_reportInterval)) {
+            fprintf(stderr, "WaylandEGL::ViewBackend: %llu presented, %llu discarded, last at %llu ns, refresh %.2f ms, flags 0x%x\n",
+                static_cast<unsigned long long>(m_presented), static_cast<unsigned long long>(m_discarded),
+                static_cast<unsigned long long>(m_lastPresentation.timestamp), m_lastPresentation.refresh / 1e6, m_lastPresentation.flags);
+        }
+    } else
+        ++m_discarded;
 
     wpe_view_backend_dispatch_frame_displayed(backend);
 }
@@ -29,8 +29,12 @@
 #ifdef BACKEND_BCM_NEXUS_WAYLAND
 #include "nsc-client-protocol.h"
 #endif
+#include "ipc-touch.h"
+#include "presentation.h"
+#include "presentation-time-client-protocol.h"
 #include "xdg-shell-client-protocol.h"
 #include "wayland-client-protocol.h"
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 #include <glib.h>
@@ -138,6 +142,9 @@ const struct wl_registry_listener g_registryListener = {
 
         if (!std::strcmp(interface, "wl_shell"))
             interfaces.shell = static_cast<struct wl_shell*>(wl_registry_bind(registry, name, &wl_shell_interface, 1));
+
+        if (!std::strcmp(interface, "wp_presentation"))
+            interfaces.presentation = static_cast<struct wp_presentation*>(wl_registry_bind(registry, name, &wp_presentation_interface, 1));
     },
     // global_remove
     [](void*, struct wl_registry*, uint32_t) { },
@@ -647,6 +654,9 @@ Display::Display()
 
     if ( m_interfaces.seat )
         wl_seat_add_listener(m_interfaces.seat, &g_seatListener, &m_seatData);
+
+    if (m_interfaces.presentation)
+        m_presentation = new Presentation(m_interfaces.presentation);
 }
 
 Display::~Display()
@@ -667,6 +677,9 @@ Display::~Display()
         xdg_shell_destroy(m_interfaces.xdg);
     if (m_interfaces.shell)
         wl_shell_destroy(m_interfaces.shell);
+    // Destroys the wp_presentation global as well.
+    delete m_presentation;
+    m_presentation = nullptr;
     m_interfaces = {
         nullptr,
 #ifdef BACKEND_BCM_NEXUS_WAYLAND
@@ -675,6 +688,7 @@ Display::~Display()
         nullptr,
         nullptr,
         nullptr,
+        nullptr,
     };
 
     if (m_registry)
@@ -717,6 +731,24 @@ void Display::unregisterInputClient(struct wl_surface* surface)
 }
 
 
+// Axis events that were not written yet add up as long as they scroll along
+// the same axis, the newer one gives the time and position.
+static bool mergeInputMessages(IPC::Message& queued, const IPC::Message& newer)
+{
+    if (newer.messageCode != EventDispatcher::MsgType::AXIS)
+        return false;
+
+    auto& queuedEvent = *reinterpret_cast<wpe_input_axis_event*>(queued.messageData);
+    auto& newerEvent = *reinterpret_cast<const wpe_input_axis_event*>(newer.messageData);
+    if (queuedEvent.type != newerEvent.type || queuedEvent.axis != newerEvent.axis || queuedEvent.modifiers != newerEvent.modifiers)
+        return false;
+
+    int32_t value = queuedEvent.value + newerEvent.value;
+    queuedEvent = newerEvent;
+    queuedEvent.value = value;
+    return true;
+}
+
 EventDispatcher& EventDispatcher::singleton()
 {
     static EventDispatcher event;
@@ -731,7 +763,7 @@ void EventDispatcher::sendEvent( wpe_input_axis_event& event )
         static_assert(sizeof(message.messageData) >= sizeof(event), "messageData must be large enough to hold wpe_input_axis_event");
         message.messageCode = MsgType::AXIS;
         memcpy( message.messageData, &event, sizeof(event) );
-        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size, IPC::Delivery::Mergeable, IPC::Lane::Bulk);
     }
 }
 
@@ -743,20 +775,16 @@ void EventDispatcher::sendEvent( wpe_input_pointer_event& event )
         static_assert(sizeof(message.messageData) >= sizeof(event), "messageData must be large enough to hold wpe_input_pointer_event");
         message.messageCode = MsgType::POINTER;
         memcpy( message.messageData, &event, sizeof(event) );
-        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        // Motion that was not written yet is stale once a newer one comes in.
+        auto delivery = event.type == wpe_input_pointer_event_type_motion ? IPC::Delivery::Supersedable : IPC::Delivery::Always;
+        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size, delivery, IPC::Lane::Bulk);
     }
 }
 
 void EventDispatcher::sendEvent( wpe_input_touch_event& event )
 {
     if ( m_ipc != nullptr )
-    {
-        IPC::Message message;
-        static_assert(sizeof(message.messageData) >= sizeof(event), "messageData must be large enough to hold wpe_input_touch_event");
-        message.messageCode = MsgType::TOUCH;
-        memcpy( message.messageData, &event, sizeof(event) );
-        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size);
-    }
+        IPC::Touch::send( *m_ipc, MsgType::TOUCH, event );
 }
 
 void EventDispatcher::sendEvent( wpe_input_keyboard_event& event )
@@ -767,7 +795,7 @@ void EventDispatcher::sendEvent( wpe_input_keyboard_event& event )
         static_assert(sizeof(message.messageData) >= sizeof(event), "messageData must be large enough to hold wpe_input_keyboard_event");
         message.messageCode = MsgType::KEYBOARD;
         memcpy( message.messageData, &event, sizeof(event) );
-        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size, IPC::Delivery::Always, IPC::Lane::Bulk);
     }
 }
 
@@ -779,13 +807,14 @@ void EventDispatcher::sendEvent( wpe_input_touch_event_raw& event )
         static_assert(sizeof(message.messageData) >= sizeof(event), "messageData must be large enough to hold wpe_input_touch_event_raw");
         message.messageCode = MsgType::TOUCHSIMPLE;
         memcpy( message.messageData, &event, sizeof(event) );
-        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size);
+        m_ipc->sendMessage(IPC::Message::data(message), IPC::Message::size, IPC::Delivery::Always, IPC::Lane::Bulk);
     }
 }
 
 void EventDispatcher::setIPC( IPC::Client& ipcClient )
 {
     m_ipc = &ipcClient;
+    m_ipc->setMergeFunction(mergeInputMessages);
 }
 
 } // namespace Wayland
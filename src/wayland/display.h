@@ -46,6 +46,7 @@ struct wl_registry;
 struct wl_seat;
 struct wl_surface;
 struct wl_touch;
+struct wp_presentation;
 struct xdg_shell;
 struct wl_shell;
 
@@ -53,6 +54,8 @@ typedef struct _GSource GSource;
 
 namespace Wayland {
 
+class Presentation;
+
 class EventDispatcher
 {
 public:
@@ -71,6 +74,7 @@ public:
 	TOUCHSIMPLE,
 	KEYBOARD
     };
+
 private:
     EventDispatcher() {};
     ~EventDispatcher() {};
@@ -93,9 +97,13 @@ public:
         struct wl_seat* seat;
         struct xdg_shell* xdg;
         struct wl_shell* shell;
+        struct wp_presentation* presentation;
     };
     const Interfaces& interfaces() const { return m_interfaces; }
 
+    // Null unless the compositor supports wp_presentation.
+    Presentation* presentation() const { return m_presentation; }
+
     struct SeatData {
         std::unordered_map<struct wl_surface*, struct wpe_view_backend*> inputClients;
 
@@ -145,6 +153,7 @@ private:
     Interfaces m_interfaces;
 
     SeatData m_seatData;
+    Presentation* m_presentation { nullptr };
 
     GSource* m_eventSource;
 };
@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "presentation.h"
+
+#include "presentation-time-client-protocol.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <time.h>
+
+namespace Wayland {
+
+const size_t Presentation::windowSize;
+
+Presentation::Presentation(struct wp_presentation* presentation)
+    : m_presentation(presentation)
+    , m_clockId(CLOCK_MONOTONIC)
+{
+    wp_presentation_add_listener(m_presentation, &s_listener, this);
+
+    if (const char* interval = std::getenv("WPE_PRESENTATION_STATISTICS"))
+        m_reportInterval = std::strtoul(interval, nullptr, 10);
+}
+
+Presentation::~Presentation()
+{
+    for (auto* request : m_requests) {
+        wp_presentation_feedback_destroy(request->feedback);
+        delete request;
+    }
+    wp_presentation_destroy(m_presentation);
+}
+
+void Presentation::requestFeedback(struct wl_surface* surface, Callback callback, void* data)
+{
+    auto* request = new Request { this, wp_presentation_feedback(m_presentation, surface), callback, data, now() };
+    wp_presentation_feedback_add_listener(request->feedback, &s_feedbackListener, request);
+    m_requests.push_back(request);
+}
+
+void Presentation::cancelFeedback(void* data)
+{
+    auto end = std::remove_if(m_requests.begin(), m_requests.end(),
+        [data](Request* request)
+        {
+            if (request->data != data)
+                return false;
+            wp_presentation_feedback_destroy(request->feedback);
+            delete request;
+            return true;
+        });
+    m_requests.erase(end, m_requests.end());
+}
+
+void Presentation::report() const
+{
+    fprintf(stderr, "Wayland::Presentation: %llu presented, %llu discarded, %llu vsynced, %llu zero-copy, %llu missed vblanks, "
+        "frame time %.2f ms average, %.2f ms max, refresh %.2f ms\n",
+        static_cast<unsigned long long>(m_statistics.presented), static_cast<unsigned long long>(m_statistics.discarded),
+        static_cast<unsigned long long>(m_statistics.vsynced), static_cast<unsigned long long>(m_statistics.zeroCopy),
+        static_cast<unsigned long long>(m_statistics.missedVblanks),
+        m_statistics.averageFrameTime / 1e6, m_statistics.maxFrameTime / 1e6, m_statistics.refresh / 1e6);
+}
+
+uint64_t Presentation::now() const
+{
+    struct timespec time;
+    if (clock_gettime(m_clockId, &time))
+        return 0;
+    return uint64_t(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+void Presentation::complete(Request* request, const Feedback& feedback)
+{
+    m_requests.erase(std::find(m_requests.begin(), m_requests.end(), request));
+    wp_presentation_feedback_destroy(request->feedback);
+
+    record(*request, feedback);
+    if (feedback.presented && m_reportInterval && !(m_statistics.presented % m_reportInterval))
+        report();
+    if (request->callback)
+        request->callback(request->data, feedback);
+    delete request;
+}
+
+void Presentation::record(const Request& request, const Feedback& feedback)
+{
+    if (!feedback.presented) {
+        ++m_statistics.discarded;
+        return;
+    }
+
+    ++m_statistics.presented;
+    if (feedback.flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC)
+        ++m_statistics.vsynced;
+    if (feedback.flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY)
+        ++m_statistics.zeroCopy;
+    if (feedback.refresh)
+        m_statistics.refresh = feedback.refresh;
+
+    uint64_t last = m_lastPresentation;
+    m_lastPresentation = std::max(last, feedback.timestamp);
+    if (!last || feedback.timestamp <= last)
+        return;
+
+    uint64_t refresh = m_statistics.refresh;
+    if (refresh) {
+        // The frame could have been shown on the first refresh after it was
+        // committed, and that after the previous one.
+        uint64_t expected = last + refresh;
+        if (request.commitTime > last)
+            expected = last + (request.commitTime - last + refresh - 1) / refresh * refresh;
+        if (feedback.timestamp > expected)
+            m_statistics.missedVblanks += (feedback.timestamp - expected + refresh / 2) / refresh;
+
+        // Idle time between frames is no frame time.
+        if (request.commitTime >= last + refresh)
+            return;
+    }
+
+    m_frameTimes[m_frameTimeIndex] = feedback.timestamp - last;
+    m_frameTimeIndex = (m_frameTimeIndex + 1) % windowSize;
+    m_frameTimeCount = std::min(m_frameTimeCount + 1, windowSize);
+
+    uint64_t sum = 0;
+    uint64_t max = 0;
+    for (size_t i = 0; i < m_frameTimeCount; ++i) {
+        sum += m_frameTimes[i];
+        max = std::max(max, m_frameTimes[i]);
+    }
+    m_statistics.averageFrameTime = sum / m_frameTimeCount;
+    m_statistics.maxFrameTime = max;
+}
+
+const struct wp_presentation_listener Presentation::s_listener = {
+    // clock_id
+    [](void* data, struct wp_presentation*, uint32_t clockId)
+    {
+        static_cast<Presentation*>(data)->m_clockId = clockId;
+    },
+};
+
+const struct wp_presentation_feedback_listener Presentation::s_feedbackListener = {
+    // sync_output
+    [](void*, struct wp_presentation_feedback*, struct wl_output*) { },
+    // presented
+    [](void* data, struct wp_presentation_feedback*, uint32_t secondsHigh, uint32_t secondsLow, uint32_t nanoseconds,
+        uint32_t refresh, uint32_t sequenceHigh, uint32_t sequenceLow, uint32_t flags)
+    {
+        auto* request = static_cast<Request*>(data);
+        uint64_t seconds = (uint64_t(secondsHigh) << 32) | secondsLow;
+        Feedback feedback { true, seconds * 1000000000 + nanoseconds, refresh, (uint64_t(sequenceHigh) << 32) | sequenceLow, flags };
+        request->presentation->complete(request, feedback);
+    },
+    // discarded
+    [](void* data, struct wp_presentation_feedback*)
+    {
+        auto* request = static_cast<Request*>(data);
+        request->presentation->complete(request, Feedback { false, 0, 0, 0, 0 });
+    },
+};
+
+} // namespace Wayland
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef wpe_view_backend_wayland_presentation_h
+#define wpe_view_backend_wayland_presentation_h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+struct wl_surface;
+struct wp_presentation;
+struct wp_presentation_feedback;
+struct wp_presentation_feedback_listener;
+struct wp_presentation_listener;
+
+namespace Wayland {
+
+// Asks wp_presentation when committed frames actually reached the screen and
+// keeps statistics over the most recent ones.
+class Presentation {
+public:
+    struct Feedback {
+        bool presented;
+        // In nanoseconds of the compositor's presentation clock.
+        uint64_t timestamp;
+        // Nanoseconds until the next refresh, 0 if unknown.
+        uint32_t refresh;
+        uint64_t sequence;
+        // wp_presentation_feedback_kind bits.
+        uint32_t flags;
+    };
+
+    // Frame times are the intervals between consecutive presentations while
+    // frames were committed back to back, in nanoseconds over the last
+    // windowSize frames. A missed vblank is a refresh that passed between a
+    // commit and its presentation without showing it.
+    struct Statistics {
+        uint64_t presented;
+        uint64_t discarded;
+        uint64_t vsynced;
+        uint64_t zeroCopy;
+        uint64_t missedVblanks;
+        uint64_t averageFrameTime;
+        uint64_t maxFrameTime;
+        uint32_t refresh;
+    };
+
+    using Callback = void (*)(void*, const Feedback&);
+
+    static const size_t windowSize = 120;
+
+    // Takes ownership of the global.
+    explicit Presentation(struct wp_presentation*);
+    ~Presentation();
+
+    // Feedback on the next commit of the surface, the callback runs once it
+    // was presented or discarded.
+    void requestFeedback(struct wl_surface*, Callback, void*);
+    // Drops the requests made with the data, their callbacks never run.
+    void cancelFeedback(void*);
+
+    const Statistics& statistics() const { return m_statistics; }
+    // Prints the statistics to stderr. Also done every that many presented
+    // frames with WPE_PRESENTATION_STATISTICS set.
+    void report() const;
+
+private:
+    struct Request {
+        Presentation* presentation;
+        struct wp_presentation_feedback* feedback;
+        Callback callback;
+        void* data;
+        uint64_t commitTime;
+    };
+
+    static const struct wp_presentation_listener s_listener;
+    static const struct wp_presentation_feedback_listener s_feedbackListener;
+
+    uint64_t now() const;
+    void complete(Request*, const Feedback&);
+    void record(const Request&, const Feedback&);
+
+    struct wp_presentation* m_presentation;
+    uint32_t m_clockId;
+    std::vector<Request*> m_requests;
+    unsigned long m_reportInterval { 0 };
+
+    uint64_t m_lastPresentation { 0 };
+    uint64_t m_frameTimes[windowSize] { };
+    size_t m_frameTimeCount { 0 };
+    size_t m_frameTimeIndex { 0 };
+    Statistics m_statistics { 0, 0, 0, 0, 0, 0, 0, 0 };
+};
+
+} // namespace Wayland
+
+#endif // wpe_view_backend_wayland_presentation_h
@@ -29,9 +29,14 @@
 
 #include <wpe/wpe-egl.h>
 
+#include "ipc-frame-pipeline.h"
+#include "presentation.h"
+#include "presentation-time-client-protocol.h"
 #include <stdio.h>
+#include <algorithm>
 #include <cstring>
 #include <glib.h>
+#include <vector>
 #include <wayland-client.h>
 #include <wayland-egl.h>
 
@@ -185,6 +190,8 @@ public:
 
     struct wl_display* display() const { return m_display; }
     struct wl_compositor* compositor() const { return m_compositor; }
+    // Null unless the compositor supports wp_presentation.
+    Wayland::Presentation* presentation() const { return m_presentation; }
 
     void initialize();
 
@@ -194,6 +201,7 @@ private:
     struct wl_display* m_display { nullptr };
     struct wl_registry* m_registry { nullptr };
     struct wl_compositor* m_compositor { nullptr };
+    Wayland::Presentation* m_presentation { nullptr };
     GSource* m_eventSource { nullptr };
 };
 
@@ -215,6 +223,7 @@ Backend::~Backend()
 
     if (m_compositor)
         wl_compositor_destroy(m_compositor);
+    delete m_presentation;
     if (m_registry)
         wl_registry_destroy(m_registry);
     if (m_display)
@@ -250,6 +259,9 @@ struct wl_registry_listener Backend::s_registryListener = {
 
         if (!std::strcmp(interface, "wl_compositor"))
             backend.m_compositor = static_cast<struct wl_compositor*>(wl_registry_bind(registry, name, &wl_compositor_interface, 1));
+
+        if (!std::strcmp(interface, "wp_presentation") && !backend.m_presentation)
+            backend.m_presentation = new Wayland::Presentation(static_cast<struct wp_presentation*>(wl_registry_bind(registry, name, &wp_presentation_interface, 1)));
     },
     // global_remove
     [](void*, struct wl_registry*, uint32_t)
@@ -273,13 +285,22 @@ public:
     void frameRendered();
 
 private:
+    void frameDisplayed(struct wl_callback*);
+    void frameComplete();
+
     static const struct wl_callback_listener s_frameListener;
 
     struct wpe_renderer_backend_egl_target* m_target;
 
-    const Backend* m_backend;
-    struct wl_surface* m_surface;
-    struct wl_egl_window* m_window;
+    const Backend* m_backend { nullptr };
+    struct wl_surface* m_surface { nullptr };
+    struct wl_egl_window* m_window { nullptr };
+
+    // A frame callback counts as the frame having been displayed, up to the
+    // pipeline depth frames complete before that.
+    std::vector<struct wl_callback*> m_frameCallbacks;
+    IPC::FramePipeline m_framePipeline;
+    GSource* m_frameCompleteSource { nullptr };
 };
 
 EGLTarget::EGLTarget(struct wpe_renderer_backend_egl_target* target)
@@ -289,6 +310,14 @@ EGLTarget::EGLTarget(struct wpe_renderer_backend_egl_target* target)
 
 EGLTarget::~EGLTarget()
 {
+    if (m_backend && m_backend->presentation())
+        m_backend->presentation()->cancelFeedback(this);
+    for (auto* callback : m_frameCallbacks)
+        wl_callback_destroy(callback);
+    if (m_frameCompleteSource) {
+        g_source_destroy(m_frameCompleteSource);
+        g_source_unref(m_frameCompleteSource);
+    }
     if (m_window)
         wl_egl_window_destroy(m_window);
     if (m_surface)
@@ -316,23 +345,58 @@ void EGLTarget::resize(uint32_t width, uint32_t height)
 void EGLTarget::frameWillRender()
 {
     struct wl_callback* frameCallback = wl_surface_frame(m_surface);
-    wl_callback_add_listener(frameCallback, &s_frameListener, m_target);
+    wl_callback_add_listener(frameCallback, &s_frameListener, this);
+    m_frameCallbacks.push_back(frameCallback);
+
+    // Only kept for the statistics, nothing else to report it to here.
+    if (m_backend && m_backend->presentation())
+        m_backend->presentation()->requestFeedback(m_surface, nullptr, this);
 }
 
 void EGLTarget::frameRendered()
 {
     if (m_backend && m_backend->display())
         wl_display_flush(m_backend->display());
+
+    if (!m_framePipeline.commit() || m_frameCompleteSource)
+        return;
+
+    // Not from within frame_rendered, like the callback would.
+    m_frameCompleteSource = g_timeout_source_new(0);
+    g_source_set_callback(m_frameCompleteSource,
+        [](gpointer data) -> gboolean
+        {
+            static_cast<EGLTarget*>(data)->frameComplete();
+            return G_SOURCE_REMOVE;
+        }, this, nullptr);
+    g_source_attach(m_frameCompleteSource, g_main_context_get_thread_default());
+}
+
+void EGLTarget::frameDisplayed(struct wl_callback* callback)
+{
+    m_frameCallbacks.erase(std::find(m_frameCallbacks.begin(), m_frameCallbacks.end(), callback));
+    wl_callback_destroy(callback);
+
+    if (m_framePipeline.displayed())
+        frameComplete();
+}
+
+void EGLTarget::frameComplete()
+{
+    if (m_frameCompleteSource) {
+        g_source_destroy(m_frameCompleteSource);
+        g_source_unref(m_frameCompleteSource);
+    }
+    m_frameCompleteSource = nullptr;
+
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(m_target);
 }
 
 const struct wl_callback_listener EGLTarget::s_frameListener = {
     // frame
     [](void* data, struct wl_callback* callback, uint32_t)
     {
-        wl_callback_destroy(callback);
-
-        auto* target = static_cast<struct wpe_renderer_backend_egl_target*>(data);
-        wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
+        static_cast<EGLTarget*>(data)->frameDisplayed(callback);
     },
 };
 
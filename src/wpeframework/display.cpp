@@ -25,6 +25,7 @@
  */
 
 #include "display.h"
+#include "ipc-touch.h"
 #include <cstring>
 
 namespace WPEFramework {
@@ -160,6 +161,23 @@ void KeyboardHandler::HandleKeyEvent(const uint32_t key, const IKeyboard::state
     }
 }
 
+// See src/wayland, axis events that were not written yet add up.
+static bool mergeInputMessages(IPC::Message& queued, const IPC::Message& newer)
+{
+    if (newer.messageCode != Display::MsgType::AXIS)
+        return false;
+
+    auto& queuedEvent = *reinterpret_cast<wpe_input_axis_event*>(queued.messageData);
+    auto& newerEvent = *reinterpret_cast<const wpe_input_axis_event*>(newer.messageData);
+    if (queuedEvent.type != newerEvent.type || queuedEvent.axis != newerEvent.axis || queuedEvent.modifiers != newerEvent.modifiers)
+        return false;
+
+    int32_t value = queuedEvent.value + newerEvent.value;
+    queuedEvent = newerEvent;
+    queuedEvent.value = value;
+    return true;
+}
+
 // -----------------------------------------------------------------------------------------
 // Display wrapper around the wayland abstraction class
 // -----------------------------------------------------------------------------------------
@@ -170,6 +188,8 @@ Display::Display(IPC::Client& ipc, const std::string& name)
     , m_backend(nullptr)
     , m_display(Compositor::IDisplay::Instance(name))
 {
+    m_ipc.setMergeFunction(mergeInputMessages);
+
     int descriptor = m_display->FileDescriptor();
     EventSource* source(reinterpret_cast<EventSource*>(m_eventSource));
 
@@ -209,7 +229,7 @@ Display::~Display()
     IPC::Message message;
     message.messageCode = MsgType::KEYBOARD;
     std::memcpy(message.messageData, &event, sizeof(event));
-    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size, IPC::Delivery::Always, IPC::Lane::Bulk);
 }
 
 /* virtual */ void Display::Key(const bool pressed, uint32_t keycode, uint32_t hardware_keycode, uint32_t modifiers, uint32_t time)
@@ -219,7 +239,7 @@ Display::~Display()
     IPC::Message message;
     message.messageCode = MsgType::KEYBOARD;
     std::memcpy(message.messageData, &event, sizeof(event));
-    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size, IPC::Delivery::Always, IPC::Lane::Bulk);
     // TODO: this is not needed but it was done in the wayland-egl code, lets remove this later.
     // wpe_view_backend_dispatch_keyboard_event(m_backend, &event);
 }
@@ -229,7 +249,7 @@ void Display::SendEvent(wpe_input_axis_event& event)
     IPC::Message message;
     message.messageCode = MsgType::AXIS;
     std::memcpy(message.messageData, &event, sizeof(event));
-    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size, IPC::Delivery::Mergeable, IPC::Lane::Bulk);
 }
 
 void Display::SendEvent(wpe_input_pointer_event& event)
@@ -237,15 +257,13 @@ void Display::SendEvent(wpe_input_pointer_event& event)
     IPC::Message message;
     message.messageCode = MsgType::POINTER;
     std::memcpy(message.messageData, &event, sizeof(event));
-    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    auto delivery = event.type == wpe_input_pointer_event_type_motion ? IPC::Delivery::Supersedable : IPC::Delivery::Always;
+    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size, delivery, IPC::Lane::Bulk);
 }
 
 void Display::SendEvent(wpe_input_touch_event& event)
 {
-    IPC::Message message;
-    message.messageCode = MsgType::TOUCH;
-    std::memcpy(message.messageData, &event, sizeof(event));
-    m_ipc.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    IPC::Touch::send(m_ipc, MsgType::TOUCH, event);
 }
 
 /* If we have pointer and or touch support in the abstraction layer, link it through like here 
@@ -44,6 +44,8 @@ struct EGLTarget : public IPC::Client::Handler {
     // IPC::Client::Handler
     void handleMessage(char* data, size_t size) override;
 
+    void handleFrameComplete(const IPC::FrameComplete&);
+
     struct wpe_renderer_backend_egl_target* target;
     IPC::Client ipcClient;
 
@@ -96,19 +98,18 @@ EGLTarget::~EGLTarget()
 
 void EGLTarget::handleMessage(char* data, size_t size)
 {
-    if (size == IPC::Message::size)
-    {
-        auto& message = IPC::Message::cast(data);
-        switch (message.messageCode) {
-        case IPC::FrameComplete::code:
-        {
-            wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
-            break;
-        }
-        default:
-            fprintf(stderr, "EGLTarget: unhandled message\n");
-        }
-    };
+    if (size != IPC::Message::size)
+        return;
+
+    using Dispatcher = IPC::Schema::Dispatcher<EGLTarget,
+        IPC::Schema::Handler<IPC::FrameComplete, EGLTarget, &EGLTarget::handleFrameComplete>>;
+    if (!Dispatcher::dispatch(*this, data, size))
+        fprintf(stderr, "EGLTarget: unhandled message\n");
+}
+
+void EGLTarget::handleFrameComplete(const IPC::FrameComplete&)
+{
+    wpe_renderer_backend_egl_target_dispatch_frame_complete(target);
 }
 
 } // namespace WPEFramework
@@ -172,6 +173,7 @@ struct wpe_renderer_backend_egl_target_interface wpeframework_renderer_backend_e
         IPC::Message message;
         IPC::BufferCommit::construct(message);
         target.ipcClient.sendMessage(IPC::Message::data(message), IPC::Message::size);
+        target.ipcClient.busyPoll(IPC::FrameComplete::code);
     },
 };
 
@@ -30,6 +30,8 @@
 #include "display.h"
 #include "ipc.h"
 #include "ipc-buffer.h"
+#include "ipc-touch.h"
+#include <unistd.h>
 
 #define WIDTH 1280
 #define HEIGHT 720
@@ -41,10 +43,10 @@ struct ViewBackend : public IPC::Host::Handler {
     virtual ~ViewBackend();
 
     // IPC::Host::Handler
-    void handleFd(int) override { };
+    void handleFd(int fd) override { close(fd); };
     void handleMessage(char*, size_t) override;
 
-    void ackBufferCommit();
+    void ackBufferCommit(const IPC::BufferCommit&);
     void initialize();
 
     struct wpe_view_backend* backend;
@@ -64,9 +66,24 @@ ViewBackend::~ViewBackend()
 
 void ViewBackend::handleMessage(char* data, size_t size)
 {
+    auto& messageCode = *reinterpret_cast<uint32_t*>(data);
+    if (messageCode == Display::MsgType::TOUCH) {
+        struct wpe_input_touch_event event;
+        if (!IPC::Touch::decode(IPC::Frame::payload(data), IPC::Frame::payloadSize(size), event))
+            return;
+
+        wpe_view_backend_dispatch_touch_event(backend, &event);
+        return;
+    }
+
     if (size != IPC::Message::size)
         return;
 
+    using Dispatcher = IPC::Schema::Dispatcher<ViewBackend,
+        IPC::Schema::Handler<IPC::BufferCommit, ViewBackend, &ViewBackend::ackBufferCommit>>;
+    if (Dispatcher::dispatch(*this, data, size))
+        return;
+
     auto& message = IPC::Message::cast(data);
     switch (message.messageCode) {
     case Display::MsgType::AXIS:
@@ -81,23 +98,12 @@ void ViewBackend::handleMessage(char* data, size_t size)
         wpe_view_backend_dispatch_pointer_event(backend, event);
         break;
     }
-    case Display::MsgType::TOUCH:
-    {
-        struct wpe_input_touch_event * event = reinterpret_cast<wpe_input_touch_event*>(std::addressof(message.messageData));
-        wpe_view_backend_dispatch_touch_event(backend, event);
-        break;
-    }
     case Display::MsgType::KEYBOARD:
     {
         struct wpe_input_keyboard_event * event = reinterpret_cast<wpe_input_keyboard_event*>(std::addressof(message.messageData));
         wpe_view_backend_dispatch_keyboard_event(backend, event);
         break;
     }
-    case IPC::BufferCommit::code:
-    {
-        ackBufferCommit();
-        break;
-    }
     default:
         fprintf(stderr, "ViewBackend: unhandled message\n");
     }
@@ -119,7 +125,7 @@ void ViewBackend::initialize()
     wpe_view_backend_dispatch_set_size( backend, width, height);
 }
 
-void ViewBackend::ackBufferCommit()
+void ViewBackend::ackBufferCommit(const IPC::BufferCommit&)
 {
     IPC::Message message;
     IPC::FrameComplete::construct(message);
@@ -0,0 +1,579 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Measures the IPC channel between a Host and a Client running on two threads
+// with their own main contexts, the way the UI and web processes do.
+//
+//   ipc-bench [--mode=stream|seqpacket|ring|loopback|multiplex|iothread|uring|pipeline|all]
+//             [--messages=N] [--burst=N] [--payload=BYTES]
+//             [--round-trips=N] [--fd-round-trips=N]
+//             [--frames=N] [--render=US] [--display-latency=US] [--refresh=US]
+//
+// The uring mode is only there when built with USE_IPC_IO_URING.
+//
+// Latency is the time between the client sending a BufferCommit style
+// message and receiving the FrameComplete the host answers it with, once
+// with plain messages and once with a descriptor attached to every commit.
+// Throughput is measured with bursts of messages from the host, each burst
+// acknowledged by the client. Payloads that do not fit in a Message are sent
+// as frames. With WPE_IPC_TIMESTAMPS=1 the one-way latencies the host saw are
+// listed as well.
+//
+// The pipeline mode renders frames headless for every IPC::FramePipeline
+// depth. The client takes the render time per frame, the host shows each
+// commit on the first refresh after the display latency passed, and
+// completes frames the way a view backend does. It reports the frame rate
+// against the time from commit to display.
+
+#include "ipc.h"
+#include "ipc-frame-pipeline.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum Code : uint32_t {
+    StartCommits = 1,
+    Commit,
+    FrameComplete,
+    CommitsDone,
+    Burst,
+    BurstDone,
+    Quit,
+    StartFrames,
+    FrameCommit,
+    FrameReleased,
+    FramesDone,
+};
+
+struct StartData {
+    uint32_t count;
+    uint32_t withFd;
+};
+
+struct BurstData {
+    uint32_t index;
+    uint32_t count;
+};
+
+struct FramesData {
+    uint32_t count;
+    uint32_t renderTime;
+};
+
+struct Options {
+    const char* mode { "all" };
+    size_t messages { 1000000 };
+    size_t burst { 64 };
+    size_t payload { sizeof(BurstData) };
+    size_t roundTrips { 100000 };
+    size_t fdRoundTrips { 10000 };
+    size_t frames { 240 };
+    size_t renderTime { 8000 };
+    size_t displayLatency { 25000 };
+    size_t refresh { 16667 };
+};
+
+struct Latency {
+    double p50;
+    double p99;
+    double p999;
+};
+
+static Latency latency(std::vector<double>& samples)
+{
+    if (samples.empty())
+        return Latency { 0, 0, 0 };
+
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&samples](double fraction) {
+        return samples[std::min(samples.size() - 1, static_cast<size_t>(fraction * samples.size()))];
+    };
+    return Latency { percentile(0.5), percentile(0.99), percentile(0.999) };
+}
+
+// Messages and frames both start with the code, followed by the payload.
+template<typename Endpoint>
+static void sendPayload(Endpoint& endpoint, uint32_t code, const std::vector<uint8_t>& payload)
+{
+    if (payload.size() > IPC::Message::dataSize) {
+        endpoint.sendFrame(code, payload.data(), payload.size());
+        return;
+    }
+
+    IPC::Message message;
+    message.messageCode = code;
+    memcpy(message.messageData, payload.data(), payload.size());
+    endpoint.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+static void sendCode(IPC::Host& host, uint32_t code, const void* data, size_t size)
+{
+    IPC::Message message;
+    message.messageCode = code;
+    if (size)
+        memcpy(message.messageData, data, size);
+    host.sendMessage(IPC::Message::data(message), IPC::Message::size);
+}
+
+struct ClientSide : public IPC::Client::Handler {
+    void handleMessage(char* data, size_t size) override
+    {
+        if (size < sizeof(uint32_t) + sizeof(BurstData))
+            return;
+
+        uint32_t code = *reinterpret_cast<uint32_t*>(data);
+        char* payload = IPC::Frame::payload(data);
+        switch (code) {
+        case StartCommits:
+        {
+            auto& start = *reinterpret_cast<StartData*>(payload);
+            commitTarget = start.count;
+            withFd = start.withFd;
+            roundTrips.clear();
+            roundTrips.reserve(commitTarget);
+            sendCommit();
+            break;
+        }
+        case FrameComplete:
+            roundTrips.push_back(std::chrono::duration<double, std::micro>(Clock::now() - committedAt).count());
+            if (roundTrips.size() < commitTarget)
+                sendCommit();
+            else {
+                IPC::Message message;
+                message.messageCode = CommitsDone;
+                client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            }
+            break;
+        case Burst:
+        {
+            auto& burst = *reinterpret_cast<BurstData*>(payload);
+            if (burst.index + 1 == burst.count) {
+                IPC::Message message;
+                message.messageCode = BurstDone;
+                client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            }
+            break;
+        }
+        case StartFrames:
+        {
+            auto& start = *reinterpret_cast<FramesData*>(payload);
+            frameTarget = start.count;
+            renderTime = start.renderTime;
+            framesCommitted = framesReleased = 0;
+            renderFrame();
+            break;
+        }
+        case FrameReleased:
+            ++framesReleased;
+            if (framesCommitted < frameTarget)
+                renderFrame();
+            else if (framesReleased == frameTarget) {
+                IPC::Message message;
+                message.messageCode = FramesDone;
+                client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            }
+            break;
+        case Quit:
+            g_main_loop_quit(loop);
+            break;
+        default:
+            break;
+        }
+    }
+
+    // Stands in for the GPU work of a frame, the main loop is as busy
+    // meanwhile as a web process that renders.
+    void renderFrame()
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(renderTime));
+
+        auto now = Clock::now();
+        if (!framesCommitted)
+            firstFrameAt = now;
+        lastFrameAt = now;
+        ++framesCommitted;
+
+        IPC::Message message;
+        message.messageCode = FrameCommit;
+        client.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
+
+    void sendCommit()
+    {
+        committedAt = Clock::now();
+        if (withFd)
+            client.sendMessageWithFds(Commit, payload.data(), payload.size(), &bufferFd, 1);
+        else
+            sendPayload(client, Commit, payload);
+    }
+
+    IPC::Client client;
+    GMainLoop* loop { nullptr };
+    std::vector<uint8_t> payload;
+    int bufferFd { -1 };
+
+    Clock::time_point committedAt;
+    std::vector<double> roundTrips;
+    size_t commitTarget { 0 };
+    bool withFd { false };
+
+    size_t frameTarget { 0 };
+    size_t renderTime { 0 };
+    size_t framesCommitted { 0 };
+    size_t framesReleased { 0 };
+    Clock::time_point firstFrameAt;
+    Clock::time_point lastFrameAt;
+};
+
+static void runClient(ClientSide* side, int fd)
+{
+    GMainContext* context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+
+    side->loop = g_main_loop_new(context, FALSE);
+    side->client.initialize(*side, fd);
+    g_main_loop_run(side->loop);
+    side->client.deinitialize();
+    g_main_loop_unref(side->loop);
+
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+}
+
+struct HostSide : public IPC::Host::Handler {
+    void handleFd(int fd) override
+    {
+        close(fd);
+    }
+
+    // Descriptors of the commits are closed by the default
+    // handleMessageWithFds(), as a real backend would after importing them.
+    void handleMessage(char* data, size_t size) override
+    {
+        if (size < sizeof(uint32_t))
+            return;
+
+        switch (*reinterpret_cast<uint32_t*>(data)) {
+        case Commit:
+        {
+            IPC::Message message;
+            message.messageCode = FrameComplete;
+            host.sendMessage(IPC::Message::data(message), IPC::Message::size);
+            break;
+        }
+        case CommitsDone:
+            g_main_loop_quit(loop);
+            break;
+        case BurstDone:
+            if (sent < messageTarget)
+                sendBurst();
+            else
+                g_main_loop_quit(loop);
+            break;
+        case FrameCommit:
+            commitFrame();
+            break;
+        case FramesDone:
+            framesDone = true;
+            if (!pendingDisplays)
+                g_main_loop_quit(loop);
+            break;
+        default:
+            break;
+        }
+    }
+
+    void runFrames(unsigned depth, const Options& options)
+    {
+        pipeline = IPC::FramePipeline(depth);
+        refresh = options.refresh;
+        displayLatency = options.displayLatency;
+        vblankOrigin = g_get_monotonic_time();
+        lastDisplay = 0;
+        framesDone = false;
+        displayLatencies.clear();
+
+        FramesData start { static_cast<uint32_t>(options.frames), static_cast<uint32_t>(options.renderTime) };
+        sendCode(host, StartFrames, &start, sizeof(start));
+        g_main_loop_run(loop);
+    }
+
+    void commitFrame()
+    {
+        gint64 now = g_get_monotonic_time();
+        if (pipeline.commit())
+            sendCode(host, FrameReleased, nullptr, 0);
+
+        // One frame per refresh, the first one after the display latency.
+        gint64 ready = now + displayLatency;
+        gint64 displayAt = vblankOrigin + (ready - vblankOrigin + refresh - 1) / refresh * refresh;
+        displayAt = std::max(displayAt, lastDisplay + refresh);
+        lastDisplay = displayAt;
+
+        struct Display {
+            HostSide* host;
+            gint64 committedAt;
+        };
+        GSource* source = g_source_new(&s_displaySourceFuncs, sizeof(GSource));
+        g_source_set_callback(source,
+            [](gpointer data) -> gboolean
+            {
+                auto& display = *static_cast<Display*>(data);
+                display.host->frameDisplayed(display.committedAt);
+                return G_SOURCE_REMOVE;
+            }, new Display { this, now },
+            [](gpointer data)
+            {
+                delete static_cast<Display*>(data);
+            });
+        g_source_set_ready_time(source, displayAt);
+        g_source_attach(source, nullptr);
+        g_source_unref(source);
+        ++pendingDisplays;
+    }
+
+    void frameDisplayed(gint64 committedAt)
+    {
+        displayLatencies.push_back((g_get_monotonic_time() - committedAt) / 1e3);
+        --pendingDisplays;
+        if (pipeline.displayed())
+            sendCode(host, FrameReleased, nullptr, 0);
+        if (framesDone && !pendingDisplays)
+            g_main_loop_quit(loop);
+    }
+
+    static GSourceFuncs s_displaySourceFuncs;
+
+    void runCommits(size_t count, bool withFd)
+    {
+        StartData start { static_cast<uint32_t>(count), withFd };
+        sendCode(host, StartCommits, &start, sizeof(start));
+        g_main_loop_run(loop);
+    }
+
+    void sendBurst()
+    {
+        auto& burst = *reinterpret_cast<BurstData*>(payload.data());
+        burst.count = std::min(burstSize, messageTarget - sent);
+        for (burst.index = 0; burst.index < burst.count; ++burst.index)
+            sendPayload(host, Burst, payload);
+        sent += burst.count;
+    }
+
+    IPC::Host host;
+    GMainLoop* loop { nullptr };
+    std::vector<uint8_t> payload;
+
+    size_t messageTarget { 0 };
+    size_t burstSize { 0 };
+    size_t sent { 0 };
+
+    IPC::FramePipeline pipeline;
+    gint64 refresh { 0 };
+    gint64 displayLatency { 0 };
+    gint64 vblankOrigin { 0 };
+    gint64 lastDisplay { 0 };
+    size_t pendingDisplays { 0 };
+    bool framesDone { false };
+    std::vector<double> displayLatencies;
+};
+
+GSourceFuncs HostSide::s_displaySourceFuncs = {
+    nullptr, // prepare
+    nullptr, // check
+    // dispatch
+    [](GSource*, GSourceFunc callback, gpointer data) -> gboolean
+    {
+        return callback(data);
+    },
+    nullptr, // finalize
+    nullptr, // closure_callback
+    nullptr, // closure_marshall
+};
+
+static void configureTransport(const char* mode)
+{
+    setenv("WPE_IPC_SEQPACKET", !strcmp(mode, "seqpacket") ? "1" : "0", 1);
+    if (!strcmp(mode, "ring"))
+        setenv("WPE_IPC_SHARED_RING", "1", 1);
+    else
+        unsetenv("WPE_IPC_SHARED_RING");
+    setenv("WPE_IPC_IO_URING", !strcmp(mode, "uring") ? "1" : "0", 1);
+    setenv("WPE_IPC_LOOPBACK", !strcmp(mode, "loopback") ? "1" : "0", 1);
+    setenv("WPE_IPC_MULTIPLEX", !strcmp(mode, "multiplex") ? "1" : "0", 1);
+    setenv("WPE_IPC_IO_THREAD", !strcmp(mode, "iothread") ? "1" : "0", 1);
+}
+
+static void runMode(const char* mode, const Options& options)
+{
+    configureTransport(mode);
+
+    HostSide host;
+    host.loop = g_main_loop_new(nullptr, FALSE);
+    host.payload.assign(options.payload, 0);
+    host.host.initialize(host);
+
+    ClientSide client;
+    client.payload.assign(options.payload, 0);
+    client.bufferFd = eventfd(0, EFD_CLOEXEC);
+    std::thread thread(runClient, &client, host.host.releaseClientFD());
+
+    // Warm up, which also lets the shared ring handshake settle.
+    host.runCommits(1000, false);
+
+    // The client is idle between runs, its samples can be read from here.
+    host.runCommits(options.roundTrips, false);
+    Latency commit = latency(client.roundTrips);
+    host.runCommits(options.fdRoundTrips, true);
+    Latency fd = latency(client.roundTrips);
+
+    host.messageTarget = options.messages;
+    host.burstSize = options.burst;
+    auto start = Clock::now();
+    host.sendBurst();
+    g_main_loop_run(host.loop);
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    auto statistics = host.host.sendStatistics();
+    IPC::LatencyStatistics latencies[8];
+    size_t latencyCount = host.host.latencyStatistics(latencies, 8);
+    uint64_t lost = host.host.lostMessages();
+
+    sendCode(host.host, Quit, nullptr, 0);
+    thread.join();
+    close(client.bufferFd);
+
+    host.host.deinitialize();
+    g_main_loop_unref(host.loop);
+
+    printf("%-10s %12.0f msgs/s %10.1f MB/s   payload %zu bytes, bursts of %zu\n", mode,
+        options.messages / seconds, options.messages * options.payload / seconds / 1e6, options.payload, options.burst);
+    printf("%-10s commit rtt     p50 %8.2f us   p99 %8.2f us   p99.9 %8.2f us\n", "", commit.p50, commit.p99, commit.p999);
+    printf("%-10s commit+fd rtt  p50 %8.2f us   p99 %8.2f us   p99.9 %8.2f us   fd cost %+.2f us\n", "",
+        fd.p50, fd.p99, fd.p999, fd.p50 - commit.p50);
+    printf("%-10s queued %llu   dropped %llu   flushed %llu   merged %llu\n", "",
+        static_cast<unsigned long long>(statistics.queued), static_cast<unsigned long long>(statistics.dropped),
+        static_cast<unsigned long long>(statistics.flushed), static_cast<unsigned long long>(statistics.merged));
+
+    // Only there when running with WPE_IPC_TIMESTAMPS=1.
+    for (size_t i = 0; i < latencyCount; ++i) {
+        printf("%-10s code %u one-way p50 %8.2f us   p99 %8.2f us   p99.9 %8.2f us   max %8.2f us   (%llu)\n", "",
+            latencies[i].messageCode, latencies[i].p50 / 1e3, latencies[i].p99 / 1e3, latencies[i].p999 / 1e3,
+            latencies[i].max / 1e3, static_cast<unsigned long long>(latencies[i].count));
+    }
+    if (latencyCount)
+        printf("%-10s lost %llu\n", "", static_cast<unsigned long long>(lost));
+}
+
+// Over the plain socket, the transport hardly matters at frame rates.
+static void runPipeline(const Options& options)
+{
+    configureTransport("stream");
+
+    HostSide host;
+    host.loop = g_main_loop_new(nullptr, FALSE);
+    host.host.initialize(host);
+
+    ClientSide client;
+    std::thread thread(runClient, &client, host.host.releaseClientFD());
+
+    printf("%-10s render %zu us   display latency %zu us   refresh %zu us   %zu frames\n", "pipeline",
+        options.renderTime, options.displayLatency, options.refresh, options.frames);
+    for (unsigned depth = 1; depth <= IPC::FramePipeline::maxDepth; ++depth) {
+        host.runFrames(depth, options);
+
+        double seconds = std::chrono::duration<double>(client.lastFrameAt - client.firstFrameAt).count();
+        double fps = seconds > 0 ? (client.framesCommitted - 1) / seconds : 0;
+        Latency display = latency(host.displayLatencies);
+        printf("%-10s depth %u %8.1f fps   commit->display p50 %8.2f ms   p99 %8.2f ms\n", "",
+            depth, fps, display.p50, display.p99);
+    }
+
+    sendCode(host.host, Quit, nullptr, 0);
+    thread.join();
+
+    host.host.deinitialize();
+    g_main_loop_unref(host.loop);
+}
+
+static bool parseSize(const char* argument, const char* name, size_t& value)
+{
+    size_t length = strlen(name);
+    if (strncmp(argument, name, length) || argument[length] != '=')
+        return false;
+    value = std::max<unsigned long>(1, strtoul(argument + length + 1, nullptr, 10));
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "--mode=", 7))
+            options.mode = argv[i] + 7;
+        else if (!parseSize(argv[i], "--messages", options.messages)
+            && !parseSize(argv[i], "--burst", options.burst)
+            && !parseSize(argv[i], "--payload", options.payload)
+            && !parseSize(argv[i], "--round-trips", options.roundTrips)
+            && !parseSize(argv[i], "--fd-round-trips", options.fdRoundTrips)
+            && !parseSize(argv[i], "--frames", options.frames)
+            && !parseSize(argv[i], "--render", options.renderTime)
+            && !parseSize(argv[i], "--display-latency", options.displayLatency)
+            && !parseSize(argv[i], "--refresh", options.refresh)) {
+            fprintf(stderr, "usage: %s [--mode=stream|seqpacket|ring|loopback|multiplex|iothread|uring|pipeline|all] [--messages=N] [--burst=N]"
+                " [--payload=BYTES] [--round-trips=N] [--fd-round-trips=N]"
+                " [--frames=N] [--render=US] [--display-latency=US] [--refresh=US]\n", argv[0]);
+            return 1;
+        }
+    }
+    options.payload = std::min(std::max(options.payload, sizeof(BurstData)), size_t(IPC::Frame::maxLength));
+
+#if USE_IPC_IO_URING
+    static const char* modes[] = { "stream", "seqpacket", "ring", "loopback", "multiplex", "iothread", "uring" };
+#else
+    static const char* modes[] = { "stream", "seqpacket", "ring", "loopback", "multiplex", "iothread" };
+#endif
+    for (auto* mode : modes) {
+        if (!strcmp(options.mode, "all") || !strcmp(options.mode, mode))
+            runMode(mode, options);
+    }
+    if (!strcmp(options.mode, "all") || !strcmp(options.mode, "pipeline"))
+        runPipeline(options);
+    return 0;
+}
@@ -0,0 +1,296 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Prints a dump of the IPC flight recorder, see src/util/ipc-flight-recorder.h.
+//
+//   ipc-flight-decoder [--backend=NAME] FILE
+//
+// With a backend the message codes of its view and renderer backends, and of
+// the input events it forwards, are printed by name.
+
+#include "ipc-channel.h"
+#include "ipc-flight-recorder.h"
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+using IPC::FlightRecorder;
+
+enum class Layout {
+    None,
+    // uint32_t width, height
+    Size,
+    // uint32_t handle, width, height
+    HandleAndSize,
+    // int width, height, style behind the padding
+    SizeAndStyle,
+    // Frame header, the payload is not decoded
+    Frame,
+    Raw,
+};
+
+struct CodeName {
+    uint32_t code;
+    const char* name;
+    Layout layout;
+};
+
+static const CodeName s_internalCodes[] = {
+    { IPC::Internal::SharedRingOffer::code, "SharedRingOffer", Layout::Raw },
+    { IPC::Internal::SharedRingAccept::code, "SharedRingAccept", Layout::None },
+    { IPC::Internal::SharedRingSwitch::code, "SharedRingSwitch", Layout::None },
+    { IPC::Internal::FdTransfer::code, "FdTransfer", Layout::None },
+    { IPC::Internal::FdCarrier::code, "FdCarrier", Layout::None },
+    { IPC::Internal::LoopbackAccept::code, "LoopbackAccept", Layout::None },
+    { IPC::Internal::LoopbackSwitch::code, "LoopbackSwitch", Layout::None },
+    { IPC::Internal::MultiplexHello::code, "MultiplexHello", Layout::Raw },
+    { IPC::Internal::ChannelSelect::code, "ChannelSelect", Layout::Raw },
+    { IPC::Internal::ChannelAttach::code, "ChannelAttach", Layout::Raw },
+    { IPC::Internal::Stamp::code, "Stamp", Layout::Raw },
+};
+
+// Display::MsgType of src/wayland and src/wpeframework.
+#define WAYLAND_INPUT_CODES \
+    { 0x30, "Axis", Layout::Raw }, \
+    { 0x31, "Pointer", Layout::Raw }, \
+    { 0x32, "Touch", Layout::Frame }, \
+    { 0x33, "TouchSimple", Layout::Raw }, \
+    { 0x34, "Keyboard", Layout::Raw }
+
+static const CodeName s_bcmRPiCodes[] = {
+    { 1, "TargetConstruction", Layout::HandleAndSize },
+    { 2, "BufferCommit", Layout::HandleAndSize },
+    { 3, "FrameComplete", Layout::None },
+};
+
+static const CodeName s_bcmNexusCodes[] = {
+    { 1, "BufferCommit", Layout::Size },
+    { 2, "FrameComplete", Layout::None },
+    WAYLAND_INPUT_CODES,
+};
+
+static const CodeName s_bcmNexusWLCodes[] = {
+    { 1, "TargetConstruction", Layout::HandleAndSize },
+    { 2, "Authentication", Layout::Frame },
+    { 3, "BufferCommit", Layout::Size },
+    { 4, "FrameComplete", Layout::None },
+    WAYLAND_INPUT_CODES,
+};
+
+static const CodeName s_sizeCommitCodes[] = {
+    { 1, "BufferCommit", Layout::Size },
+    { 2, "FrameComplete", Layout::None },
+};
+
+static const CodeName s_waylandEGLCodes[] = {
+    { 1, "BufferCommit", Layout::None },
+    { 2, "FrameComplete", Layout::None },
+    WAYLAND_INPUT_CODES,
+};
+
+static const CodeName s_wpeFrameworkCodes[] = {
+    { 1, "BufferCommit", Layout::None },
+    { 2, "FrameComplete", Layout::None },
+    { 0x30, "Axis", Layout::Raw },
+    { 0x31, "Pointer", Layout::Raw },
+    { 0x32, "Touch", Layout::Frame },
+    { 0x33, "Keyboard", Layout::Raw },
+};
+
+static const CodeName s_windowsEGLCodes[] = {
+    { 1, "BufferCommit", Layout::None },
+    { 2, "FrameComplete", Layout::None },
+    { 3, "SetSizeAndStyle", Layout::SizeAndStyle },
+};
+
+#undef WAYLAND_INPUT_CODES
+
+struct Backend {
+    const char* name;
+    const CodeName* codes;
+    size_t count;
+};
+
+#define BACKEND(name, codes) { name, codes, sizeof(codes) / sizeof(codes[0]) }
+static const Backend s_backends[] = {
+    BACKEND("bcm-rpi", s_bcmRPiCodes),
+    BACKEND("bcm-nexus", s_bcmNexusCodes),
+    BACKEND("bcm-nexus-wayland", s_bcmNexusWLCodes),
+    BACKEND("intelce", s_sizeCommitCodes),
+    BACKEND("viv-imx6", s_sizeCommitCodes),
+    BACKEND("wayland-egl", s_waylandEGLCodes),
+    BACKEND("realtek-wl-egl", s_waylandEGLCodes),
+    BACKEND("wpeframework", s_wpeFrameworkCodes),
+    BACKEND("windows-egl", s_windowsEGLCodes),
+};
+#undef BACKEND
+
+static const CodeName* findCode(const CodeName* codes, size_t count, uint32_t code)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (codes[i].code == code)
+            return &codes[i];
+    }
+    return nullptr;
+}
+
+static void printRaw(const uint8_t* data, size_t length)
+{
+    // Trailing zeroes are padding most of the time.
+    while (length && !data[length - 1])
+        --length;
+    for (size_t i = 0; i < length; ++i)
+        printf(" %02x", data[i]);
+}
+
+static void printEntry(const FlightRecorder::Entry& entry, uint64_t start, const Backend* backend)
+{
+    IPC::Message message = entry.message;
+    uint32_t code = message.messageCode;
+    const uint8_t* data = message.messageData;
+
+    printf("%12.3f ms  channel %-3u %s  ", (entry.timestamp - start) / 1e6, entry.channel,
+        entry.direction == static_cast<uint8_t>(FlightRecorder::Direction::Sent) ? "send" : "recv");
+
+    if (IPC::Frame::isFrame(code)) {
+        auto& frame = *reinterpret_cast<IPC::Frame*>(&message);
+        const CodeName* name = backend ? findCode(backend->codes, backend->count, frame.messageCode) : nullptr;
+        if (!name)
+            name = findCode(s_internalCodes, sizeof(s_internalCodes) / sizeof(s_internalCodes[0]), frame.messageCode);
+        if (name)
+            printf("frame %s", name->name);
+        else
+            printf("frame 0x%x", frame.messageCode);
+        printf(" length %u fds %u\n", frame.length, frame.flags & IPC::Frame::fdCountMask);
+        return;
+    }
+
+    const CodeName* name = findCode(s_internalCodes, sizeof(s_internalCodes) / sizeof(s_internalCodes[0]), code);
+    if (!name && backend)
+        name = findCode(backend->codes, backend->count, code);
+    if (!name) {
+        printf("0x%x", code);
+        printRaw(data, IPC::Message::dataSize);
+        printf("\n");
+        return;
+    }
+
+    printf("%s", name->name);
+    uint32_t words[IPC::Message::dataSize / sizeof(uint32_t)];
+    memcpy(words, data, sizeof(words));
+    switch (name->layout) {
+    case Layout::None:
+    case Layout::Frame:
+        break;
+    case Layout::Size:
+        printf(" %ux%u", words[0], words[1]);
+        break;
+    case Layout::HandleAndSize:
+        printf(" handle %u %ux%u", words[0], words[1], words[2]);
+        break;
+    case Layout::SizeAndStyle:
+        printf(" %dx%d style %d", int32_t(words[5]), int32_t(words[6]), int32_t(words[7]));
+        break;
+    case Layout::Raw:
+        printRaw(data, IPC::Message::dataSize);
+        break;
+    }
+    printf("\n");
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    const Backend* backend = nullptr;
+    const char* path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "--backend=", 10)) {
+            for (auto& candidate : s_backends) {
+                if (!strcmp(candidate.name, argv[i] + 10))
+                    backend = &candidate;
+            }
+            if (!backend) {
+                fprintf(stderr, "unknown backend %s, one of:", argv[i] + 10);
+                for (auto& candidate : s_backends)
+                    fprintf(stderr, " %s", candidate.name);
+                fprintf(stderr, "\n");
+                return 1;
+            }
+        } else if (!path)
+            path = argv[i];
+        else {
+            path = nullptr;
+            break;
+        }
+    }
+    if (!path) {
+        fprintf(stderr, "usage: %s [--backend=NAME] FILE\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "unable to open %s\n", path);
+        return 1;
+    }
+
+    FlightRecorder::FileHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, FlightRecorder::magic, sizeof(header.magic))
+        || header.version != FlightRecorder::version || header.entrySize != sizeof(FlightRecorder::Entry)) {
+        fprintf(stderr, "%s is not a flight recorder dump this decoder understands\n", path);
+        fclose(file);
+        return 1;
+    }
+
+    std::vector<FlightRecorder::Entry> entries(header.entryCount);
+    size_t count = fread(entries.data(), sizeof(FlightRecorder::Entry), entries.size(), file);
+    fclose(file);
+    entries.resize(count);
+
+    // Entries that were being written during the dump carry no sequence.
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+        [](const FlightRecorder::Entry& entry) { return !entry.sequence; }), entries.end());
+    std::sort(entries.begin(), entries.end(),
+        [](const FlightRecorder::Entry& a, const FlightRecorder::Entry& b) {
+            return a.sequence < b.sequence;
+        });
+
+    printf("pid %u, %zu messages, dumped %.3f ms after the last one\n", header.pid, entries.size(),
+        entries.empty() ? 0 : (header.dumpTime - entries.back().timestamp) / 1e6);
+    if (entries.empty())
+        return 0;
+
+    uint64_t start = entries.front().timestamp;
+    for (auto& entry : entries)
+        printEntry(entry, start, backend);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (C) 2015, 2016 Igalia S.L.
+ * Copyright (C) 2015, 2016 Metrological
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A
+ * PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Replays a capture taken with WPE_IPC_CAPTURE against a stand-in view
+// backend, which answers every commit with a frame completion through a real
+// IPC::Host, the way the view backends do.
+//
+//   ipc-replay [--speed=X] [--channel=N] [--ack=COMMIT:COMPLETE] FILE
+//
+// --speed=1 keeps the captured timing, the default of 0 runs flat out.
+// --ack takes the message codes of the backend, e.g. 2:3 for BCMRPi, and
+// defaults to 1:2 as used by most of them.
+
+#include "ipc.h"
+#include "ipc-replay.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+struct ClientSide : public IPC::Client::Handler {
+    void handleMessage(char* data, size_t size) override
+    {
+        if (IPC::Message::cast(data).messageCode == completeCode)
+            ++completions;
+        else if (IPC::Message::cast(data).messageCode == quitCode)
+            g_main_loop_quit(loop);
+    }
+
+    static const uint32_t quitCode = 0x7ffe0000;
+
+    IPC::Client client;
+    GMainLoop* loop { nullptr };
+    uint32_t completeCode { 0 };
+    size_t completions { 0 };
+};
+
+static void runClient(ClientSide* side, int fd)
+{
+    GMainContext* context = g_main_context_new();
+    g_main_context_push_thread_default(context);
+
+    side->loop = g_main_loop_new(context, FALSE);
+    side->client.initialize(*side, fd);
+    g_main_loop_run(side->loop);
+    side->client.deinitialize();
+    g_main_loop_unref(side->loop);
+
+    g_main_context_pop_thread_default(context);
+    g_main_context_unref(context);
+}
+
+struct ViewBackend : public IPC::Host::Handler {
+    void handleFd(int fd) override
+    {
+        close(fd);
+    }
+
+    void handleMessage(char* data, size_t size) override
+    {
+        if (size < sizeof(uint32_t) || *reinterpret_cast<uint32_t*>(data) != commitCode)
+            return;
+
+        IPC::Message message;
+        message.messageCode = completeCode;
+        host.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    }
+
+    IPC::Host host;
+    uint32_t commitCode { 1 };
+    uint32_t completeCode { 2 };
+};
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    double speed = 0;
+    uint32_t channel = 0;
+    ViewBackend backend;
+    const char* path = nullptr;
+    bool usage = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strncmp(argv[i], "--speed=", 8))
+            speed = strtod(argv[i] + 8, nullptr);
+        else if (!strncmp(argv[i], "--channel=", 10))
+            channel = strtoul(argv[i] + 10, nullptr, 10);
+        else if (!strncmp(argv[i], "--ack=", 6)) {
+            char* end;
+            backend.commitCode = strtoul(argv[i] + 6, &end, 0);
+            usage |= *end != ':';
+            backend.completeCode = strtoul(end + 1, nullptr, 0);
+        } else if (!path)
+            path = argv[i];
+        else
+            usage = true;
+    }
+    if (!path || usage) {
+        fprintf(stderr, "usage: %s [--speed=X] [--channel=N] [--ack=COMMIT:COMPLETE] FILE\n", argv[0]);
+        return 1;
+    }
+
+    std::unique_ptr<IPC::Replay> replay(IPC::Replay::load(path, channel));
+    if (!replay)
+        return 1;
+    if (!replay->messageCount()) {
+        fprintf(stderr, "%s holds nothing a host received\n", path);
+        return 1;
+    }
+
+    backend.host.initialize(backend);
+    ClientSide client;
+    client.completeCode = backend.completeCode;
+    std::thread thread(runClient, &client, backend.host.releaseClientFD());
+
+    auto result = replay->run(backend, speed);
+
+    IPC::Message message;
+    message.messageCode = ClientSide::quitCode;
+    backend.host.sendMessage(IPC::Message::data(message), IPC::Message::size);
+    thread.join();
+    backend.host.deinitialize();
+
+    printf("channel %u: %llu messages in %.3f s, %.0f msgs/s, %zu frame completions delivered\n", replay->channel(),
+        static_cast<unsigned long long>(result.messages), result.seconds, result.messages / result.seconds, client.completions);
+    printf("%10s %10s %12s %10s %10s\n", "code", "count", "total ms", "mean us", "max us");
+    for (auto& entry : result.codes) {
+        // Descriptors sent on their own are listed under code 0.
+        char code[16] = "fd";
+        if (entry.messageCode)
+            snprintf(code, sizeof(code), "0x%x", entry.messageCode);
+        printf("%10s %10llu %12.3f %10.2f %10.2f\n", code,
+            static_cast<unsigned long long>(entry.count), entry.total / 1e6, entry.total / 1e3 / entry.count, entry.max / 1e3);
+    }
+    return 0;
+}